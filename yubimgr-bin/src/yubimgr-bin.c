@@ -19,6 +19,7 @@ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
 OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 SOFTWARE.
 */
+#include <limits.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -26,7 +27,18 @@ SOFTWARE.
 #include <argp.h>
 
 #include <yubimgr/yubimgr.h>
+#include <yubimgr/audit.h>
+#include <yubimgr/identity.h>
+#include <yubimgr/keygen.h>
 #include <yubimgr/logging.h>
+#include <yubimgr/metrics.h>
+#include <yubimgr/personalize.h>
+#include <yubimgr/piv.h>
+#include <yubimgr/renew.h>
+#include <yubimgr/revocation.h>
+#include <yubimgr/simulate.h>
+#include <yubimgr/timeout.h>
+#include <yubimgr/trace.h>
 
 const char* program_version     = PACKAGE_STRING;
 const char* program_bug_address = PACKAGE_BUGREPORT;
@@ -34,13 +46,59 @@ const char* program_bug_address = PACKAGE_BUGREPORT;
 static char doc[] =
     "yubimgr -- Bootstrap and manage YubiKeys OpenPGP/PIV applets.";
 
+static char args_doc[] = "[PATTERN...]";
+
 enum {
     // Options
     OPTION_LOG_LEVEL = 'v',
+    OPTION_DN_SUFFIX = 0x200,
+    OPTION_PIV_RESET,
+    OPTION_PIV_GENERATE,
+    OPTION_PIV_CERTIFICATE,
+    OPTION_PIV_MANAGEMENT_KEY,
+    OPTION_PIV_NEW_MANAGEMENT_KEY,
+    OPTION_PIV_MANAGEMENT_ALGORITHM,
+    OPTION_PIV_NEW_MANAGEMENT_ALGORITHM,
+    OPTION_PIV_PUBLIC_KEY,
+    OPTION_PIV_NEW_PIN,
+    OPTION_PIV_NEW_PUK,
+    OPTION_PIV_CURRENT_PIN,
+    OPTION_PIV_CURRENT_PUK,
+    OPTION_METRICS,
+    OPTION_TIMEOUT,
+    OPTION_PHASE_TIMEOUT,
+    OPTION_REVOCATION_STORE,
+    OPTION_PUBLISH,
+    OPTION_AUDIT_LOG,
+    OPTION_SIMULATE,
+    OPTION_READERS,
+    OPTION_LATENCY_MODEL,
+    OPTION_KEYGEN,
+    OPTION_KEY_PROFILE,
+    OPTION_BACKUP_DIR,
+    OPTION_PERSONALIZE,
+    OPTION_CARD_LANGUAGE,
+    OPTION_CARD_URL,
+    OPTION_CARD_RESET_CODE,
+    OPTION_TOUCH_POLICY,
+    OPTION_EXPIRE,
+    OPTION_WORKERS,
+    OPTION_IDENTITY_INDEX,
+    OPTION_ROSTER,
+    OPTION_TRACE,
+    OPTION_SEED,
     // Actions
     ACTION_BOOTSTRAP = 'b',
     ACTION_RESET     = 'r',
     ACTION_STATUS    = 's',
+    // Long only actions
+    ACTION_EXPORT_SSH  = 0x100,
+    ACTION_EXPORT_CSR  = 0x101,
+    ACTION_PIV         = 0x102,
+    ACTION_REVOKE      = 0x103,
+    ACTION_AUDIT_QUERY = 0x104,
+    ACTION_EXPORT_KEYS = 0x105,
+    ACTION_RENEW       = 0x106,
     // Information
     INFO_USERNAME  = 'u',
     INFO_FIRSTNAME = 'f',
@@ -50,22 +108,193 @@ enum {
 
 struct arguments {
     const char* log_level;
-    char action;
+    int action;
+    const char* output;
+    const char* dn_suffix;
+    const char* metrics;
+    const char* trace;
+    const char* revocation_store;
+    const char* backup_dir;
+    int publish;
+    const char* audit_log;
+    const char* audit_query;
+    const char* expire;
+    size_t workers;
+    const char* identity_index;
+    const char* roster;
+    struct simulation simulation;
+    int seed_set;
+    enum KEYGEN_MODE keygen;
+    enum KEYGEN_PROFILE key_profile;
+    double timeout;
+    int timeout_set;
+    int phase_timeouts_set[PHASE_COUNT];
+    const char** patterns;
     char username[256];
     char firstname[256];
     char lastname[256];
     char email[256];
     char passphrase[256];
+    struct piv_config piv;
+    int piv_options;
+    int piv_new_pin_set;
+    int piv_new_puk_set;
+    char piv_pin[256];
+    char piv_puk[256];
+    unsigned char piv_management_key[PIV_MANAGEMENT_KEY_MAX_SIZE];
+    unsigned char piv_new_management_key[PIV_MANAGEMENT_KEY_MAX_SIZE];
+    int personalize;
+    int card_reset_code_set;
+    struct personalization personalization;
+    char card_user_pin[128];
+    char card_admin_pin[128];
+    char card_reset_code[128];
 };
 
 static struct argp_option options[] = {
     // Options
     {"log-level", OPTION_LOG_LEVEL, "LOG_LEVEL", 0,
      "Logging level (trace|debug|info|warning|error)", 0},
+    {"metrics", OPTION_METRICS, "FILE", 0,
+     "Write metrics to FILE after every card and on exit (Prometheus "
+     "textfile format).",
+     0},
+    {"trace", OPTION_TRACE, "FILE", 0,
+     "Write the phases of every card to FILE on exit (Chrome trace format, "
+     "for chrome://tracing or Perfetto).",
+     0},
+    {"timeout", OPTION_TIMEOUT, "SECONDS", 0,
+     "Cancel any phase running longer than SECONDS (0 for no limit).", 0},
+    {"phase-timeout", OPTION_PHASE_TIMEOUT, "PHASE=SECONDS", 0,
+     "Override the timeout of a single phase (e.g. \"piv=60\").", 0},
+    {"revocation-store", OPTION_REVOCATION_STORE, "DIR", 0,
+     "Revocation certificates store (written by bootstrap, read by revoke).",
+     0},
+    {"audit-log", OPTION_AUDIT_LOG, "FILE", 0,
+     "Append a record of every operation to the binary audit log FILE.", 0},
+    {"simulate", OPTION_SIMULATE, "CARDS", 0,
+     "Dry run bootstrap or reset over CARDS simulated cards, and print the "
+     "projected station throughput.",
+     0},
+    {"readers", OPTION_READERS, "N", 0,
+     "Number of card readers of the simulated station (1 by default).", 0},
+    {"latency-model", OPTION_LATENCY_MODEL, "FILE", 0,
+     "Metrics FILE (see --metrics) the simulated phase timings are drawn "
+     "from.",
+     0},
+    {"seed", OPTION_SEED, "SEED", 0,
+     "Seed of the simulated timings and failures (1 by default), the same "
+     "seed replays the same run.",
+     0},
+    {"keygen", OPTION_KEYGEN, "MODE", 0,
+     "Subkey generation: \"addkey\" (encryption subkey by gpg, default) or "
+     "\"host\" (all subkeys generated in parallel on the host, backed up, "
+     "then moved to the card).",
+     0},
+    {"key-profile", OPTION_KEY_PROFILE, "PROFILE", 0,
+     "Algorithm of host generated subkeys "
+     "(rsa2048|rsa3072|rsa4096|ed25519).",
+     0},
+    {"backup-dir", OPTION_BACKUP_DIR, "DIR", 0,
+     "Offline storage the masterkey and its secret subkeys are exported to.",
+     0},
+    {"personalize", OPTION_PERSONALIZE, 0, 0,
+     "Personalize the card at the end of bootstrap: PINs, cardholder name, "
+     "login, language, URL and touch policies, in a single card session.",
+     0},
+    {"card-language", OPTION_CARD_LANGUAGE, "LANG", 0,
+     "Language preference written to the card (e.g. \"en\").", 0},
+    {"card-url", OPTION_CARD_URL, "URL", 0,
+     "Public key URL written to the card, a \"%s\" is replaced by the "
+     "masterkey fingerprint.",
+     0},
+    {"card-reset-code", OPTION_CARD_RESET_CODE, 0, 0,
+     "Also set the card reset code (prompted like the PINs), which unblocks "
+     "the user PIN without the admin PIN.",
+     0},
+    {"touch-policy", OPTION_TOUCH_POLICY, "KEY=POLICY", 0,
+     "Touch policy of a card key (sig|dec|aut) "
+     "(off|on|fixed|cached|cached-fixed).",
+     0},
+    {"expire", OPTION_EXPIRE, "PERIOD", 0,
+     "New validity of the renewed subkeys, as accepted by gpg (e.g. \"1y\").",
+     0},
+    {"workers", OPTION_WORKERS, "N", 0,
+     "Parallel renewal workers, each with its own keyring (one per CPU by "
+     "default).",
+     0},
+    {"identity-index", OPTION_IDENTITY_INDEX, "FILE", 0,
+     "Index of the users who already have a masterkey: bootstrap refuses "
+     "them, and indexes every completed bootstrap.",
+     0},
+    {"roster", OPTION_ROSTER, "FILE", 0,
+     "Bootstrap a card for every \"username,firstname,lastname,email\" row "
+     "of the CSV FILE. Duplicate rows and users who already have a "
+     "masterkey are written to FILE.rejected instead.",
+     0},
+    {"publish", OPTION_PUBLISH, 0, 0,
+     "Send revoked keys to the configured keyservers.", 0},
+    {"dn-suffix", OPTION_DN_SUFFIX, "DN", 0,
+     "RDNs appended to the CSR subject (e.g. \"O=Corp,C=FR\").", 0},
+    {"piv-reset", OPTION_PIV_RESET, 0, 0,
+     "Reset the PIV applet to factory before provisioning.", 0},
+    {"piv-generate", OPTION_PIV_GENERATE, "SLOT:ALGO", 0,
+     "Generate a key in a PIV slot (9a|9c|9d|9e) "
+     "(rsa1024|rsa2048|eccp256|eccp384).",
+     0},
+    {"piv-certificate", OPTION_PIV_CERTIFICATE, "SLOT:FILE", 0,
+     "Import a DER certificate in a PIV slot.", 0},
+    {"piv-public-key", OPTION_PIV_PUBLIC_KEY, "SLOT:FILE", 0,
+     "Write the public key generated in a PIV slot to FILE (PEM).", 0},
+    {"piv-new-pin", OPTION_PIV_NEW_PIN, 0, 0,
+     "Change the PIV PIN (prompted).", 0},
+    {"piv-new-puk", OPTION_PIV_NEW_PUK, 0, 0,
+     "Change the PIV PUK (prompted).", 0},
+    {"piv-current-pin", OPTION_PIV_CURRENT_PIN, "PIN", 0,
+     "Current PIV PIN, required by --piv-new-pin without --piv-reset.", 0},
+    {"piv-current-puk", OPTION_PIV_CURRENT_PUK, "PUK", 0,
+     "Current PIV PUK, required by --piv-new-puk without --piv-reset.", 0},
+    {"piv-management-key", OPTION_PIV_MANAGEMENT_KEY, "HEX", 0,
+     "Current PIV management key (factory key by default).", 0},
+    {"piv-management-algorithm", OPTION_PIV_MANAGEMENT_ALGORITHM, "ALGO", 0,
+     "Algorithm of the current PIV management key "
+     "(3des|aes128|aes192|aes256), asked to the card by default.",
+     0},
+    {"piv-new-management-key", OPTION_PIV_NEW_MANAGEMENT_KEY, "HEX", 0,
+     "New PIV management key.", 0},
+    {"piv-new-management-algorithm", OPTION_PIV_NEW_MANAGEMENT_ALGORITHM,
+     "ALGO", 0,
+     "Algorithm of the new PIV management key (the current one by "
+     "default).",
+     0},
     // Actions
     {"status", ACTION_STATUS, 0, 0, "Print smartcard status.", 0},
     {"reset", ACTION_RESET, 0, 0, "Reset smartcard to factory.", 0},
     {"bootstrap", ACTION_BOOTSTRAP, 0, 0, "Bootstrap new masterkey.", 0},
+    {"export-ssh", ACTION_EXPORT_SSH, "DIR", 0,
+     "Export SSH public keys of the keys matching PATTERN (all keys by "
+     "default) to DIR, along with an authorized_keys bundle.",
+     0},
+    {"piv", ACTION_PIV, 0, 0, "Provision the PIV applet.", 0},
+    {"export-csr", ACTION_EXPORT_CSR, "FILE", 0,
+     "Generate X.509 CSRs for the authentication subkeys of the keys "
+     "matching PATTERN as a single PEM bundle FILE (plus FILE.manifest).",
+     0},
+    {"revoke", ACTION_REVOKE, "FILE", OPTION_ARG_OPTIONAL,
+     "Revoke the keys designated by PATTERN (fingerprint, email or card "
+     "serial) from the revocation store, optionally exporting them to FILE.",
+     0},
+    {"audit-query", ACTION_AUDIT_QUERY, "FIELD=VALUE", 0,
+     "Print the audit log records matching serial=, user= or fpr=.", 0},
+    {"export-keys", ACTION_EXPORT_KEYS, "DIR", 0,
+     "Export the public keys matching PATTERN (all keys by default) to DIR, "
+     "as a keyring.gpg bundle and a Web Key Directory tree.",
+     0},
+    {"renew", ACTION_RENEW, "FILE", 0,
+     "Extend the subkeys validity (see --expire) of the masterkeys matching "
+     "PATTERN (fingerprint or key ID, all by default) in the backup "
+     "directory, and write the updated public keys to the keyring FILE.",
+     0},
     // Info
     {"username", INFO_USERNAME, "USERNAME", 0, "Provide username.", 0},
     {"firstname", INFO_FIRSTNAME, "FIRSTNAME", 0, "Provide first name.", 0},
@@ -75,9 +304,22 @@ static struct argp_option options[] = {
     {0},
 };
 
-void read_info(const char* prompt, size_t min, size_t max, char* out, int echo)
+// Prompts until the answer is between min and max characters long. Size is
+// the size of out.
+void read_info(const char* prompt,
+               size_t min,
+               size_t max,
+               char* out,
+               size_t size,
+               int echo)
 {
-    while (strlen(out) < min) {
+    while (strlen(out) < min || strlen(out) > max) {
+        if (strlen(out) > max) {
+            log_error("%s must be at most %zu characters long.\n", prompt,
+                      max);
+            memset(out, 0, size);
+        }
+
         printf("%s: ", prompt);
         fflush(stdout);
 
@@ -96,8 +338,12 @@ void read_info(const char* prompt, size_t min, size_t max, char* out, int echo)
             }
         }
 
-        if (!fgets(out, max, stdin))
-            continue;
+        if (!fgets(out, size, stdin)) {
+            if (!echo)
+                tcsetattr(fileno(stdin), TCSAFLUSH, &old_termattrs);
+            log_error("Failed to read %s.\n", prompt);
+            exit(EXIT_FAILURE);
+        }
 
         if (!echo) {
             tcsetattr(fileno(stdin), TCSAFLUSH, &old_termattrs);
@@ -114,6 +360,76 @@ void read_info(const char* prompt, size_t min, size_t max, char* out, int echo)
         puts("\r");
 }
 
+static int parse_hex(const char* hex, unsigned char* out, size_t size)
+{
+    if (strlen(hex) != 2 * size)
+        return 1;
+
+    for (size_t i = 0; i < size; ++i) {
+        unsigned int byte;
+        if (sscanf(hex + 2 * i, "%2x", &byte) != 1)
+            return 1;
+        out[i] = byte;
+    }
+
+    return 0;
+}
+
+// Management keys are 16, 24 or 32 bytes long, depending on the algorithm
+static void parse_management_key(struct argp_state* state,
+                                 const char* hex,
+                                 unsigned char* out,
+                                 size_t* size)
+{
+    *size = strlen(hex) / 2;
+    if ((*size != 16 && *size != 24 && *size != 32) ||
+        parse_hex(hex, out, *size))
+        argp_error(state, "management key must be 32, 48 or 64 hex digits.");
+}
+
+static void parse_piv_slot(struct argp_state* state,
+                           char* arg,
+                           struct piv_slot_config** slot_config,
+                           const char** value)
+{
+    struct arguments* arguments = state->input;
+    enum PIV_SLOT slot;
+
+    char* separator = strchr(arg, ':');
+    if (!separator)
+        argp_error(state, "expected SLOT:VALUE, got \"%s\".", arg);
+    *separator = 0;
+    arguments->piv_options = 1;
+
+    if (piv_parse_slot(arg, &slot))
+        argp_error(state, "invalid PIV slot \"%s\".", arg);
+
+    *slot_config = &arguments->piv.slots[slot];
+    *value       = separator + 1;
+}
+
+static double parse_seconds(struct argp_state* state, const char* arg)
+{
+    char* end;
+    double seconds = strtod(arg, &end);
+
+    if (end == arg || *end || seconds < 0)
+        argp_error(state, "invalid timeout \"%s\".", arg);
+
+    return seconds;
+}
+
+static size_t parse_count(struct argp_state* state, const char* arg)
+{
+    char* end;
+    unsigned long count = strtoul(arg, &end, 10);
+
+    if (end == arg || *end || !count)
+        argp_error(state, "invalid count \"%s\".", arg);
+
+    return count;
+}
+
 static error_t parse_opt(int key, char* arg, struct argp_state* state)
 {
     state->name = PACKAGE_NAME;
@@ -124,13 +440,204 @@ static error_t parse_opt(int key, char* arg, struct argp_state* state)
         case OPTION_LOG_LEVEL:
             arguments->log_level = arg;
             break;
+        case OPTION_DN_SUFFIX:
+            arguments->dn_suffix = arg;
+            break;
+        case OPTION_METRICS:
+            arguments->metrics = arg;
+            break;
+        case OPTION_TRACE:
+            arguments->trace = arg;
+            break;
+        case OPTION_REVOCATION_STORE:
+            arguments->revocation_store = arg;
+            break;
+        case OPTION_PUBLISH:
+            arguments->publish = 1;
+            break;
+        case OPTION_AUDIT_LOG:
+            arguments->audit_log = arg;
+            break;
+        case OPTION_SIMULATE:
+            arguments->simulation.cards = parse_count(state, arg);
+            break;
+        case OPTION_READERS:
+            arguments->simulation.readers = parse_count(state, arg);
+            break;
+        case OPTION_LATENCY_MODEL:
+            arguments->simulation.model = arg;
+            break;
+        case OPTION_SEED: {
+            char* end;
+            unsigned long seed = strtoul(arg, &end, 10);
+            if (end == arg || *end || seed > UINT_MAX)
+                argp_error(state, "invalid seed \"%s\".", arg);
+            arguments->simulation.seed = (unsigned int)seed;
+            arguments->seed_set        = 1;
+            break;
+        }
+        case OPTION_KEYGEN:
+            if (!strcmp(arg, "addkey"))
+                arguments->keygen = KEYGEN_ADDKEY;
+            else if (!strcmp(arg, "host"))
+                arguments->keygen = KEYGEN_HOST;
+            else
+                argp_error(state, "invalid keygen mode \"%s\".", arg);
+            break;
+        case OPTION_KEY_PROFILE:
+            if (keygen_parse_profile(arg, &arguments->key_profile))
+                argp_error(state, "invalid key profile \"%s\".", arg);
+            break;
+        case OPTION_BACKUP_DIR:
+            arguments->backup_dir = arg;
+            break;
+        case OPTION_PERSONALIZE:
+            arguments->personalize = 1;
+            break;
+        case OPTION_CARD_LANGUAGE:
+            arguments->personalization.language = arg;
+            break;
+        case OPTION_CARD_URL:
+            arguments->personalization.url = arg;
+            break;
+        case OPTION_CARD_RESET_CODE:
+            arguments->card_reset_code_set = 1;
+            break;
+        case OPTION_TOUCH_POLICY: {
+            enum CARD_KEY card_key;
+            char* separator = strchr(arg, '=');
+            if (!separator)
+                argp_error(state, "expected KEY=POLICY, got \"%s\".", arg);
+            *separator = 0;
+            if (touch_parse_key(arg, &card_key))
+                argp_error(state, "invalid card key \"%s\".", arg);
+            if (touch_parse_policy(separator + 1,
+                                   &arguments->personalization.touch[card_key]))
+                argp_error(state, "invalid touch policy \"%s\".",
+                           separator + 1);
+            break;
+        }
+        case OPTION_EXPIRE:
+            arguments->expire = arg;
+            break;
+        case OPTION_WORKERS:
+            arguments->workers = parse_count(state, arg);
+            break;
+        case OPTION_IDENTITY_INDEX:
+            arguments->identity_index = arg;
+            break;
+        case OPTION_ROSTER:
+            arguments->roster = arg;
+            break;
+        case OPTION_TIMEOUT:
+            arguments->timeout     = parse_seconds(state, arg);
+            arguments->timeout_set = 1;
+            break;
+        case OPTION_PHASE_TIMEOUT: {
+            enum PHASE phase;
+            char* separator = strchr(arg, '=');
+            if (!separator)
+                argp_error(state, "expected PHASE=SECONDS, got \"%s\".", arg);
+            *separator = 0;
+            if (phase_parse(arg, &phase))
+                argp_error(state, "invalid phase \"%s\".", arg);
+            set_phase_timeout(phase, parse_seconds(state, separator + 1));
+            arguments->phase_timeouts_set[phase] = 1;
+            break;
+        }
+        case OPTION_PIV_RESET:
+            arguments->piv.reset   = 1;
+            arguments->piv_options = 1;
+            break;
+        case OPTION_PIV_GENERATE:
+        case OPTION_PIV_CERTIFICATE:
+        case OPTION_PIV_PUBLIC_KEY: {
+            struct piv_slot_config* slot_config;
+            const char* value;
+            parse_piv_slot(state, arg, &slot_config, &value);
+            if (key == OPTION_PIV_CERTIFICATE)
+                slot_config->certificate = value;
+            else if (key == OPTION_PIV_PUBLIC_KEY)
+                slot_config->public_key = value;
+            else if (piv_parse_algorithm(value, &slot_config->algorithm))
+                argp_error(state, "invalid PIV algorithm \"%s\".", value);
+            break;
+        }
+        case OPTION_PIV_NEW_PIN:
+            arguments->piv_new_pin_set = 1;
+            arguments->piv_options     = 1;
+            break;
+        case OPTION_PIV_NEW_PUK:
+            arguments->piv_new_puk_set = 1;
+            arguments->piv_options     = 1;
+            break;
+        case OPTION_PIV_CURRENT_PIN:
+        case OPTION_PIV_CURRENT_PUK:
+            // PIV PINs and PUKs are padded to 8 bytes on the card
+            if (strlen(arg) < 6 || strlen(arg) > 8)
+                argp_error(state, "PIV PIN and PUK are 6 to 8 characters.");
+            if (key == OPTION_PIV_CURRENT_PIN)
+                arguments->piv.current_pin = arg;
+            else
+                arguments->piv.current_puk = arg;
+            arguments->piv_options = 1;
+            break;
+        case OPTION_PIV_MANAGEMENT_KEY:
+            parse_management_key(state, arg, arguments->piv_management_key,
+                                 &arguments->piv.management_key_size);
+            arguments->piv.management_key = arguments->piv_management_key;
+            arguments->piv_options        = 1;
+            break;
+        case OPTION_PIV_NEW_MANAGEMENT_KEY:
+            parse_management_key(state, arg,
+                                 arguments->piv_new_management_key,
+                                 &arguments->piv.new_management_key_size);
+            arguments->piv.new_management_key =
+                arguments->piv_new_management_key;
+            arguments->piv_options = 1;
+            break;
+        case OPTION_PIV_MANAGEMENT_ALGORITHM:
+            if (piv_parse_management_algorithm(
+                    arg, &arguments->piv.management_algorithm))
+                argp_error(state, "invalid management key algorithm \"%s\".",
+                           arg);
+            arguments->piv_options = 1;
+            break;
+        case OPTION_PIV_NEW_MANAGEMENT_ALGORITHM:
+            if (piv_parse_management_algorithm(
+                    arg, &arguments->piv.new_management_algorithm))
+                argp_error(state, "invalid management key algorithm \"%s\".",
+                           arg);
+            arguments->piv_options = 1;
+            break;
         case ACTION_STATUS:
         case ACTION_RESET:
         case ACTION_BOOTSTRAP:
+        case ACTION_PIV:
             if (arguments->action != 0)
                 argp_error(state, "only one action is possible.");
             arguments->action = key;
             break;
+        case ACTION_EXPORT_SSH:
+        case ACTION_EXPORT_CSR:
+        case ACTION_EXPORT_KEYS:
+        case ACTION_REVOKE:
+        case ACTION_RENEW:
+            if (arguments->action != 0)
+                argp_error(state, "only one action is possible.");
+            arguments->action = key;
+            arguments->output = arg;
+            break;
+        case ACTION_AUDIT_QUERY:
+            if (arguments->action != 0)
+                argp_error(state, "only one action is possible.");
+            arguments->action      = key;
+            arguments->audit_query = arg;
+            break;
+        case ARGP_KEY_ARGS:
+            arguments->patterns = (const char**)&state->argv[state->next];
+            state->next         = state->argc;
+            break;
         case INFO_USERNAME:
             strncpy(arguments->username, arg, 256);
             break;
@@ -150,6 +657,70 @@ static error_t parse_opt(int key, char* arg, struct argp_state* state)
                 argp_usage(state);
             }
 
+            // Check patterns
+            if (arguments->patterns &&
+                arguments->action != ACTION_EXPORT_SSH &&
+                arguments->action != ACTION_EXPORT_CSR &&
+                arguments->action != ACTION_EXPORT_KEYS &&
+                arguments->action != ACTION_REVOKE &&
+                arguments->action != ACTION_RENEW)
+                argp_error(state, "this action does not take patterns.");
+            if (arguments->action == ACTION_REVOKE && !arguments->patterns)
+                argp_error(state, "revoke requires at least one PATTERN.");
+            if (arguments->action == ACTION_AUDIT_QUERY &&
+                !arguments->audit_log)
+                argp_error(state, "audit-query requires --audit-log.");
+            if (arguments->action == ACTION_RENEW &&
+                (!arguments->backup_dir || !arguments->expire))
+                argp_error(state, "renew requires --backup-dir and --expire.");
+            if (arguments->roster && (arguments->action != ACTION_BOOTSTRAP ||
+                                      arguments->simulation.cards))
+                argp_error(state, "roster requires a bootstrap, which cannot "
+                                  "be simulated.");
+            if (arguments->personalize &&
+                arguments->action != ACTION_BOOTSTRAP)
+                argp_error(state, "personalize requires bootstrap.");
+            // The PINs are prompted once, and would be the same on every card
+            if (arguments->personalize && arguments->roster)
+                argp_error(state, "personalize cannot be used with --roster.");
+            if (arguments->card_reset_code_set && !arguments->personalize)
+                argp_error(state, "card-reset-code requires --personalize.");
+
+            // Check simulation
+            if (arguments->simulation.cards) {
+                if (arguments->action != ACTION_BOOTSTRAP &&
+                    arguments->action != ACTION_RESET)
+                    argp_error(state, "only bootstrap and reset can be "
+                                      "simulated.");
+                if (!arguments->simulation.model)
+                    argp_error(state, "simulate requires --latency-model.");
+                // Virtual timings would pollute the real records
+                if (arguments->audit_log || arguments->metrics)
+                    argp_error(state, "simulate cannot be used with "
+                                      "--audit-log nor --metrics.");
+                if (!arguments->simulation.readers)
+                    arguments->simulation.readers = 1;
+                if (!arguments->seed_set)
+                    arguments->simulation.seed = 1;
+                // The same placeholder identity is used for every card
+                if (!*arguments->username)
+                    strcpy(arguments->username, "simulated");
+                if (!*arguments->firstname)
+                    strcpy(arguments->firstname, "Simulated");
+                if (!*arguments->lastname)
+                    strcpy(arguments->lastname, "User");
+                if (!*arguments->email)
+                    strcpy(arguments->email, "simulated@example.org");
+            }
+
+            if (arguments->seed_set && !arguments->simulation.cards)
+                argp_error(state, "seed requires --simulate.");
+
+            // Phase specific timeouts take precedence
+            for (int i = 0; arguments->timeout_set && i < PHASE_COUNT; ++i)
+                if (!arguments->phase_timeouts_set[i])
+                    set_phase_timeout((enum PHASE)i, arguments->timeout);
+
             // Check log level
             if (arguments->log_level == NULL) {
                 set_log_level(LOG_LEVEL_DEBUG);
@@ -168,19 +739,67 @@ static error_t parse_opt(int key, char* arg, struct argp_state* state)
                            arguments->log_level);
             }
 
+            if (arguments->piv_options && arguments->action != ACTION_PIV)
+                argp_error(state, "--piv-* options require --piv.");
+            if (arguments->piv_new_pin_set && !arguments->piv.reset &&
+                !arguments->piv.current_pin)
+                argp_error(state,
+                           "piv-new-pin requires --piv-current-pin or "
+                           "--piv-reset.");
+            if (arguments->piv_new_puk_set && !arguments->piv.reset &&
+                !arguments->piv.current_puk)
+                argp_error(state,
+                           "piv-new-puk requires --piv-current-puk or "
+                           "--piv-reset.");
+
             // Check information
-            if (arguments->action == ACTION_BOOTSTRAP) {
-                read_info("Username", 3, sizeof(arguments->username),
-                          arguments->username, 1);
-                read_info("Firstname", 3, sizeof(arguments->firstname),
-                          arguments->firstname, 1);
-                read_info("Lastname", 3, sizeof(arguments->lastname),
-                          arguments->lastname, 1);
-                read_info("Email", 10, sizeof(arguments->email),
-                          arguments->email, 1);
+            if (arguments->action == ACTION_BOOTSTRAP && !arguments->roster) {
+                read_info("Username", 3, sizeof(arguments->username) - 1,
+                          arguments->username, sizeof(arguments->username),
+                          1);
+                read_info("Firstname", 3, sizeof(arguments->firstname) - 1,
+                          arguments->firstname, sizeof(arguments->firstname),
+                          1);
+                read_info("Lastname", 3, sizeof(arguments->lastname) - 1,
+                          arguments->lastname, sizeof(arguments->lastname),
+                          1);
+                read_info("Email", 10, sizeof(arguments->email) - 1,
+                          arguments->email, sizeof(arguments->email), 1);
                 // read_info("Passphrase", 10, sizeof(arguments->passphrase),
                 //          arguments->passphrase, 0);
             }
+            if (arguments->personalize && !arguments->simulation.cards) {
+                read_info("Card user PIN", 6,
+                          sizeof(arguments->card_user_pin) - 1,
+                          arguments->card_user_pin,
+                          sizeof(arguments->card_user_pin), 0);
+                read_info("Card admin PIN", 8,
+                          sizeof(arguments->card_admin_pin) - 1,
+                          arguments->card_admin_pin,
+                          sizeof(arguments->card_admin_pin), 0);
+                arguments->personalization.new_user_pin =
+                    arguments->card_user_pin;
+                arguments->personalization.new_admin_pin =
+                    arguments->card_admin_pin;
+                if (arguments->card_reset_code_set) {
+                    read_info("Card reset code", 8,
+                              sizeof(arguments->card_reset_code) - 1,
+                              arguments->card_reset_code,
+                              sizeof(arguments->card_reset_code), 0);
+                    arguments->personalization.reset_code =
+                        arguments->card_reset_code;
+                }
+            }
+            if (arguments->piv_new_pin_set) {
+                read_info("PIV PIN", 6, 8, arguments->piv_pin,
+                          sizeof(arguments->piv_pin), 0);
+                arguments->piv.pin = arguments->piv_pin;
+            }
+            if (arguments->piv_new_puk_set) {
+                read_info("PIV PUK", 6, 8, arguments->piv_puk,
+                          sizeof(arguments->piv_puk), 0);
+                arguments->piv.puk = arguments->piv_puk;
+            }
             break;
         default:
             return ARGP_ERR_UNKNOWN;
@@ -189,7 +808,78 @@ static error_t parse_opt(int key, char* arg, struct argp_state* state)
     return 0;
 }
 
-static struct argp argp = {options, parse_opt, 0, doc, 0, 0, 0};
+static const char* metrics_path;
+
+static void write_metrics_at_exit()
+{
+    write_metrics(metrics_path);
+}
+
+static const char* trace_path;
+
+static void write_trace_at_exit()
+{
+    write_trace(trace_path);
+}
+
+static int run_card(void* opaque)
+{
+    const struct arguments* arguments = (const struct arguments*)opaque;
+
+    if (arguments->action == ACTION_RESET)
+        return reset();
+
+    return bootstrap(arguments->username, arguments->firstname,
+                     arguments->lastname, arguments->email,
+                     /*arguments.passphrase*/ "this is a test");
+}
+
+// Bootstraps a card for every identity of the roster, one after the other
+static int bootstrap_roster(const char* path)
+{
+    struct roster roster;
+    char rejected_path[1024];
+    char line[16];
+
+    snprintf(rejected_path, sizeof(rejected_path), "%s.rejected", path);
+    FILE* rejected = fopen(rejected_path, "w");
+    if (!rejected) {
+        log_error("Failed to open \"%s\".\n", rejected_path);
+        return 1;
+    }
+    int err = roster_load(path, rejected, &roster);
+    if (fclose(rejected) || err)
+        return 1;
+
+    size_t done   = 0;
+    size_t failed = 0;
+    for (; done < roster.count; ++done) {
+        const struct identity* identity = &roster.identities[done];
+        set_queue_depth(roster.count - done - 1);
+        printf("Insert the card of %s <%s> (%zu/%zu) and press Enter: ",
+               identity->username, identity->email, done + 1, roster.count);
+        fflush(stdout);
+        if (!fgets(line, sizeof(line), stdin))
+            break;
+        if (bootstrap(identity->username, identity->firstname,
+                      identity->lastname, identity->email,
+                      /*arguments.passphrase*/ "this is a test") != 0)
+            failed++;
+        // Collectors follow the roster as it goes, not only at exit
+        if (metrics_path)
+            write_metrics(metrics_path);
+    }
+
+    set_queue_depth(0);
+    log_info("Bootstrapped %zu cards out of %zu (%zu failed).\n",
+             done - failed, roster.count, failed);
+    err = failed || done != roster.count;
+    roster_release(&roster);
+
+    return err;
+}
+
+static struct argp argp = {options, parse_opt, args_doc, doc, 0, 0, 0};
 
 int main(int argc, char** argv)
 {
@@ -198,9 +888,49 @@ int main(int argc, char** argv)
 
     struct arguments arguments = {0};
 
+    // Prompts may already log errors
+    set_log_file(stdout);
+
     argp_parse(&argp, argc, argv, 0, 0, &arguments);
 
-    set_log_file(stdout);
+    // Metrics are written whatever the outcome of the action
+    if (arguments.metrics) {
+        metrics_path = arguments.metrics;
+        atexit(write_metrics_at_exit);
+    }
+    if (arguments.trace) {
+        trace_path = arguments.trace;
+        start_trace();
+        atexit(write_trace_at_exit);
+    }
+
+    set_keygen(arguments.keygen, arguments.key_profile);
+
+    if (arguments.backup_dir)
+        set_backup_dir(arguments.backup_dir);
+
+    if (arguments.identity_index)
+        set_identity_index(arguments.identity_index);
+
+    if (arguments.personalize)
+        set_personalization(&arguments.personalization);
+
+    if (arguments.revocation_store)
+        set_revocation_store(arguments.revocation_store);
+
+    if (arguments.audit_log && arguments.action != ACTION_AUDIT_QUERY &&
+        set_audit_log(arguments.audit_log) != 0)
+        return EXIT_FAILURE;
+
+    if (arguments.simulation.cards) {
+        struct simulation_report report;
+        if (simulate(&arguments.simulation, run_card, &arguments, &report)) {
+            log_error("Failed to perform simulation.\n");
+            return EXIT_FAILURE;
+        }
+        write_simulation_report(&report, stdout);
+        return EXIT_SUCCESS;
+    }
 
     switch (arguments.action) {
         case ACTION_STATUS:
@@ -216,6 +946,13 @@ int main(int argc, char** argv)
             }
             break;
         case ACTION_BOOTSTRAP:
+            if (arguments.roster) {
+                if (bootstrap_roster(arguments.roster) != 0) {
+                    log_error("Failed to perform \"bootstrap\" action.\n");
+                    return EXIT_FAILURE;
+                }
+                break;
+            }
             if (bootstrap(arguments.username, arguments.firstname,
                           arguments.lastname, arguments.email,
                           /*arguments.passphrase*/ "this is a test") != 0) {
@@ -223,6 +960,57 @@ int main(int argc, char** argv)
                 return EXIT_FAILURE;
             }
             break;
+        case ACTION_EXPORT_SSH:
+            if (export_ssh(arguments.patterns, arguments.output) != 0) {
+                log_error("Failed to perform \"export-ssh\" action.\n");
+                return EXIT_FAILURE;
+            }
+            break;
+        case ACTION_PIV:
+            if (piv_provision(&arguments.piv) != 0) {
+                log_error("Failed to perform \"piv\" action.\n");
+                return EXIT_FAILURE;
+            }
+            break;
+        case ACTION_EXPORT_CSR:
+            if (export_csr(arguments.patterns, arguments.output,
+                           arguments.dn_suffix) != 0) {
+                log_error("Failed to perform \"export-csr\" action.\n");
+                return EXIT_FAILURE;
+            }
+            break;
+        case ACTION_EXPORT_KEYS:
+            if (export_keys(arguments.patterns, arguments.output) != 0) {
+                log_error("Failed to perform \"export-keys\" action.\n");
+                return EXIT_FAILURE;
+            }
+            break;
+        case ACTION_RENEW: {
+            struct renewal renewal = {
+                arguments.backup_dir, arguments.expire,
+                /*arguments.passphrase*/ "this is a test", arguments.workers,
+                arguments.metrics,
+            };
+            if (renew(&renewal, arguments.patterns, arguments.output) != 0) {
+                log_error("Failed to perform \"renew\" action.\n");
+                return EXIT_FAILURE;
+            }
+            break;
+        }
+        case ACTION_REVOKE:
+            if (revoke_keys(arguments.patterns, arguments.output,
+                            arguments.publish) != 0) {
+                log_error("Failed to perform \"revoke\" action.\n");
+                return EXIT_FAILURE;
+            }
+            break;
+        case ACTION_AUDIT_QUERY:
+            if (audit_query(arguments.audit_log, arguments.audit_query,
+                            stdout) != 0) {
+                log_error("Failed to perform \"audit-query\" action.\n");
+                return EXIT_FAILURE;
+            }
+            break;
     }
 
     return EXIT_SUCCESS;
@@ -0,0 +1,41 @@
+/*
+Copyright (C) 2016 Aurelien Vallee
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef YUBIMGR_AUDIT_H
+#define YUBIMGR_AUDIT_H
+
+#include <yubimgr/yubimgr.h>
+
+#include <stdio.h>
+
+// Appends a record of every phase (and of every exported or revoked key)
+// to the binary audit log at path. Returns 0 on success.
+YUBIMGR_EXPORT
+int set_audit_log(const char* path);
+
+// Prints the records of the audit log at path matching query
+// ("serial=...", "user=..." or "fpr=...") to out, oldest first. Lookups go
+// through the sorted sidecar index (path.idx), records appended since the
+// index was last built are merged into it first.
+YUBIMGR_EXPORT
+int audit_query(const char* path, const char* query, FILE* out);
+
+#endif  // YUBIMGR_AUDIT_H
@@ -0,0 +1,46 @@
+/*
+Copyright (C) 2016 Aurelien Vallee
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef YUBIMGR_CARD_H
+#define YUBIMGR_CARD_H
+
+#include <yubimgr/yubimgr.h>
+
+// A conversation with the smartcard through gpg-agent/scdaemon. A single
+// session can be shared by the OpenPGP and PIV provisioning steps so that a
+// card is fully processed in one pass.
+struct card_session;
+
+YUBIMGR_EXPORT
+int card_open(struct card_session** session);
+
+YUBIMGR_EXPORT
+void card_close(struct card_session* session);
+
+// Application identifier of the card, as reported by scdaemon (for the
+// OpenPGP applet: D276000124 01 version(2) vendor(2) serial(4) 0000).
+YUBIMGR_EXPORT
+const char* card_serial(const struct card_session* session);
+
+YUBIMGR_EXPORT
+int reset_session(struct card_session* session);
+
+#endif  // YUBIMGR_CARD_H
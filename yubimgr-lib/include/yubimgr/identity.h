@@ -0,0 +1,70 @@
+/*
+Copyright (C) 2016 Aurelien Vallee
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef YUBIMGR_IDENTITY_H
+#define YUBIMGR_IDENTITY_H
+
+#include <yubimgr/yubimgr.h>
+
+#include <stddef.h>
+#include <stdio.h>
+
+struct identity {
+    const char* username;
+    const char* firstname;
+    const char* lastname;
+    const char* email;
+};
+
+// Identities of a roster, pointing into its buffer
+struct roster {
+    struct identity* identities;
+    size_t count;
+    char* buffer;
+};
+
+// Index file of the identities bootstrap() issued a masterkey for, keyed by
+// username and email (case insensitive) and masterkey fingerprint.
+// bootstrap() refuses an identity already indexed, and indexes it once
+// complete.
+YUBIMGR_EXPORT
+void set_identity_index(const char* path);
+
+// Returns 1 and copies the fingerprint of the masterkey already issued for
+// the username or email (either may be NULL), 0 otherwise, and -1 when the
+// index cannot be read.
+YUBIMGR_EXPORT
+int identity_find(const char* username,
+                  const char* email,
+                  char* fpr,
+                  size_t size);
+
+// Loads a CSV roster of "username,firstname,lastname,email" rows (an
+// optional header row starts with "username"). Rows that are malformed,
+// already have a masterkey, or repeat a username or email of an earlier row
+// are not loaded: they are written to rejected, with the reason appended.
+YUBIMGR_EXPORT
+int roster_load(const char* path, FILE* rejected, struct roster* roster);
+
+YUBIMGR_EXPORT
+void roster_release(struct roster* roster);
+
+#endif  // YUBIMGR_IDENTITY_H
@@ -0,0 +1,63 @@
+/*
+Copyright (C) 2016 Aurelien Vallee
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef YUBIMGR_KEYGEN_H
+#define YUBIMGR_KEYGEN_H
+
+#include <yubimgr/yubimgr.h>
+
+// How bootstrap() creates the subkeys of a new masterkey
+enum KEYGEN_MODE {
+    // A single encryption subkey, generated by gpg (keyedit addkey)
+    KEYGEN_ADDKEY = 0,
+    // Signing, encryption and authentication subkeys generated in parallel
+    // on the host, backed up with the masterkey, then moved to the card
+    // (keyedit keytocard)
+    KEYGEN_HOST,
+};
+
+// Algorithms of the host generated subkeys
+enum KEYGEN_PROFILE {
+    KEYGEN_RSA2048 = 0,
+    KEYGEN_RSA3072,
+    KEYGEN_RSA4096,
+    // Ed25519 for signing and authentication, Curve25519 for encryption
+    KEYGEN_ED25519,
+    KEYGEN_PROFILE_COUNT,
+};
+
+YUBIMGR_EXPORT
+void set_keygen(enum KEYGEN_MODE mode, enum KEYGEN_PROFILE profile);
+
+YUBIMGR_EXPORT
+const char* keygen_profile_name(enum KEYGEN_PROFILE profile);
+
+// Parses a profile name as printed by keygen_profile_name(). Returns 0 on
+// success.
+YUBIMGR_EXPORT
+int keygen_parse_profile(const char* name, enum KEYGEN_PROFILE* profile);
+
+// Directory (the offline storage) the masterkey and its secret subkeys are
+// exported to by bootstrap(), one armored FINGERPRINT.asc file per key.
+YUBIMGR_EXPORT
+void set_backup_dir(const char* path);
+
+#endif  // YUBIMGR_KEYGEN_H
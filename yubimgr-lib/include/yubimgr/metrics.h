@@ -0,0 +1,67 @@
+/*
+Copyright (C) 2016 Aurelien Vallee
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef YUBIMGR_METRICS_H
+#define YUBIMGR_METRICS_H
+
+#include <yubimgr/yubimgr.h>
+
+#include <stddef.h>
+
+enum PHASE {
+    PHASE_SETUP = 0,
+    PHASE_MASTERKEY,
+    PHASE_SUBKEY,
+    PHASE_EXPORT_MASTERKEY,
+    PHASE_RESET,
+    PHASE_STATUS,
+    PHASE_PIV,
+    PHASE_EXPORT_SSH,
+    PHASE_EXPORT_CSR,
+    PHASE_REVOCATION,
+    PHASE_REVOKE,
+    PHASE_EXPORT_KEYS,
+    PHASE_KEYTOCARD,
+    PHASE_PERSONALIZE,
+    PHASE_RENEW,
+    PHASE_COUNT,
+};
+
+YUBIMGR_EXPORT
+const char* phase_name(enum PHASE phase);
+
+// Parses a phase name as printed by phase_name(). Returns 0 on success.
+YUBIMGR_EXPORT
+int phase_parse(const char* name, enum PHASE* phase);
+
+YUBIMGR_EXPORT
+void set_queue_depth(size_t depth);
+
+// Monotonic time in seconds (the virtual clock while simulating)
+YUBIMGR_EXPORT
+double monotonic_now();
+
+// Atomically writes every metric to path, in the Prometheus text format
+// (suitable for the node_exporter textfile collector).
+YUBIMGR_EXPORT
+int write_metrics(const char* path);
+
+#endif  // YUBIMGR_METRICS_H
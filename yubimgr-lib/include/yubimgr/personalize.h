@@ -0,0 +1,90 @@
+/*
+Copyright (C) 2016 Aurelien Vallee
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef YUBIMGR_PERSONALIZE_H
+#define YUBIMGR_PERSONALIZE_H
+
+#include <yubimgr/yubimgr.h>
+#include <yubimgr/card.h>
+
+enum CARD_KEY {
+    CARD_KEY_SIGNATURE = 0,
+    CARD_KEY_DECRYPTION,
+    CARD_KEY_AUTHENTICATION,
+    CARD_KEY_COUNT,
+};
+
+// YubiKey touch policies (user interaction flag) of the OpenPGP keys
+enum TOUCH_POLICY {
+    TOUCH_UNSET = 0,
+    TOUCH_OFF,
+    TOUCH_ON,
+    TOUCH_FIXED,
+    TOUCH_CACHED,
+    TOUCH_CACHED_FIXED,
+};
+
+// OpenPGP applet personalization. NULL fields are left untouched. The
+// current PINs default to the factory ones.
+struct personalization {
+    const char* admin_pin;
+    const char* user_pin;
+    // New admin PIN (8 to 127 characters), user PIN (6 to 127 characters)
+    // and reset code (8 to 127 characters)
+    const char* new_admin_pin;
+    const char* new_user_pin;
+    const char* reset_code;
+    // Cardholder name, login data, language preference (e.g. "en") and
+    // public key URL
+    const char* firstname;
+    const char* lastname;
+    const char* login;
+    const char* language;
+    const char* url;
+    enum TOUCH_POLICY touch[CARD_KEY_COUNT];
+};
+
+YUBIMGR_EXPORT
+int touch_parse_key(const char* name, enum CARD_KEY* key);
+
+YUBIMGR_EXPORT
+int touch_parse_policy(const char* name, enum TOUCH_POLICY* policy);
+
+// Verifies the admin PIN once and writes every field in the same card
+// session, each with its own status check. PINs are changed last, and only
+// once every other field was written, so that a failed personalization can
+// be run again with the same PINs. The admin PIN is changed before the user
+// PIN: if the latter fails, the card is left with the new admin PIN and the
+// old user PIN.
+YUBIMGR_EXPORT
+int personalize_session(struct card_session* session,
+                        const struct personalization* config);
+
+YUBIMGR_EXPORT
+int personalize(const struct personalization* config);
+
+// Personalizes the card at the end of bootstrap(), from config completed
+// with the user record (name, login). A "%s" in the URL is replaced by the
+// masterkey fingerprint. NULL disables the stage.
+YUBIMGR_EXPORT
+void set_personalization(const struct personalization* config);
+
+#endif  // YUBIMGR_PERSONALIZE_H
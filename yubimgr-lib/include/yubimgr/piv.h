@@ -0,0 +1,107 @@
+/*
+Copyright (C) 2016 Aurelien Vallee
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef YUBIMGR_PIV_H
+#define YUBIMGR_PIV_H
+
+#include <yubimgr/yubimgr.h>
+#include <yubimgr/card.h>
+
+#include <stddef.h>
+
+enum PIV_SLOT {
+    PIV_SLOT_AUTHENTICATION = 0,   // 9a
+    PIV_SLOT_SIGNATURE,            // 9c
+    PIV_SLOT_KEY_MANAGEMENT,       // 9d
+    PIV_SLOT_CARD_AUTHENTICATION,  // 9e
+    PIV_SLOT_COUNT,
+};
+
+// Key algorithms of the slots (RSA, ECC) and of the management key (3DES,
+// AES)
+enum PIV_ALGO {
+    PIV_ALGO_NONE    = 0x00,
+    PIV_ALGO_3DES    = 0x03,
+    PIV_ALGO_RSA1024 = 0x06,
+    PIV_ALGO_RSA2048 = 0x07,
+    PIV_ALGO_AES128  = 0x08,
+    PIV_ALGO_AES192  = 0x0A,
+    PIV_ALGO_AES256  = 0x0C,
+    PIV_ALGO_ECCP256 = 0x11,
+    PIV_ALGO_ECCP384 = 0x14,
+};
+
+// Largest management key (AES-256)
+#define PIV_MANAGEMENT_KEY_MAX_SIZE 32
+
+struct piv_slot_config {
+    // Key to generate in the slot, PIV_ALGO_NONE to leave it untouched
+    enum PIV_ALGO algorithm;
+    // Where to write the public key of the generated key (PEM
+    // SubjectPublicKeyInfo), for the CSR or certificate of the slot, or NULL
+    const char* public_key;
+    // DER certificate to import in the slot, or NULL
+    const char* certificate;
+};
+
+struct piv_config {
+    // Reset the PIV applet to factory before provisioning
+    int reset;
+    // New PIN/PUK (6 to 8 characters), or NULL to keep the current ones
+    const char* pin;
+    const char* puk;
+    // Current PIN/PUK, needed to change them unless the applet is reset
+    // first (it then has the factory ones)
+    const char* current_pin;
+    const char* current_puk;
+    // Algorithm of the current management key, PIV_ALGO_NONE to ask the
+    // card (GET METADATA, YubiKey 5.3 and later) and assume 3DES if it
+    // cannot tell. YubiKey 5.7 and later ship with an AES-192 key.
+    enum PIV_ALGO management_algorithm;
+    // Current management key. NULL means the factory key.
+    const unsigned char* management_key;
+    size_t management_key_size;
+    // New management key and its algorithm (PIV_ALGO_NONE keeps the current
+    // one). A NULL key keeps the current key.
+    enum PIV_ALGO new_management_algorithm;
+    const unsigned char* new_management_key;
+    size_t new_management_key_size;
+    struct piv_slot_config slots[PIV_SLOT_COUNT];
+};
+
+YUBIMGR_EXPORT
+int piv_parse_slot(const char* name, enum PIV_SLOT* slot);
+
+YUBIMGR_EXPORT
+int piv_parse_algorithm(const char* name, enum PIV_ALGO* algorithm);
+
+// Parses a management key algorithm (3des|aes128|aes192|aes256)
+YUBIMGR_EXPORT
+int piv_parse_management_algorithm(const char* name, enum PIV_ALGO* algorithm);
+
+YUBIMGR_EXPORT
+int piv_provision_session(struct card_session* session,
+                          const struct piv_config* config);
+
+YUBIMGR_EXPORT
+int piv_provision(const struct piv_config* config);
+
+#endif  // YUBIMGR_PIV_H
@@ -0,0 +1,53 @@
+/*
+Copyright (C) 2016 Aurelien Vallee
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef YUBIMGR_RENEW_H
+#define YUBIMGR_RENEW_H
+
+#include <yubimgr/yubimgr.h>
+
+#include <stddef.h>
+
+struct renewal {
+    // Vault holding the masterkeys, as exported by bootstrap() (see
+    // set_backup_dir()). The vault itself is never written to.
+    const char* vault;
+    // New validity of every subkey, as accepted by gpg (e.g. "1y", "2y" or
+    // an ISO date)
+    const char* expire;
+    // Passphrase protecting the masterkeys
+    const char* passphrase;
+    // Worker threads, each with its own keyring. 0 for one per CPU.
+    size_t workers;
+    // Metrics file rewritten after every masterkey (see write_metrics()),
+    // or NULL
+    const char* metrics;
+};
+
+// Extends the subkeys validity of the vault masterkeys matching patterns
+// (fingerprints or key IDs, every masterkey when NULL), then writes the
+// updated public keys to a single binary keyring FILE.
+YUBIMGR_EXPORT
+int renew(const struct renewal* config,
+          const char** patterns,
+          const char* output);
+
+#endif  // YUBIMGR_RENEW_H
@@ -0,0 +1,40 @@
+/*
+Copyright (C) 2016 Aurelien Vallee
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef YUBIMGR_REVOCATION_H
+#define YUBIMGR_REVOCATION_H
+
+#include <yubimgr/yubimgr.h>
+
+// Directory where bootstrap() stores a revocation certificate (along with
+// the public key) for every masterkey, indexed by fingerprint, email and
+// card serial.
+YUBIMGR_EXPORT
+void set_revocation_store(const char* path);
+
+// Revokes the keys designated by the NULL terminated queries (fingerprint,
+// email or card serial) in a single import into the current keyring. The
+// revoked public keys are exported to output (if not NULL) and sent to the
+// configured keyservers if publish is set.
+YUBIMGR_EXPORT
+int revoke_keys(const char** queries, const char* output, int publish);
+
+#endif  // YUBIMGR_REVOCATION_H
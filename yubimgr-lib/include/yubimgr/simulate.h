@@ -0,0 +1,67 @@
+/*
+Copyright (C) 2016 Aurelien Vallee
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef YUBIMGR_SIMULATE_H
+#define YUBIMGR_SIMULATE_H
+
+#include <yubimgr/yubimgr.h>
+
+#include <stddef.h>
+#include <stdio.h>
+
+// A provisioning station: a roster of cards, all queued at once, processed
+// by a number of readers. Phase durations and failure rates are drawn from
+// the phase histograms of a metrics file (see write_metrics()).
+struct simulation {
+    size_t cards;
+    size_t readers;
+    const char* model;
+    unsigned int seed;
+};
+
+struct simulation_report {
+    size_t cards;
+    size_t readers;
+    size_t failures;
+    double makespan;
+    double throughput;
+    double utilization;
+    double mean_wait;
+    double p95_wait;
+    double max_wait;
+};
+
+// Runs card(opaque) once per card of the roster (typically bootstrap() or
+// reset()) in simulation mode: card and key generation steps are skipped
+// and only advance a virtual clock, everything else (steps, deadlines,
+// retries, logging) runs as usual. Simulated cards are left out of the
+// metrics and the audit log. Returns 0 on success.
+YUBIMGR_EXPORT
+int simulate(const struct simulation* config,
+             int (*card)(void* opaque),
+             void* opaque,
+             struct simulation_report* report);
+
+YUBIMGR_EXPORT
+void write_simulation_report(const struct simulation_report* report,
+                             FILE* out);
+
+#endif  // YUBIMGR_SIMULATE_H
@@ -0,0 +1,36 @@
+/*
+Copyright (C) 2016 Aurelien Vallee
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef YUBIMGR_TIMEOUT_H
+#define YUBIMGR_TIMEOUT_H
+
+#include <yubimgr/yubimgr.h>
+#include <yubimgr/metrics.h>
+
+// Phases exceeding their timeout are cancelled and fail with GPG_ERR_TIMEOUT
+// (a stuck card, a wedged scdaemon or an unanswered touch prompt).
+#define DEFAULT_PHASE_TIMEOUT 300.0
+
+// Sets the timeout (in seconds) of a phase, 0 disables it.
+YUBIMGR_EXPORT
+void set_phase_timeout(enum PHASE phase, double seconds);
+
+#endif  // YUBIMGR_TIMEOUT_H
@@ -42,4 +42,15 @@ int reset();
 YUBIMGR_EXPORT
 int status();
 
+YUBIMGR_EXPORT
+int export_ssh(const char** patterns, const char* output_dir);
+
+YUBIMGR_EXPORT
+int export_csr(const char** patterns,
+               const char* output,
+               const char* dn_suffix);
+
+YUBIMGR_EXPORT
+int export_keys(const char** patterns, const char* output_dir);
+
 #endif  // YUBIMGR_H
@@ -0,0 +1,88 @@
+/*
+Copyright (C) 2016 Aurelien Vallee
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef YUBIMGR_APDU_H
+#define YUBIMGR_APDU_H
+
+#include "deadline.h"
+
+#include <gpgme.h>
+
+#include <stddef.h>
+
+// Short APDU: header(4) + Lc(1) + data(255) + Le(1)
+#define APDU_MAX_SIZE 261
+
+#define SW_OK 0x9000
+#define SW_SECURITY_STATUS 0x6982
+#define SW_AUTH_BLOCKED 0x6983
+
+struct card_session {
+    struct gpgme_context* context;
+    struct watchdog watchdog;
+    char serial[64];
+    unsigned char response[8192];
+    size_t response_size;
+};
+
+// Sends a raw assuan command to gpg-agent, data lines are collected in the
+// session response buffer.
+int card_command(struct card_session* session, const char* command);
+
+// Serial number printed on the card (embedded in OpenPGP AIDs), or an
+// empty string.
+void card_printed_serial(const struct card_session* session,
+                         char* serial,
+                         size_t size);
+
+// Opens the card just long enough to read its printed serial (see
+// card_printed_serial()). serial is empty when no card answers.
+int card_read_serial(char* serial, size_t size);
+
+// Whether err is a transport error worth retrying the whole card session
+// for (reader hiccup, card reset or re-plugged).
+int card_transient(int err);
+
+// Whether sw rejects a PIN while counting the attempt (63Cx, or 6982 from
+// cards not reporting the tries left): trying again gets closer to blocking
+// it. Any other status word means the PIN cannot be blocked this way.
+int card_pin_retry(unsigned int sw);
+
+// Sends an APDU to the card. On success the response data (status word
+// stripped) is available in the session response buffer.
+int card_apdu(struct card_session* session,
+              const unsigned char* apdu,
+              size_t size,
+              unsigned int* sw);
+
+// Builds a short APDU, data may be NULL. Returns the APDU size.
+size_t apdu_build(unsigned char* apdu,
+                  unsigned char cla,
+                  unsigned char ins,
+                  unsigned char p1,
+                  unsigned char p2,
+                  const unsigned char* data,
+                  size_t size);
+
+// Selects the OpenPGP applet
+int select_openpgp(struct card_session* session);
+
+#endif  // YUBIMGR_APDU_H
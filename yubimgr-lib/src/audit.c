@@ -0,0 +1,451 @@
+/*
+Copyright (C) 2016 Aurelien Vallee
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <yubimgr/audit.h>
+#include <yubimgr/logging.h>
+
+#include "audit_log.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define AUDIT_MAGIC "YMA1"
+#define AUDIT_INDEX_MAGIC "YMAIDX1"
+#define AUDIT_KEY_SIZE 72
+
+// Records appended since the index was built are scanned linearly, until
+// there are enough of them to be worth merging into the index
+#define AUDIT_INDEX_LAG 1024
+
+// Fixed size records, appended with a single write() so that concurrent
+// yubimgr processes never interleave them
+struct audit_record {
+    char magic[4];
+    uint16_t phase;
+    uint16_t reserved;
+    int32_t result;
+    uint32_t duration_ms;
+    int64_t timestamp_us;
+    char serial[16];
+    char fpr[48];
+    char user[64];
+};
+
+// The index is a sorted array of (key, record number) pairs, one per
+// non-empty field of every indexed record
+struct audit_index_header {
+    char magic[8];
+    uint64_t records;
+    uint64_t count;
+};
+
+struct audit_index_entry {
+    char key[AUDIT_KEY_SIZE];
+    uint64_t record;
+};
+
+struct audit_mapping {
+    void* data;
+    size_t size;
+};
+
+static int _audit_fd = -1;
+
+static __thread struct {
+    char user[64];
+    char fpr[48];
+    char serial[16];
+} _subject;
+
+int set_audit_log(const char* path)
+{
+    int fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        log_error("Failed to open audit log \"%s\": %s\n", path,
+                  strerror(errno));
+        return 1;
+    }
+
+    if (_audit_fd >= 0)
+        close(_audit_fd);
+    _audit_fd = fd;
+
+    return 0;
+}
+
+void audit_subject(const char* user, const char* fpr, const char* serial)
+{
+    if (user)
+        snprintf(_subject.user, sizeof(_subject.user), "%s", user);
+    if (fpr)
+        snprintf(_subject.fpr, sizeof(_subject.fpr), "%s", fpr);
+    if (serial)
+        snprintf(_subject.serial, sizeof(_subject.serial), "%s", serial);
+}
+
+void audit_clear()
+{
+    memset(&_subject, 0, sizeof(_subject));
+}
+
+static void audit_write(enum PHASE phase,
+                        int err,
+                        double duration,
+                        const char* user,
+                        const char* fpr,
+                        const char* serial)
+{
+    struct audit_record record;
+    struct timespec now;
+
+    if (_audit_fd < 0)
+        return;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    memset(&record, 0, sizeof(record));
+    memcpy(record.magic, AUDIT_MAGIC, sizeof(record.magic));
+    record.phase        = phase;
+    record.result       = err;
+    record.duration_ms  = (uint32_t)(duration * 1000);
+    record.timestamp_us = (int64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+    snprintf(record.user, sizeof(record.user), "%s", user ? user : "");
+    snprintf(record.fpr, sizeof(record.fpr), "%s", fpr ? fpr : "");
+    snprintf(record.serial, sizeof(record.serial), "%s", serial ? serial : "");
+
+    if (write(_audit_fd, &record, sizeof(record)) != sizeof(record))
+        log_warning("Failed to write audit record: %s\n", strerror(errno));
+}
+
+void audit_phase(enum PHASE phase, int err, double duration)
+{
+    audit_write(phase, err, duration, _subject.user, _subject.fpr,
+                _subject.serial);
+}
+
+void audit_event(enum PHASE phase,
+                 int err,
+                 const char* user,
+                 const char* fpr,
+                 const char* serial)
+{
+    audit_write(phase, err, 0, user, fpr, serial);
+}
+
+// Builds the index key of a field: users are case insensitive, serials are
+// printed without their leading zeros
+static int audit_key(const char* field, const char* value, char* key)
+{
+    char normalized[AUDIT_KEY_SIZE];
+    size_t i;
+
+    if (!strcmp(field, "serial"))
+        while (*value == '0' && value[1])
+            value++;
+
+    for (i = 0; value[i] && i < sizeof(normalized) - 1; ++i)
+        normalized[i] = !strcmp(field, "user")
+                            ? tolower((unsigned char)value[i])
+                            : toupper((unsigned char)value[i]);
+    normalized[i] = 0;
+
+    if (!*normalized)
+        return 1;
+
+    return snprintf(key, AUDIT_KEY_SIZE, "%s=%s", field, normalized) >=
+           AUDIT_KEY_SIZE;
+}
+
+// Index keys of a record, returns their count
+static size_t audit_record_keys(const struct audit_record* record,
+                                char keys[3][AUDIT_KEY_SIZE])
+{
+    size_t count = 0;
+
+    if (!audit_key("serial", record->serial, keys[count]))
+        count++;
+    if (!audit_key("user", record->user, keys[count]))
+        count++;
+    if (!audit_key("fpr", record->fpr, keys[count]))
+        count++;
+
+    return count;
+}
+
+static int map_file(const char* path, struct audit_mapping* mapping)
+{
+    struct stat st;
+
+    mapping->data = NULL;
+    mapping->size = 0;
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return 1;
+
+    if (fstat(fd, &st)) {
+        close(fd);
+        return 1;
+    }
+
+    // An empty file has nothing to map
+    if (!st.st_size) {
+        close(fd);
+        return 0;
+    }
+
+    mapping->data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping->data == MAP_FAILED) {
+        mapping->data = NULL;
+        return 1;
+    }
+    mapping->size = st.st_size;
+
+    return 0;
+}
+
+static void unmap_file(struct audit_mapping* mapping)
+{
+    if (mapping->data)
+        munmap(mapping->data, mapping->size);
+    mapping->data = NULL;
+}
+
+static int compare_entries(const void* a, const void* b)
+{
+    const struct audit_index_entry* x = (const struct audit_index_entry*)a;
+    const struct audit_index_entry* y = (const struct audit_index_entry*)b;
+
+    int r = strcmp(x->key, y->key);
+    if (r)
+        return r;
+
+    return x->record < y->record ? -1 : x->record > y->record;
+}
+
+// Returns the index header if the mapping holds a valid index
+static const struct audit_index_header* index_header(
+    const struct audit_mapping* index)
+{
+    const struct audit_index_header* header =
+        (const struct audit_index_header*)index->data;
+
+    if (!header || index->size < sizeof(*header) ||
+        memcmp(header->magic, AUDIT_INDEX_MAGIC, sizeof(header->magic)) ||
+        index->size !=
+            sizeof(*header) + header->count * sizeof(struct audit_index_entry))
+        return NULL;
+
+    return header;
+}
+
+// Merges the records appended since the index was built into a new index,
+// atomically replacing the previous one
+static int audit_index_merge(const char* index_path,
+                             const struct audit_mapping* log,
+                             const struct audit_mapping* index)
+{
+    const struct audit_record* records = (const struct audit_record*)log->data;
+    const struct audit_index_header* header = index_header(index);
+    size_t record_count = log->size / sizeof(struct audit_record);
+    size_t indexed      = header ? header->records : 0;
+    size_t old_count    = header ? header->count : 0;
+    const struct audit_index_entry* old_entries =
+        header ? (const struct audit_index_entry*)(header + 1) : NULL;
+
+    log_debug("Merging %zu audit records into \"%s\".\n",
+              record_count - indexed, index_path);
+
+    struct audit_index_entry* entries = (struct audit_index_entry*)calloc(
+        3 * (record_count - indexed) + 1, sizeof(struct audit_index_entry));
+    if (!entries)
+        return 1;
+
+    size_t count = 0;
+    for (size_t i = indexed; i < record_count; ++i) {
+        char keys[3][AUDIT_KEY_SIZE];
+        if (memcmp(records[i].magic, AUDIT_MAGIC, 4))
+            continue;
+        size_t key_count = audit_record_keys(&records[i], keys);
+        for (size_t k = 0; k < key_count; ++k) {
+            memcpy(entries[count].key, keys[k], AUDIT_KEY_SIZE);
+            entries[count++].record = i;
+        }
+    }
+    qsort(entries, count, sizeof(*entries), compare_entries);
+
+    char tmp_path[1040];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%d", index_path, getpid());
+    FILE* file = fopen(tmp_path, "w");
+    if (!file) {
+        log_error("Failed to open \"%s\": %s\n", tmp_path, strerror(errno));
+        free(entries);
+        return 1;
+    }
+
+    struct audit_index_header new_header = {{0}, record_count,
+                                            old_count + count};
+    memcpy(new_header.magic, AUDIT_INDEX_MAGIC, sizeof(new_header.magic));
+    fwrite(&new_header, sizeof(new_header), 1, file);
+
+    // Both sides are sorted, a single merge pass keeps the index sorted
+    size_t i = 0, j = 0;
+    while (i < old_count || j < count) {
+        if (j == count || (i < old_count &&
+                           compare_entries(&old_entries[i], &entries[j]) < 0))
+            fwrite(&old_entries[i++], sizeof(*entries), 1, file);
+        else
+            fwrite(&entries[j++], sizeof(*entries), 1, file);
+    }
+    free(entries);
+
+    if (fclose(file) || rename(tmp_path, index_path)) {
+        log_error("Failed to write \"%s\": %s\n", index_path, strerror(errno));
+        unlink(tmp_path);
+        return 1;
+    }
+
+    return 0;
+}
+
+static void print_record(const struct audit_record* record, FILE* out)
+{
+    char date[32];
+    struct tm tm;
+
+    time_t seconds = record->timestamp_us / 1000000;
+    gmtime_r(&seconds, &tm);
+    strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", &tm);
+
+    fprintf(out, "%s %s %s %.3fs", date, phase_name(record->phase),
+            record->result ? "failed" : "ok", record->duration_ms / 1000.0);
+    if (*record->serial)
+        fprintf(out, " serial=%.16s", record->serial);
+    if (*record->user)
+        fprintf(out, " user=%.64s", record->user);
+    if (*record->fpr)
+        fprintf(out, " fpr=%.48s", record->fpr);
+    fputc('\n', out);
+}
+
+int audit_query(const char* path, const char* query, FILE* out)
+{
+    char field[16];
+    char key[AUDIT_KEY_SIZE];
+    char index_path[1024];
+    struct audit_mapping log   = {NULL, 0};
+    struct audit_mapping index = {NULL, 0};
+
+    const char* value = strchr(query, '=');
+    if (!value || value - query >= (long)sizeof(field)) {
+        log_error("Invalid audit query \"%s\".\n", query);
+        return 1;
+    }
+    snprintf(field, sizeof(field), "%.*s", (int)(value - query), query);
+    if ((strcmp(field, "serial") && strcmp(field, "user") &&
+         strcmp(field, "fpr")) ||
+        audit_key(field, value + 1, key)) {
+        log_error("Invalid audit query \"%s\" (serial|user|fpr=VALUE).\n",
+                  query);
+        return 1;
+    }
+
+    if (map_file(path, &log)) {
+        log_error("Failed to open audit log \"%s\": %s\n", path,
+                  strerror(errno));
+        return 1;
+    }
+
+    const struct audit_record* records = (const struct audit_record*)log.data;
+    size_t record_count = log.size / sizeof(struct audit_record);
+
+    snprintf(index_path, sizeof(index_path), "%s.idx", path);
+    map_file(index_path, &index);
+
+    // A missing, corrupted or lagging index is (re)built, failing that the
+    // unindexed records are scanned
+    const struct audit_index_header* header = index_header(&index);
+    if (header && header->records > record_count)
+        header = NULL;
+    if (!header)
+        unmap_file(&index);
+    size_t indexed = header ? header->records : 0;
+    if (record_count - indexed > AUDIT_INDEX_LAG) {
+        if (!audit_index_merge(index_path, &log, &index)) {
+            unmap_file(&index);
+            map_file(index_path, &index);
+            header  = index_header(&index);
+            indexed = header ? header->records : 0;
+        }
+    }
+
+    size_t matches = 0;
+    if (header) {
+        const struct audit_index_entry* entries =
+            (const struct audit_index_entry*)(header + 1);
+
+        // Lower bound of key, matching entries are sorted by record
+        size_t low = 0, high = header->count;
+        while (low < high) {
+            size_t middle = low + (high - low) / 2;
+            if (strcmp(entries[middle].key, key) < 0)
+                low = middle + 1;
+            else
+                high = middle;
+        }
+
+        for (; low < header->count && !strcmp(entries[low].key, key); ++low)
+            if (entries[low].record < record_count) {
+                print_record(&records[entries[low].record], out);
+                matches++;
+            }
+    }
+
+    for (size_t i = indexed; i < record_count; ++i) {
+        char keys[3][AUDIT_KEY_SIZE];
+        if (memcmp(records[i].magic, AUDIT_MAGIC, 4))
+            continue;
+        size_t key_count = audit_record_keys(&records[i], keys);
+        for (size_t k = 0; k < key_count; ++k) {
+            if (!strcmp(keys[k], key)) {
+                print_record(&records[i], out);
+                matches++;
+                break;
+            }
+        }
+    }
+
+    log_debug("%zu audit records match \"%s\".\n", matches, key);
+
+    unmap_file(&index);
+    unmap_file(&log);
+
+    return 0;
+}
@@ -0,0 +1,46 @@
+/*
+Copyright (C) 2016 Aurelien Vallee
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef YUBIMGR_AUDIT_LOG_H
+#define YUBIMGR_AUDIT_LOG_H
+
+#include <yubimgr/audit.h>
+#include <yubimgr/metrics.h>
+
+// Sets who and what the next audit records of the current thread are
+// about. NULL fields are left unchanged.
+void audit_subject(const char* user, const char* fpr, const char* serial);
+
+// Forgets the subject, at the end of an operation.
+void audit_clear();
+
+// Records the end of a phase for the current subject (see phase_end()).
+void audit_phase(enum PHASE phase, int err, double duration);
+
+// Records an event about an explicit subject, for batch operations (one
+// record per exported or revoked key).
+void audit_event(enum PHASE phase,
+                 int err,
+                 const char* user,
+                 const char* fpr,
+                 const char* serial);
+
+#endif  // YUBIMGR_AUDIT_LOG_H
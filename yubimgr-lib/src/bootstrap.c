@@ -22,7 +22,21 @@ SOFTWARE.
 #include <yubimgr/yubimgr.h>
 #include <yubimgr/logging.h>
 
+#include "apdu.h"
+#include "audit_log.h"
+#include "bootstrap.h"
+#include "deadline.h"
+#include "hostkey.h"
+#include "identity_index.h"
+#include "personalization.h"
+#include "phase.h"
+#include "probes.h"
+#include "revocation_store.h"
+#include "simulation.h"
+#include "trace_events.h"
+
 #include <gpgme.h>
+#include <gcrypt.h>
 
 #include <string.h>
 #include <stdlib.h>
@@ -30,6 +44,7 @@ SOFTWARE.
 #include <locale.h>
 #include <unistd.h>
 #include <errno.h>
+#include <fcntl.h>
 #define _XOPEN_SOURCE 500
 #define __USE_XOPEN_EXTENDED
 #include <ftw.h>
@@ -65,29 +80,69 @@ int check_gpgme()
     return 0;
 }
 
-int set_passphrase(const char* temporary_keyring, const char* passphrase)
+int check_gcrypt()
+{
+    // Secure memory is not used: keys generated on the host end up in the
+    // temporary keyring files anyway
+    if (!gcry_control(GCRYCTL_INITIALIZATION_FINISHED_P)) {
+        if (!gcry_check_version(GCRYPT_VERSION)) {
+            log_error("Failed to initialize libgcrypt.\n");
+            return 1;
+        }
+        gcry_control(GCRYCTL_DISABLE_SECMEM, 0);
+        gcry_control(GCRYCTL_INITIALIZATION_FINISHED, 0);
+    }
+
+    return 0;
+}
+
+// Creates (truncates) a file of a keyring directory, for writing
+static FILE* create_keyring_file(const char* homedir, const char* filename)
+{
+    char path[1024];
+
+    snprintf(path, sizeof(path), "%s/%s", homedir, filename);
+    log_debug("Generating %s at \"%s\".\n", filename, path);
+
+    FILE* file = fopen(path, "w");
+    if (!file)
+        log_error("Failed to open \"%s\": %s\n", path, strerror(errno));
+
+    return file;
+}
+
+int set_card_passphrase(const char* temporary_keyring,
+                        const char* passphrase,
+                        const char* admin_pin)
 {
-    static char pinentry_path[256];
-    static const char* pinentry_filename = "pinentry";
-    strncpy(pinentry_path, temporary_keyring,
-            sizeof(pinentry_path) - sizeof(pinentry_filename) - 1);
-    strcat(pinentry_path, "/");
-    strcat(pinentry_path, pinentry_filename);
-    log_debug("Generating pinentry at \"%s\".\n", pinentry_path);
-    FILE* pinentry_file = fopen(pinentry_path, "w");
+    char pinentry_path[1024];
+
+    // gpg-agent describes card PIN prompts with the PIN name: the admin PIN
+    // asked by scdaemon is answered separately from the key passphrase
+    FILE* pinentry_file = create_keyring_file(temporary_keyring, "pinentry");
+    if (!pinentry_file)
+        return 1;
     fprintf(pinentry_file,
             "#!/bin/bash\n"
             "\n"
             "echo OK Your orders please\n"
-            "while read cmd; do\n"
+            "admin=0\n"
+            "while read -r cmd; do\n"
             "  case $cmd in\n"
-            "    GETPIN) echo \"D %s\"; echo \"omfg\" >/tmp/lol ; echo OK;;\n"
+            "    SETDESC*Admin*PIN*|SETPROMPT*Admin*PIN*) admin=1; echo OK;;\n"
+            "    GETPIN)\n"
+            "      if [ $admin = 1 ]; then echo \"D %s\"\n"
+            "      else echo \"D %s\"; fi\n"
+            "      admin=0; echo OK;;\n"
+            "    RESET) admin=0; echo OK;;\n"
             "    *) echo OK;;\n"
             "  esac\n"
             "done\n",
-            passphrase);
+            admin_pin, passphrase);
     fclose(pinentry_file);
 
+    snprintf(pinentry_path, sizeof(pinentry_path), "%s/pinentry",
+             temporary_keyring);
     if (chmod(pinentry_path, S_IRUSR | S_IWUSR | S_IXUSR)) {
         log_error("Failed to chmod pinentry program.\n");
         return 1;
@@ -96,71 +151,89 @@ int set_passphrase(const char* temporary_keyring, const char* passphrase)
     return 0;
 }
 
+int set_passphrase(const char* temporary_keyring, const char* passphrase)
+{
+    return set_card_passphrase(temporary_keyring, passphrase, passphrase);
+}
+
 int configure_gpg(const char* temporary_keyring)
 {
     // Setup GPG to automatically use "expert" mode
-    static char gpg_conf_path[256];
-    static const char* gpg_conf_filename = "gpg.conf";
-    strncpy(gpg_conf_path, temporary_keyring,
-            sizeof(gpg_conf_path) - sizeof(gpg_conf_filename) - 1);
-    strcat(gpg_conf_path, "/");
-    strcat(gpg_conf_path, gpg_conf_filename);
-    log_debug("Generating gpg.conf at \"%s\".\n", gpg_conf_path);
-    FILE* gpg_conf_file = fopen(gpg_conf_path, "w");
+    FILE* gpg_conf_file = create_keyring_file(temporary_keyring, "gpg.conf");
+    if (!gpg_conf_file)
+        return 1;
     fputs("expert\n", gpg_conf_file);
     fclose(gpg_conf_file);
 
     return 0;
 }
 
+// Copies the scdaemon-program of the current keyring ($GNUPGHOME), so that
+// the agent of a temporary keyring reaches the same card
+static void inherit_scdaemon(FILE* gpg_agent_conf_file,
+                             const char* temporary_keyring)
+{
+    char path[1024];
+    char line[1024];
+    const char* homedir = getenv("GNUPGHOME");
+    const char* home    = getenv("HOME");
+
+    if (homedir && !strcmp(homedir, temporary_keyring))
+        return;
+    if (homedir)
+        snprintf(path, sizeof(path), "%s/gpg-agent.conf", homedir);
+    else if (home)
+        snprintf(path, sizeof(path), "%s/.gnupg/gpg-agent.conf", home);
+    else
+        return;
+
+    FILE* file = fopen(path, "r");
+    if (!file)
+        return;
+    while (fgets(line, sizeof(line), file))
+        if (!strncmp(line, "scdaemon-program ", 17))
+            fputs(line, gpg_agent_conf_file);
+    fclose(file);
+}
+
 int configure_gpg_agent(const char* temporary_keyring)
 {
     // Setup gpg-agent to use dummy pinentry program
-    static char gpg_agent_conf_path[256];
-    static const char* gpg_agent_conf_filename = "gpg-agent.conf";
-    strncpy(gpg_agent_conf_path, temporary_keyring,
-            sizeof(gpg_agent_conf_path) - sizeof(gpg_agent_conf_filename));
-    strcat(gpg_agent_conf_path, "/");
-    strcat(gpg_agent_conf_path, gpg_agent_conf_filename);
-    log_debug("Generatig gpg-agent.conf at \"%s\".\n", gpg_agent_conf_path);
-    FILE* gpg_agent_conf_file = fopen(gpg_agent_conf_path, "w");
+    FILE* gpg_agent_conf_file =
+        create_keyring_file(temporary_keyring, "gpg-agent.conf");
+    if (!gpg_agent_conf_file)
+        return 1;
     fprintf(gpg_agent_conf_file, "pinentry-program %s/pinentry\n",
             temporary_keyring);
     fputs("allow-loopback-pinentry\n", gpg_agent_conf_file);
+    inherit_scdaemon(gpg_agent_conf_file, temporary_keyring);
     fclose(gpg_agent_conf_file);
 
     // Make sure gpg-agent is running properly and configured to use our
-    // gpg-agent.conf
-    static char gpg_connect_agent_command[256];
-    snprintf(gpg_connect_agent_command, sizeof(gpg_connect_agent_command),
-             "gpg-connect-agent --homedir \"%s\" KILLAGENT /bye 2>&1",
-             temporary_keyring);
-    FILE* outp = popen(gpg_connect_agent_command, "r");
-    log_debug("Running command \"%s\".\n", gpg_connect_agent_command);
-    if (pclose(outp))
-        log_error("Failed to stop currently running gpg-agent.\n");
-    snprintf(gpg_connect_agent_command, sizeof(gpg_connect_agent_command),
-             "gpg-connect-agent --homedir \"%s\" /bye 2>&1", temporary_keyring);
-    outp = popen(gpg_connect_agent_command, "r");
-    log_debug("Running command \"%s\".\n", gpg_connect_agent_command);
-    if (pclose(outp))
+    // gpg-agent.conf. Commands are killed if the agent does not answer.
+    const char* kill_agent[] = {"gpg-connect-agent", "--homedir",
+                                temporary_keyring, "KILLAGENT", "/bye", NULL};
+    int killed = !run_command(kill_agent, 1);
+    if (!killed)
         log_error("Failed to stop currently running gpg-agent.\n");
+    const char* start_agent[] = {"gpg-connect-agent", "--homedir",
+                                 temporary_keyring, "/bye", NULL};
+    if (run_command(start_agent, 1))
+        log_error("Failed to start gpg-agent.\n");
+    else if (killed)
+        metrics_increment(COUNTER_AGENT_RESTARTS);
 
     return 0;
 }
 
-int setup_gpgme(struct gpgme_context** context, const char* temporary_keyring)
+int setup_homedir(struct gpgme_context** context, const char* homedir)
 {
     gpgme_error_t err;
 
-    // Prepare the environment
-    unsetenv("GPG_AGENT_INFO");
-    setenv("GNUPGHOME", temporary_keyring, 1);
-
-    if (configure_gpg(temporary_keyring))
+    if (configure_gpg(homedir))
         return 1;
 
-    if (configure_gpg_agent(temporary_keyring))
+    if (configure_gpg_agent(homedir))
         return 1;
 
     // Setup GPGME context
@@ -175,11 +248,32 @@ int setup_gpgme(struct gpgme_context** context, const char* temporary_keyring)
         return 1;
     }
 
+    // The context, not the process environment, designates the keyring
+    if ((err = gpgme_ctx_set_engine_info(*context, GPGME_PROTOCOL_OpenPGP,
+                                         NULL, homedir))) {
+        log_error("Failed to use keyring %s.\n", homedir);
+        return 1;
+    }
+
     gpgme_set_armor(*context, 1);
 
     return 0;
 }
 
+int setup_gpgme(struct gpgme_context** context, const char* temporary_keyring)
+{
+    // The agent is configured from the user keyring, before the environment
+    // is prepared for the card stages and the commands run on the side of
+    // GPGME
+    if (setup_homedir(context, temporary_keyring))
+        return 1;
+
+    unsetenv("GPG_AGENT_INFO");
+    setenv("GNUPGHOME", temporary_keyring, 1);
+
+    return 0;
+}
+
 int mk_tmpdir(char* tmpdir, size_t size)
 {
     const char* tmprootdir = getenv("TMPDIR");
@@ -260,7 +354,10 @@ int generate_masterkey(struct gpgme_context* context,
 
     log_trace("Key generation params:\n%s", genkey_params);
 
-    if ((err = gpgme_op_genkey(context, genkey_params, NULL, NULL))) {
+    struct watchdog watchdog;
+    watchdog_arm(&watchdog, context);
+    err = gpgme_op_genkey(context, genkey_params, NULL, NULL);
+    if ((err = watchdog_disarm(&watchdog, err))) {
         log_error("Failed to call genkey (%d). %s: %s\n", err,
                   gpgme_strsource(err), gpgme_strerror(err));
         return err;
@@ -279,11 +376,6 @@ int generate_masterkey(struct gpgme_context* context,
     return 0;
 }
 
-struct step {
-    const char* request;
-    const char* response;
-};
-
 struct edit_state {
     size_t cur_step;
     size_t max_step;
@@ -306,10 +398,27 @@ gpgme_error_t edit_key_cb(void* handle,
         return 1;
     }
 
+    // Do not keep answering a card conversation past the phase deadline
+    if (deadline_expired()) {
+        log_error("Deadline reached while editing key.\n");
+        return gpgme_error(GPG_ERR_TIMEOUT);
+    }
+
+    // gpg goes on with the next prompt after a failed card operation, such
+    // as keytocard with a wrong admin PIN
+    if (status == GPGME_STATUS_SC_OP_FAILURE) {
+        log_error("Card operation failed%s.\n",
+                  args && !strcmp(args, "2") ? ", bad PIN" : "");
+        return gpgme_error(GPG_ERR_CARD);
+    }
+
     // Nothing is expected from us here
     if (fd < 0)
         return 0;
 
+    YUBIMGR_PROBE3(keyedit__prompt, (int)status, args ? args : "",
+                   state->cur_step);
+
     // If we reached the final step, then just leave
     if (state->cur_step >= state->max_step) {
         gpgme_io_write(fd, "quit\n", 5);
@@ -331,50 +440,173 @@ gpgme_error_t edit_key_cb(void* handle,
     return 0;
 }
 
-int generate_subkey_encrypt(struct gpgme_context* context, char* masterkey_fpr)
+int edit_masterkey(struct gpgme_context* context,
+                   const char* masterkey_fpr,
+                   struct step* steps,
+                   size_t count)
 {
-    log_info("Generating encryption subkey...\n");
-
     int err;
     gpgme_key_t key  = NULL;
     gpgme_data_t out = NULL;
 
     // Retrieve the masterkey
-    if ((err = gpgme_op_keylist_start(context, masterkey_fpr, 0))) {
-        log_error("Failed to list keys.\n");
-        return err;
-    }
-
-    if ((err = gpgme_op_keylist_next(context, &key))) {
-        log_error("Failed to list keys.\n");
-        return err;
-    }
-
-    if ((err = gpgme_op_keylist_end(context))) {
+    if ((err = gpgme_get_key(context, masterkey_fpr, &key, 0))) {
         log_error("Failed to list keys.\n");
         return err;
     }
 
     if ((err = gpgme_data_new(&out))) {
         log_error("Failed to create new data.\n");
+        gpgme_key_unref(key);
         return err;
     }
 
+    struct edit_state state = {0, count, 0, 250 * count, steps};
+
+    struct watchdog watchdog;
+    watchdog_arm(&watchdog, context);
+    err = gpgme_op_edit(context, key, edit_key_cb, &state, out);
+    if ((err = watchdog_disarm(&watchdog, err)))
+        log_error("Failed to edit masterkey. %s: %s\n", gpgme_strsource(err),
+                  gpgme_strerror(err));
+
+    gpgme_data_release(out);
+    gpgme_key_unref(key);
+
+    return err;
+}
+
+int generate_subkey_encrypt(struct gpgme_context* context, char* masterkey_fpr)
+{
+    log_info("Generating encryption subkey...\n");
+
     struct step steps[] = {
         {"keyedit.prompt", "addkey"}, {"keygen.algo", "8"},
         {"keygen.flags", "s"},        {"keygen.flags", "e"},
         {"keygen.flags", "q"},        {"keygen.size", "2048"},
         {"keygen.valid", "0"},        {"keyedit.prompt", "save"},
     };
-    struct edit_state state = {0, 8, 0, 250, steps};
 
     // Add encryption subkey
-    if ((err = gpgme_op_edit(context, key, edit_key_cb, &state, out))) {
-        log_error("Failed to edit masterkey.\n");
+    return edit_masterkey(context, masterkey_fpr, steps,
+                          sizeof(steps) / sizeof(steps[0]));
+}
+
+// Capabilities toggled from the defaults gpg picks for an existing key
+// (sign and encrypt for RSA, sign for Ed25519, encrypt for Curve25519,
+// which is not asked for)
+static const char* _rsa_toggles[SUBKEY_COUNT][4] = {
+    {"e", NULL}, {"s", NULL}, {"s", "e", "a", NULL}};
+static const char* _ecc_toggles[SUBKEY_COUNT][4] = {
+    {NULL}, {NULL}, {"s", "a", NULL}};
+
+// gpg-agent got the host keys as hostkey_store() wrote them, unprotected.
+// Changing the passphrase of the whole key (to the same one, answered by
+// the pinentry) protects them, so that they are not exported in the clear.
+static int protect_subkeys(struct gpgme_context* context,
+                           const char* masterkey_fpr)
+{
+    int err;
+    gpgme_key_t key = NULL;
+
+    if ((err = gpgme_get_key(context, masterkey_fpr, &key, 1))) {
+        log_error("Failed to list keys.\n");
         return err;
     }
 
-    return 0;
+    struct watchdog watchdog;
+    watchdog_arm(&watchdog, context);
+    err = gpgme_op_passwd(context, key, 0);
+    if ((err = watchdog_disarm(&watchdog, err)))
+        log_error("Failed to protect subkeys. %s: %s\n", gpgme_strsource(err),
+                  gpgme_strerror(err));
+
+    gpgme_key_unref(key);
+
+    return err;
+}
+
+int generate_subkeys_host(struct gpgme_context* context,
+                          const char* temporary_keyring,
+                          char* masterkey_fpr)
+{
+    int err;
+    struct hostkey keys[SUBKEY_COUNT];
+    enum KEYGEN_PROFILE profile = keygen_profile();
+
+    log_info("Generating %s subkeys on the host...\n",
+             keygen_profile_name(profile));
+
+    if ((err = hostkey_generate(profile, keys, 1)))
+        return err;
+
+    for (int i = 0; i < SUBKEY_COUNT && !err; ++i)
+        err = hostkey_store(&keys[i], temporary_keyring);
+    if (err) {
+        hostkey_release(keys);
+        return err;
+    }
+
+    // Add the keys already known to gpg-agent, in a single session
+    struct step steps[SUBKEY_COUNT * 8 + 1];
+    size_t count = 0;
+    for (int i = 0; i < SUBKEY_COUNT; ++i) {
+        const char* const* toggles =
+            hostkey_is_rsa(profile) ? _rsa_toggles[i] : _ecc_toggles[i];
+
+        steps[count++] = (struct step){"keyedit.prompt", "addkey"};
+        steps[count++] = (struct step){"keygen.algo", "13"};
+        steps[count++] = (struct step){"keygen.keygrip", keys[i].keygrip};
+        for (; *toggles; ++toggles)
+            steps[count++] = (struct step){"keygen.flags", *toggles};
+        if (hostkey_is_rsa(profile) || i != SUBKEY_ENCRYPT)
+            steps[count++] = (struct step){"keygen.flags", "q"};
+        steps[count++] = (struct step){"keygen.valid", "0"};
+    }
+    steps[count++] = (struct step){"keyedit.prompt", "save"};
+
+    err = edit_masterkey(context, masterkey_fpr, steps, count);
+    hostkey_release(keys);
+
+    if (!err)
+        err = protect_subkeys(context, masterkey_fpr);
+
+    return err;
+}
+
+int move_subkeys_to_card(struct gpgme_context* context,
+                         const char* temporary_keyring,
+                         const char* passphrase,
+                         char* masterkey_fpr)
+{
+    log_info("Moving subkeys to the card...\n");
+
+    // Each key is unprotected with the passphrase, then written under the
+    // admin PIN the card has before personalization
+    int err;
+    if ((err = set_card_passphrase(temporary_keyring, passphrase,
+                                   personalization_admin_pin())))
+        return err;
+
+    // Subkeys are selected by index, in the order generate_subkeys_host()
+    // added them, and go to the card slot of the same usage
+    struct step steps[] = {
+        {"keyedit.prompt", "key 1"},
+        {"keyedit.prompt", "keytocard"},
+        {"cardedit.genkeys.storekeytype", "1"},
+        {"keyedit.prompt", "key 1"},
+        {"keyedit.prompt", "key 2"},
+        {"keyedit.prompt", "keytocard"},
+        {"cardedit.genkeys.storekeytype", "2"},
+        {"keyedit.prompt", "key 2"},
+        {"keyedit.prompt", "key 3"},
+        {"keyedit.prompt", "keytocard"},
+        {"cardedit.genkeys.storekeytype", "3"},
+        {"keyedit.prompt", "save"},
+    };
+
+    return edit_masterkey(context, masterkey_fpr, steps,
+                          sizeof(steps) / sizeof(steps[0]));
 }
 
 int export_masterkey(struct gpgme_context* context,
@@ -382,59 +614,244 @@ int export_masterkey(struct gpgme_context* context,
                      const char* passphrase,
                      char* masterkey_fpr)
 {
-    (void)(context);
     (void)(temporary_keyring);
     (void)(passphrase);
-    (void)(masterkey_fpr);
 
-    return 1;
+    int err;
+    gpgme_data_t data = NULL;
+    const char* dir   = backup_dir();
+
+    if (!dir) {
+        log_error("No backup directory to export the masterkey to.\n");
+        return 1;
+    }
+
+    log_info("Exporting masterkey to \"%s\"...\n", dir);
+
+    if ((err = gpgme_data_new(&data))) {
+        log_error("Failed to create new data.\n");
+        return err;
+    }
+
+    // Secret subkeys generated on the host are still in the keyring, and
+    // are backed up along with the masterkey, under its passphrase
+    if ((err = gpgme_op_export(context, masterkey_fpr,
+                               GPGME_EXPORT_MODE_SECRET, data))) {
+        log_error("Failed to export masterkey. %s: %s\n",
+                  gpgme_strsource(err), gpgme_strerror(err));
+        gpgme_data_release(data);
+        return err;
+    }
+
+    size_t size;
+    char* armor = gpgme_data_release_and_get_mem(data, &size);
+
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/%s.asc", dir, masterkey_fpr);
+    int fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0600);
+    if (!size || fd < 0 || write(fd, armor, size) != (ssize_t)size) {
+        log_error("Failed to write \"%s\": %s\n", path,
+                  size ? strerror(errno) : "empty export");
+        err = 1;
+    }
+    if (fd >= 0 && close(fd))
+        err = 1;
+    gpgme_free(armor);
+
+    return err;
+}
+
+// What the bootstrap steps share, for a single card
+struct bootstrap_state {
+    struct gpgme_context* context;
+    char temporary_keyring[256];
+    const char* username;
+    const char* firstname;
+    const char* lastname;
+    const char* email;
+    const char* passphrase;
+    char masterkey_fpr[41];
+    char serial[16];
+};
+
+static int step_setup(struct bootstrap_state* state)
+{
+    return setup_gpgme(&state->context, state->temporary_keyring);
+}
+
+static int step_masterkey(struct bootstrap_state* state)
+{
+    int err = generate_masterkey(state->context, state->temporary_keyring,
+                                 state->username, state->firstname,
+                                 state->lastname, state->email,
+                                 state->passphrase, state->masterkey_fpr);
+    if (!err)
+        audit_subject(NULL, state->masterkey_fpr, NULL);
+    return err;
+}
+
+static int step_revocation(struct bootstrap_state* state)
+{
+    return store_revocation(state->context, state->temporary_keyring,
+                            state->email, state->masterkey_fpr,
+                            state->serial);
+}
+
+static int step_subkey(struct bootstrap_state* state)
+{
+    if (keygen_mode() == KEYGEN_HOST)
+        return generate_subkeys_host(state->context, state->temporary_keyring,
+                                     state->masterkey_fpr);
+    return generate_subkey_encrypt(state->context, state->masterkey_fpr);
+}
+
+static int step_export_masterkey(struct bootstrap_state* state)
+{
+    return export_masterkey(state->context, state->temporary_keyring,
+                            state->passphrase, state->masterkey_fpr);
 }
 
+static int step_keytocard(struct bootstrap_state* state)
+{
+    return move_subkeys_to_card(state->context, state->temporary_keyring,
+                                state->passphrase, state->masterkey_fpr);
+}
+
+// Fills the personalization from the user record and writes it to the card
+static int step_personalize(struct bootstrap_state* state)
+{
+    struct personalization config = *personalization_config();
+    char url[256];
+
+    if (!config.firstname)
+        config.firstname = state->firstname;
+    if (!config.lastname)
+        config.lastname = state->lastname;
+    if (!config.login)
+        config.login = state->username;
+
+    const char* fpr = config.url ? strstr(config.url, "%s") : NULL;
+    if (fpr) {
+        snprintf(url, sizeof(url), "%.*s%s%s", (int)(fpr - config.url),
+                 config.url, state->masterkey_fpr, fpr + 2);
+        config.url = url;
+    }
+
+    return personalize_card(&config);
+}
+
+static int keytocard_enabled()
+{
+    return keygen_mode() == KEYGEN_HOST;
+}
+
+static int personalize_enabled()
+{
+    return personalization_config() != NULL;
+}
+
+// Host generated subkeys go to the card once backed up. The card is
+// personalized last, moving keys still needs its current admin PIN.
+static const struct {
+    enum PHASE phase;
+    const char* name;
+    int (*run)(struct bootstrap_state* state);
+    int (*enabled)();
+} _bootstrap_steps[] = {
+    {PHASE_SETUP, "setup_gpgme", step_setup, NULL},
+    {PHASE_MASTERKEY, "generate_masterkey", step_masterkey, NULL},
+    {PHASE_REVOCATION, "store_revocation", step_revocation, NULL},
+    {PHASE_SUBKEY, "generate_subkeys", step_subkey, NULL},
+    {PHASE_EXPORT_MASTERKEY, "export_masterkey", step_export_masterkey, NULL},
+    {PHASE_KEYTOCARD, "move_subkeys_to_card", step_keytocard,
+     keytocard_enabled},
+    {PHASE_PERSONALIZE, "personalize_card", step_personalize,
+     personalize_enabled},
+};
+#define BOOTSTRAP_STEP_COUNT \
+    (sizeof(_bootstrap_steps) / sizeof(_bootstrap_steps[0]))
+
 int bootstrap(const char* username,
               const char* firstname,
               const char* lastname,
               const char* email,
               const char* passphrase)
 {
-    int err;
-    struct gpgme_context* context = NULL;
-    char masterkey_fpr[41];
-
-    if ((err = check_gpgme()) != 0)
-        return err;
-
-    static char temporary_keyring[256];
-    if (!mk_tmpdir(temporary_keyring, sizeof(temporary_keyring))) {
-        log_error("Failed to create temporary keyring.\n");
-        return 1;
-    }
-    log_debug("Using temporary keyring directory %s.\n", temporary_keyring);
+    int err = 0;
+    struct phase_span span;
+    struct bootstrap_state state = {
+        NULL, "", username, firstname, lastname, email, passphrase, "", "",
+    };
 
-    if ((err = setup_gpgme(&context, temporary_keyring)) != 0) {
-        log_error("Step setup_gpgme failed.\n");
-        goto cleanup;
+    // The card stages run under the temporary keyring, the user keyring is
+    // restored for the next bootstrap()
+    char homedir[1024] = "";
+    if (getenv("GNUPGHOME"))
+        snprintf(homedir, sizeof(homedir), "%s", getenv("GNUPGHOME"));
+
+    trace_card(username);
+
+    // Simulated steps never touch GPG nor the keyring
+    if (!simulating()) {
+        // Duplicates are refused before any key is generated
+        char fpr[41];
+        int found = identity_find(username, email, fpr, sizeof(fpr));
+        if (found < 0) {
+            log_error("Failed to look %s <%s> up in the identity index.\n",
+                      username, email);
+            return 1;
+        }
+        if (found) {
+            log_error("%s <%s> already has masterkey %s.\n", username, email,
+                      fpr);
+            return 1;
+        }
+
+        if ((err = check_gpgme()) != 0 || (err = check_gcrypt()) != 0)
+            return err;
+
+        // Every record of this bootstrap carries the card serial, whichever
+        // steps later open the card
+        if (card_read_serial(state.serial, sizeof(state.serial)))
+            log_warning("No card found, bootstrap is not recorded against "
+                        "its serial.\n");
+
+        if (!mk_tmpdir(state.temporary_keyring,
+                       sizeof(state.temporary_keyring))) {
+            log_error("Failed to create temporary keyring.\n");
+            return 1;
+        }
+        log_debug("Using temporary keyring directory %s.\n",
+                  state.temporary_keyring);
     }
 
-    if ((err = generate_masterkey(context, temporary_keyring, username,
-                                  firstname, lastname, email, passphrase,
-                                  masterkey_fpr)) != 0) {
-        log_error("Step generate_masterkey failed.\n");
-        goto cleanup;
+    audit_subject(username, NULL, state.serial);
+
+    for (size_t i = 0; i < BOOTSTRAP_STEP_COUNT && !err; ++i) {
+        if (_bootstrap_steps[i].enabled && !_bootstrap_steps[i].enabled())
+            continue;
+        phase_begin(&span, _bootstrap_steps[i].phase);
+        if (simulating())
+            err = simulate_phase(_bootstrap_steps[i].phase);
+        else
+            err = _bootstrap_steps[i].run(&state);
+        if (phase_end(&span, err))
+            log_error("Step %s failed.\n", _bootstrap_steps[i].name);
     }
 
-    if ((err = generate_subkey_encrypt(context, masterkey_fpr))) {
-        log_error("Step generate_subkey_encrypt failed.\n");
-        goto cleanup;
-    }
+    // Indexed once complete, a failed bootstrap can be run again
+    if (!err && !simulating() && identity_indexed())
+        err = identity_record(username, email, state.masterkey_fpr);
 
-    if ((err = export_masterkey(context, temporary_keyring, passphrase,
-                                masterkey_fpr))) {
-        log_error("Step export_masterkey failed.\n");
-        goto cleanup;
+    if (!simulating()) {
+        rm_tmpdir(state.temporary_keyring);
+        if (*homedir)
+            setenv("GNUPGHOME", homedir, 1);
+        else
+            unsetenv("GNUPGHOME");
     }
-
-cleanup:
-    rm_tmpdir(temporary_keyring);
+    audit_clear();
+    metrics_increment(COUNTER_BOOTSTRAP_CARDS);
 
     return err;
 }
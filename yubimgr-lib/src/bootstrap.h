@@ -0,0 +1,65 @@
+/*
+Copyright (C) 2016 Aurelien Vallee
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef YUBIMGR_BOOTSTRAP_H
+#define YUBIMGR_BOOTSTRAP_H
+
+#include <gpgme.h>
+
+#include <stddef.h>
+
+// Helpers from bootstrap.c shared with the other library stages
+
+int check_gpgme();
+
+int check_gcrypt();
+
+// Creates an empty keyring directory under $TMPDIR, returns 0 on failure.
+int mk_tmpdir(char* tmpdir, size_t size);
+
+void rm_tmpdir(const char* path);
+
+// Configures gpg and a fresh gpg-agent in homedir, and creates a context
+// bound to it. Several keyrings can be used at once, from different
+// threads.
+int setup_homedir(struct gpgme_context** context, const char* homedir);
+
+// Makes the gpg-agent of the keyring answer passphrase prompts by itself.
+int set_passphrase(const char* temporary_keyring, const char* passphrase);
+
+// Same, answering the card admin PIN prompts with admin_pin instead
+int set_card_passphrase(const char* temporary_keyring,
+                        const char* passphrase,
+                        const char* admin_pin);
+
+// A scripted keyedit answer: response is sent on the next request prompt
+struct step {
+    const char* request;
+    const char* response;
+};
+
+// Runs a scripted keyedit session on the masterkey
+int edit_masterkey(struct gpgme_context* context,
+                   const char* masterkey_fpr,
+                   struct step* steps,
+                   size_t count);
+
+#endif  // YUBIMGR_BOOTSTRAP_H
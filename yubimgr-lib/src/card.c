@@ -0,0 +1,255 @@
+/*
+Copyright (C) 2016 Aurelien Vallee
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <yubimgr/card.h>
+#include <yubimgr/logging.h>
+
+#include "apdu.h"
+#include "audit_log.h"
+#include "bootstrap.h"
+#include "trace_events.h"
+
+#include <gpgme.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static gpgme_error_t card_data_cb(void* opaque, const void* data, size_t size)
+{
+    struct card_session* session = (struct card_session*)opaque;
+
+    if (size > sizeof(session->response) - session->response_size)
+        return gpgme_error(GPG_ERR_TOO_LARGE);
+
+    memcpy(session->response + session->response_size, data, size);
+    session->response_size += size;
+
+    return 0;
+}
+
+static gpgme_error_t card_status_cb(void* opaque,
+                                    const char* status,
+                                    const char* args)
+{
+    struct card_session* session = (struct card_session*)opaque;
+
+    if (!strcmp(status, "SERIALNO")) {
+        snprintf(session->serial, sizeof(session->serial), "%s", args);
+        session->serial[strcspn(session->serial, " ")] = 0;
+    }
+
+    return 0;
+}
+
+int card_open(struct card_session** session)
+{
+    gpgme_error_t err;
+
+    if ((err = check_gpgme()) != 0)
+        return err;
+
+    // Unlike gpg, the Assuan protocol does not autostart gpg-agent
+    static const char* const launch[] = {"gpgconf", "--launch", "gpg-agent",
+                                         NULL};
+    if (run_command(launch, 0)) {
+        log_error("Failed to launch gpg-agent.\n");
+        return 1;
+    }
+
+    *session = (struct card_session*)calloc(1, sizeof(struct card_session));
+    if (!*session)
+        return 1;
+
+    // The assuan protocol talks to gpg-agent, which forwards SCD commands
+    if ((err = gpgme_new(&(*session)->context)) != GPG_ERR_NO_ERROR) {
+        log_error("Failed to create GPGME context.\n");
+        goto error;
+    }
+
+    if ((err = gpgme_set_protocol((*session)->context,
+                                  GPGME_PROTOCOL_ASSUAN)) !=
+        GPG_ERR_NO_ERROR) {
+        log_error("Failed to use Assuan protocol.\n");
+        goto error;
+    }
+
+    // A stuck card or agent cancels the whole session once the current
+    // phase deadline expires
+    watchdog_arm(&(*session)->watchdog, (*session)->context);
+
+    if ((err = card_command(*session, "SCD SERIALNO undefined")))
+        goto error;
+
+    // Whatever happens next is recorded against this card, and its lane in
+    // the trace is named after it
+    char serial[16];
+    card_printed_serial(*session, serial, sizeof(serial));
+    audit_subject(NULL, NULL, serial);
+    trace_card_serial(serial);
+
+    return 0;
+
+error:
+    card_close(*session);
+    *session = NULL;
+    return err;
+}
+
+void card_close(struct card_session* session)
+{
+    if (!session)
+        return;
+
+    watchdog_disarm(&session->watchdog, 0);
+    gpgme_release(session->context);
+    free(session);
+}
+
+const char* card_serial(const struct card_session* session)
+{
+    return session->serial;
+}
+
+void card_printed_serial(const struct card_session* session,
+                         char* serial,
+                         size_t size)
+{
+    const char* aid = session->serial;
+
+    serial[0] = 0;
+    if (strlen(aid) == 32 && !strncmp(aid, "D276000124", 10))
+        snprintf(serial, size, "%.8s", aid + 20);
+}
+
+int card_read_serial(char* serial, size_t size)
+{
+    struct card_session* session;
+
+    serial[0] = 0;
+    int err   = card_open(&session);
+    if (!err) {
+        card_printed_serial(session, serial, size);
+        card_close(session);
+    }
+
+    return err;
+}
+
+int card_command(struct card_session* session, const char* command)
+{
+    gpgme_error_t err;
+    gpgme_error_t op_err = 0;
+
+    session->response_size = 0;
+
+    if ((err = gpgme_op_assuan_transact_ext(session->context, command,
+                                            card_data_cb, session, NULL, NULL,
+                                            card_status_cb, session,
+                                            &op_err)) ||
+        (err = op_err)) {
+        err = watchdog_error(&session->watchdog, err);
+        log_error("Card command failed (%d). %s: %s\n", err,
+                  gpgme_strsource(err), gpgme_strerror(err));
+        return err;
+    }
+
+    return 0;
+}
+
+int card_transient(int err)
+{
+    switch (gpgme_err_code(err)) {
+        case GPG_ERR_CARD:
+        case GPG_ERR_CARD_RESET:
+        case GPG_ERR_CARD_REMOVED:
+        case GPG_ERR_CARD_NOT_PRESENT:
+        case GPG_ERR_EIO:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+int card_pin_retry(unsigned int sw)
+{
+    return (sw & 0xFFF0) == 0x63C0 || sw == SW_SECURITY_STATUS;
+}
+
+int card_apdu(struct card_session* session,
+              const unsigned char* apdu,
+              size_t size,
+              unsigned int* sw)
+{
+    int err;
+    static const char prefix[] = "SCD APDU --more ";
+    char command[sizeof(prefix) + 2 * APDU_MAX_SIZE];
+
+    if (size > APDU_MAX_SIZE)
+        return 1;
+
+    // Only the header is logged, the data may contain PINs
+    log_trace("APDU %02X %02X %02X %02X (%zu bytes).\n", apdu[0], apdu[1],
+              apdu[2], apdu[3], size);
+
+    char* p = command + sprintf(command, "%s", prefix);
+    for (size_t i = 0; i < size; ++i)
+        p += sprintf(p, "%02X", apdu[i]);
+
+    if ((err = card_command(session, command)))
+        return err;
+
+    // scdaemon returns the response with the status word appended
+    if (session->response_size < 2) {
+        log_error("Truncated APDU response.\n");
+        return 1;
+    }
+
+    session->response_size -= 2;
+    *sw = (session->response[session->response_size] << 8) |
+          session->response[session->response_size + 1];
+
+    log_trace("APDU status word %04X.\n", *sw);
+
+    return 0;
+}
+
+size_t apdu_build(unsigned char* apdu,
+                  unsigned char cla,
+                  unsigned char ins,
+                  unsigned char p1,
+                  unsigned char p2,
+                  const unsigned char* data,
+                  size_t size)
+{
+    apdu[0] = cla;
+    apdu[1] = ins;
+    apdu[2] = p1;
+    apdu[3] = p2;
+
+    if (!size)
+        return 4;
+
+    apdu[4] = size;
+    memcpy(apdu + 5, data, size);
+
+    return 5 + size;
+}
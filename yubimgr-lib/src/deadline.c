@@ -0,0 +1,276 @@
+/*
+Copyright (C) 2016 Aurelien Vallee
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <yubimgr/timeout.h>
+#include <yubimgr/logging.h>
+
+#include "deadline.h"
+#include "phase.h"
+#include "simulation.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+// Time left to a killed command to exit before SIGKILL
+#define KILL_GRACE 2.0
+
+#define RETRY_BASE_DELAY 0.25
+#define RETRY_MAX_DELAY 4.0
+
+static double _phase_timeouts[PHASE_COUNT];
+static int _phase_timeouts_set[PHASE_COUNT];
+
+static __thread double _deadline;
+static __thread unsigned int _jitter_seed;
+
+void set_phase_timeout(enum PHASE phase, double seconds)
+{
+    if (phase >= PHASE_COUNT)
+        return;
+
+    _phase_timeouts[phase]     = seconds;
+    _phase_timeouts_set[phase] = 1;
+}
+
+double phase_timeout(enum PHASE phase)
+{
+    if (phase >= PHASE_COUNT || !_phase_timeouts_set[phase])
+        return DEFAULT_PHASE_TIMEOUT;
+
+    return _phase_timeouts[phase];
+}
+
+double deadline_current()
+{
+    return _deadline;
+}
+
+double deadline_enter(double timeout)
+{
+    double previous = _deadline;
+
+    if (timeout > 0) {
+        double deadline = monotonic_now() + timeout;
+        if (!_deadline || deadline < _deadline)
+            _deadline = deadline;
+    }
+
+    return previous;
+}
+
+void deadline_leave(double previous)
+{
+    _deadline = previous;
+}
+
+int deadline_expired()
+{
+    return _deadline && monotonic_now() >= _deadline;
+}
+
+static void to_timespec(double seconds, struct timespec* ts)
+{
+    ts->tv_sec  = (time_t)seconds;
+    ts->tv_nsec = (long)((seconds - ts->tv_sec) * 1e9);
+    if (ts->tv_nsec >= 1000000000L)
+        ts->tv_nsec = 999999999L;
+}
+
+static void sleep_for(double seconds)
+{
+    struct timespec ts;
+
+    if (simulating()) {
+        simulation_sleep(seconds);
+        return;
+    }
+
+    to_timespec(seconds, &ts);
+    while (nanosleep(&ts, &ts) && errno == EINTR)
+        ;
+}
+
+static void* watchdog_run(void* opaque)
+{
+    struct watchdog* watchdog = (struct watchdog*)opaque;
+    struct timespec ts;
+
+    to_timespec(watchdog->deadline, &ts);
+
+    pthread_mutex_lock(&watchdog->mutex);
+    while (!watchdog->stopped) {
+        if (pthread_cond_timedwait(&watchdog->cond, &watchdog->mutex, &ts) ==
+            ETIMEDOUT) {
+            if (!watchdog->stopped) {
+                watchdog->fired = 1;
+                gpgme_cancel_async(watchdog->context);
+            }
+            break;
+        }
+    }
+    pthread_mutex_unlock(&watchdog->mutex);
+
+    return NULL;
+}
+
+void watchdog_arm(struct watchdog* watchdog, struct gpgme_context* context)
+{
+    pthread_condattr_t attr;
+
+    watchdog->context  = context;
+    watchdog->deadline = deadline_current();
+    watchdog->armed    = 0;
+    watchdog->stopped  = 0;
+    watchdog->fired    = 0;
+
+    if (!watchdog->deadline)
+        return;
+
+    // Deadlines are expressed on the monotonic clock
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&watchdog->cond, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_mutex_init(&watchdog->mutex, NULL);
+
+    if (pthread_create(&watchdog->thread, NULL, watchdog_run, watchdog)) {
+        log_warning("Failed to start watchdog, operation is unbounded.\n");
+        pthread_cond_destroy(&watchdog->cond);
+        pthread_mutex_destroy(&watchdog->mutex);
+        return;
+    }
+
+    watchdog->armed = 1;
+}
+
+gpgme_error_t watchdog_disarm(struct watchdog* watchdog, gpgme_error_t err)
+{
+    if (!watchdog->armed)
+        return err;
+
+    pthread_mutex_lock(&watchdog->mutex);
+    watchdog->stopped = 1;
+    pthread_cond_signal(&watchdog->cond);
+    pthread_mutex_unlock(&watchdog->mutex);
+
+    pthread_join(watchdog->thread, NULL);
+    pthread_cond_destroy(&watchdog->cond);
+    pthread_mutex_destroy(&watchdog->mutex);
+    watchdog->armed = 0;
+
+    return watchdog_error(watchdog, err);
+}
+
+gpgme_error_t watchdog_error(struct watchdog* watchdog, gpgme_error_t err)
+{
+    if (err && __atomic_load_n(&watchdog->fired, __ATOMIC_RELAXED))
+        return gpgme_error(GPG_ERR_TIMEOUT);
+
+    return err;
+}
+
+int run_command(const char* const argv[], int quiet)
+{
+    int status;
+    double deadline = deadline_current();
+    double interval = 0.001;
+    int sent        = 0;
+
+    log_debug("Running command \"%s\".\n", argv[0]);
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        log_error("Failed to run \"%s\".\n", argv[0]);
+        return 1;
+    }
+
+    if (pid == 0) {
+        if (quiet) {
+            int fd = open("/dev/null", O_RDWR);
+            dup2(fd, STDOUT_FILENO);
+            dup2(fd, STDERR_FILENO);
+        }
+        execvp(argv[0], (char* const*)argv);
+        _exit(127);
+    }
+
+    for (;;) {
+        pid_t r = waitpid(pid, &status, WNOHANG);
+        if (r == pid)
+            break;
+        if (r < 0 && errno != EINTR) {
+            log_error("Failed to wait for \"%s\".\n", argv[0]);
+            return 1;
+        }
+
+        // Ask politely first, then give up on the command
+        if (deadline && monotonic_now() >= deadline) {
+            sent = sent ? SIGKILL : SIGTERM;
+            log_error("Command \"%s\" timed out, sending %s.\n", argv[0],
+                      sent == SIGKILL ? "SIGKILL" : "SIGTERM");
+            kill(pid, sent);
+            deadline = sent == SIGKILL ? 0 : monotonic_now() + KILL_GRACE;
+        }
+
+        sleep_for(interval);
+        if (interval < 0.05)
+            interval *= 2;
+    }
+
+    if (sent)
+        return gpgme_error(GPG_ERR_TIMEOUT);
+
+    if (!WIFEXITED(status))
+        return 1;
+
+    return WEXITSTATUS(status);
+}
+
+int retry_backoff(int* attempt)
+{
+    if (++*attempt >= RETRY_MAX_ATTEMPTS)
+        return 1;
+
+    double delay = RETRY_BASE_DELAY * (1 << (*attempt - 1));
+    if (delay > RETRY_MAX_DELAY)
+        delay = RETRY_MAX_DELAY;
+
+    // Jitter keeps readers failing together from retrying in lockstep
+    if (!_jitter_seed)
+        _jitter_seed = (unsigned int)(monotonic_now() * 1e6) ^ getpid();
+    delay = delay / 2 + delay / 2 * rand_r(&_jitter_seed) / RAND_MAX;
+
+    if (_deadline && monotonic_now() + delay >= _deadline)
+        return 1;
+
+    log_warning("Retrying in %.2fs (attempt %d of %d).\n", delay,
+                *attempt + 1, RETRY_MAX_ATTEMPTS);
+    metrics_increment(COUNTER_RETRIES);
+    sleep_for(delay);
+
+    return 0;
+}
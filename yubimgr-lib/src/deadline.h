@@ -0,0 +1,79 @@
+/*
+Copyright (C) 2016 Aurelien Vallee
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef YUBIMGR_DEADLINE_H
+#define YUBIMGR_DEADLINE_H
+
+#include <yubimgr/timeout.h>
+
+#include <gpgme.h>
+#include <pthread.h>
+
+// Deadlines are absolute monotonic times (see monotonic_now()), 0 meaning
+// unbounded. The current deadline is per thread and set by phase_begin().
+double deadline_current();
+
+// Enters a scope bounded by timeout seconds (never extending the current
+// deadline). Returns the previous deadline, to be restored by
+// deadline_leave().
+double deadline_enter(double timeout);
+
+void deadline_leave(double previous);
+
+int deadline_expired();
+
+double phase_timeout(enum PHASE phase);
+
+// Cancels a GPGME context when the current deadline expires, so that
+// synchronous operations (edit, genkey, assuan transactions) cannot block
+// forever. Nothing is started when the deadline is unbounded.
+struct watchdog {
+    struct gpgme_context* context;
+    double deadline;
+    int armed;
+    int stopped;
+    int fired;
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+};
+
+void watchdog_arm(struct watchdog* watchdog, struct gpgme_context* context);
+
+// Stops the watchdog. Returns GPG_ERR_TIMEOUT if it fired, err otherwise.
+gpgme_error_t watchdog_disarm(struct watchdog* watchdog, gpgme_error_t err);
+
+// Returns GPG_ERR_TIMEOUT if the watchdog already fired, err otherwise.
+gpgme_error_t watchdog_error(struct watchdog* watchdog, gpgme_error_t err);
+
+// Runs argv (looked up in PATH) until the current deadline, then kills it.
+// Output is discarded when quiet is set. Returns the exit status, or
+// GPG_ERR_TIMEOUT if the command had to be killed.
+int run_command(const char* const argv[], int quiet);
+
+// Exponential backoff with jitter between retries of transient errors.
+// Returns 0 after sleeping if another attempt is allowed, 1 once attempts
+// are exhausted or the next one would start past the current deadline.
+#define RETRY_MAX_ATTEMPTS 4
+
+int retry_backoff(int* attempt);
+
+#endif  // YUBIMGR_DEADLINE_H
@@ -0,0 +1,79 @@
+/*
+Copyright (C) 2016 Aurelien Vallee
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "encoding.h"
+
+static const char base64_alphabet[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+size_t base64_encode(const unsigned char* in, size_t size, char* out)
+{
+    size_t i, j = 0;
+
+    for (i = 0; i + 2 < size; i += 3) {
+        unsigned long v = (in[i] << 16) | (in[i + 1] << 8) | in[i + 2];
+        out[j++]        = base64_alphabet[(v >> 18) & 0x3f];
+        out[j++]        = base64_alphabet[(v >> 12) & 0x3f];
+        out[j++]        = base64_alphabet[(v >> 6) & 0x3f];
+        out[j++]        = base64_alphabet[v & 0x3f];
+    }
+
+    // Pad the last incomplete group
+    if (i < size) {
+        unsigned long v = in[i] << 16;
+        if (i + 1 < size)
+            v |= in[i + 1] << 8;
+        out[j++] = base64_alphabet[(v >> 18) & 0x3f];
+        out[j++] = base64_alphabet[(v >> 12) & 0x3f];
+        out[j++] = (i + 1 < size) ? base64_alphabet[(v >> 6) & 0x3f] : '=';
+        out[j++] = '=';
+    }
+
+    out[j] = 0;
+
+    return j;
+}
+
+static const char zbase32_alphabet[] = "ybndrfg8ejkmcpqxot1uwisza345h769";
+
+size_t zbase32_encode(const unsigned char* in, size_t size, char* out)
+{
+    size_t j          = 0;
+    unsigned long v   = 0;
+    unsigned int bits = 0;
+
+    for (size_t i = 0; i < size; ++i) {
+        v = (v << 8) | in[i];
+        bits += 8;
+        while (bits >= 5) {
+            bits -= 5;
+            out[j++] = zbase32_alphabet[(v >> bits) & 0x1f];
+        }
+    }
+
+    // The last incomplete group is padded with zero bits
+    if (bits)
+        out[j++] = zbase32_alphabet[(v << (5 - bits)) & 0x1f];
+
+    out[j] = 0;
+
+    return j;
+}
@@ -0,0 +1,38 @@
+/*
+Copyright (C) 2016 Aurelien Vallee
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef YUBIMGR_ENCODING_H
+#define YUBIMGR_ENCODING_H
+
+#include <stddef.h>
+
+// Number of bytes (including \0) needed to base64 encode size bytes
+#define BASE64_SIZE(size) ((((size) + 2) / 3) * 4 + 1)
+
+size_t base64_encode(const unsigned char* in, size_t size, char* out);
+
+// Number of bytes (including \0) needed to z-base-32 encode size bytes
+#define ZBASE32_SIZE(size) (((size) * 8 + 4) / 5 + 1)
+
+// z-base-32 encoding, without padding, as used by the Web Key Directory
+size_t zbase32_encode(const unsigned char* in, size_t size, char* out);
+
+#endif  // YUBIMGR_ENCODING_H
@@ -0,0 +1,235 @@
+/*
+Copyright (C) 2016 Aurelien Vallee
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <yubimgr/yubimgr.h>
+#include <yubimgr/logging.h>
+
+#include "audit_log.h"
+#include "bootstrap.h"
+#include "deadline.h"
+#include "keylist.h"
+#include "phase.h"
+
+#include <gpgme.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Escapes a RDN value as per RFC 4514 section 2.4
+static void escape_dn_value(const char* value, char* out, size_t size)
+{
+    size_t j = 0;
+
+    for (size_t i = 0; value[i] && j + 3 < size; ++i) {
+        if (strchr(",+\"\\<>;=", value[i]) ||
+            ((i == 0) && (value[i] == ' ' || value[i] == '#')) ||
+            (!value[i + 1] && value[i] == ' '))
+            out[j++] = '\\';
+        out[j++] = value[i];
+    }
+    out[j] = 0;
+}
+
+// Returns NULL for algorithms that cannot sign a PKCS#10 request
+static const char* csr_key_type(gpgme_subkey_t subkey)
+{
+    switch (subkey->pubkey_algo) {
+        case GPGME_PK_RSA:
+        case GPGME_PK_RSA_S:
+            return "RSA";
+        case GPGME_PK_ECDSA:
+            return "ECDSA";
+        case GPGME_PK_EDDSA:
+            return "EdDSA";
+        default:
+            return NULL;
+    }
+}
+
+static int append_csr(struct gpgme_context* context,
+                      gpgme_key_t key,
+                      const char* dn_suffix,
+                      FILE* bundle,
+                      FILE* manifest)
+{
+    int err;
+    gpgme_data_t csr      = NULL;
+    gpgme_subkey_t subkey = find_auth_subkey(key);
+    gpgme_user_id_t uid   = key->uids;
+
+    if (!subkey || !subkey->keygrip || !uid) {
+        log_error("Key %s has no usable authentication subkey.\n",
+                  key->subkeys->fpr);
+        return 1;
+    }
+
+    const char* key_type = csr_key_type(subkey);
+    if (!key_type) {
+        log_error("Subkey %s uses an algorithm (%d) unsupported in CSRs.\n",
+                  subkey->fpr, subkey->pubkey_algo);
+        return 1;
+    }
+
+    static const char genkey_params_template[] =
+        "<GnupgKeyParms format=\"internal\">\n"
+        "    Key-Type: %s\n"
+        "    Key-Grip: %s\n"
+        "    Key-Usage: sign\n"
+        "    Name-DN: CN=%s%s%s\n"
+        "    Name-Email: %s\n"
+        "</GnupgKeyParms>\n";
+
+    char common_name[512];
+    escape_dn_value(uid->name ? uid->name : key_username(key), common_name,
+                    sizeof(common_name));
+
+    char genkey_params[2048];
+    snprintf(genkey_params, sizeof(genkey_params), genkey_params_template,
+             key_type, subkey->keygrip, common_name,
+             dn_suffix ? "," : "", dn_suffix ? dn_suffix : "",
+             uid->email ? uid->email : "");
+
+    log_trace("CSR generation params:\n%s", genkey_params);
+
+    if ((err = gpgme_data_new(&csr))) {
+        log_error("Failed to create new data.\n");
+        return err;
+    }
+
+    // The agent signs the request with the card (or software) key, which may
+    // wait on a PIN or touch prompt
+    struct watchdog watchdog;
+    watchdog_arm(&watchdog, context);
+    err = gpgme_op_genkey(context, genkey_params, csr, NULL);
+    if ((err = watchdog_disarm(&watchdog, err))) {
+        log_error("Failed to create CSR for %s (%d). %s: %s\n",
+                  key_username(key), err, gpgme_strsource(err),
+                  gpgme_strerror(err));
+        gpgme_data_release(csr);
+        return err;
+    }
+
+    size_t size;
+    char* pem = gpgme_data_release_and_get_mem(csr, &size);
+
+    // Text outside of the PEM boundaries is ignored by PKCS#10 parsers
+    fprintf(bundle, "# %s <%s> %s\n", key_username(key),
+            uid->email ? uid->email : "", subkey->fpr);
+    fwrite(pem, 1, size, bundle);
+    fprintf(manifest, "%s\t%s\t%s\t%s\t%s\n", key_username(key),
+            uid->email ? uid->email : "", key->subkeys->fpr, subkey->fpr,
+            subkey->keygrip);
+    gpgme_free(pem);
+
+    return 0;
+}
+
+static int export_csr_bundle(const char** patterns,
+                             const char* output,
+                             const char* dn_suffix)
+{
+    int err;
+    struct gpgme_context* keyring = NULL;
+    struct gpgme_context* context = NULL;
+    gpgme_key_t* keys             = NULL;
+    size_t count                  = 0;
+    FILE* bundle                  = NULL;
+    FILE* manifest                = NULL;
+
+    if ((err = check_gpgme()) != 0)
+        return err;
+
+    if ((err = gpgme_engine_check_version(GPGME_PROTOCOL_CMS))) {
+        log_error("Failed to check for CMS support (gpgsm).\n");
+        return err;
+    }
+
+    if ((err = open_keyring(&keyring)))
+        return err;
+
+    if ((err = keylist_collect(keyring, patterns, 0, &keys, &count)))
+        goto cleanup;
+
+    if ((err = gpgme_new(&context))) {
+        log_error("Failed to create GPGME context.\n");
+        goto cleanup;
+    }
+
+    if ((err = gpgme_set_protocol(context, GPGME_PROTOCOL_CMS))) {
+        log_error("Failed to use CMS protocol.\n");
+        goto cleanup;
+    }
+
+    gpgme_set_armor(context, 1);
+
+    char manifest_path[1024];
+    snprintf(manifest_path, sizeof(manifest_path), "%s.manifest", output);
+    if (!(bundle = fopen(output, "w")) ||
+        !(manifest = fopen(manifest_path, "w"))) {
+        log_error("Failed to open CSR bundle \"%s\": %s\n", output,
+                  strerror(errno));
+        err = 1;
+        goto cleanup;
+    }
+    fputs("# username\temail\tmasterkey\tsubkey\tkeygrip\n", manifest);
+
+    size_t generated = 0;
+    size_t failed    = 0;
+    for (size_t i = 0; i < count; ++i) {
+        if (!find_auth_subkey(keys[i]))
+            continue;
+        log_debug("Generating CSR for %s.\n", key_username(keys[i]));
+        int csr_err = append_csr(context, keys[i], dn_suffix, bundle, manifest);
+        audit_event(PHASE_EXPORT_CSR, csr_err, key_username(keys[i]),
+                    keys[i]->fpr, NULL);
+        if (csr_err)
+            failed++;
+        else
+            generated++;
+    }
+
+    log_info("Generated %zu CSRs to \"%s\" (%zu failed).\n", generated,
+             output, failed);
+
+    if (failed || !generated)
+        err = 1;
+
+cleanup:
+    if (manifest && fclose(manifest))
+        err = err ? err : 1;
+    if (bundle && fclose(bundle))
+        err = err ? err : 1;
+    keylist_release(keys);
+    gpgme_release(context);
+    gpgme_release(keyring);
+
+    return err;
+}
+
+int export_csr(const char** patterns, const char* output, const char* dn_suffix)
+{
+    struct phase_span span;
+
+    phase_begin(&span, PHASE_EXPORT_CSR);
+    return phase_end(&span, export_csr_bundle(patterns, output, dn_suffix));
+}
@@ -0,0 +1,195 @@
+/*
+Copyright (C) 2016 Aurelien Vallee
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <yubimgr/yubimgr.h>
+#include <yubimgr/logging.h>
+
+#include "audit_log.h"
+#include "bootstrap.h"
+#include "keylist.h"
+#include "phase.h"
+#include "string_table.h"
+#include "wkd.h"
+
+#include <gpgme.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+// Publishes every valid user ID of the exported keys
+static int publish_wkd(const char* output_dir,
+                       const char* buffer,
+                       gpgme_key_t* keys,
+                       const struct key_block* blocks,
+                       size_t count,
+                       size_t* updated,
+                       size_t* unchanged)
+{
+    size_t capacity      = 0;
+    size_t entries_count = 0;
+
+    for (size_t i = 0; i < count; ++i)
+        for (gpgme_user_id_t uid = keys[i]->uids; uid; uid = uid->next)
+            capacity++;
+
+    if (!capacity)
+        return 0;
+
+    struct wkd_entry* entries =
+        (struct wkd_entry*)calloc(capacity, sizeof(struct wkd_entry));
+    if (!entries)
+        return 1;
+
+    for (size_t i = 0; i < count; ++i) {
+        if (blocks[i].end <= blocks[i].start)
+            continue;
+        for (gpgme_user_id_t uid = keys[i]->uids; uid; uid = uid->next) {
+            if (uid->revoked || uid->invalid ||
+                wkd_entry_init(&entries[entries_count], uid->email))
+                continue;
+            entries[entries_count++].key = i;
+        }
+    }
+
+    int err = wkd_publish(output_dir, buffer, blocks, entries, entries_count,
+                          updated, unchanged);
+    free(entries);
+
+    return err;
+}
+
+static int export_public_keys(const char** patterns, const char* output_dir)
+{
+    int err;
+    struct gpgme_context* context = NULL;
+    gpgme_key_t* keys             = NULL;
+    size_t count                  = 0;
+    struct string_table table     = {0};
+    struct key_block* blocks      = NULL;
+    const char** fprs             = NULL;
+    gpgme_data_t data             = NULL;
+    char* buffer                  = NULL;
+
+    if ((err = check_gpgme()) != 0 || (err = check_gcrypt()) != 0)
+        return err;
+
+    if (make_dir(output_dir, 0755))
+        return 1;
+
+    if ((err = open_keyring(&context)))
+        return err;
+
+    if ((err = keylist_collect(context, patterns, 0, &keys, &count)))
+        goto cleanup;
+
+    if (!count) {
+        log_error("No public key to export.\n");
+        err = 1;
+        goto cleanup;
+    }
+
+    blocks = (struct key_block*)calloc(count, sizeof(struct key_block));
+    fprs   = (const char**)calloc(count + 1, sizeof(const char*));
+    if (!blocks || !fprs || (err = string_table_init(&table, count))) {
+        err = 1;
+        goto cleanup;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        fprs[i] = keys[i]->subkeys->fpr;
+        string_table_insert(&table, fprs[i], i);
+    }
+
+    // Export the whole cohort at once, in binary form, by fingerprint so
+    // that the stream holds exactly the listed keys
+    if ((err = gpgme_data_new(&data))) {
+        log_error("Failed to create new data.\n");
+        goto cleanup;
+    }
+
+    gpgme_set_armor(context, 0);
+    if ((err = gpgme_op_export_ext(context, fprs, 0, data))) {
+        log_error("Failed to export keys. %s: %s\n", gpgme_strsource(err),
+                  gpgme_strerror(err));
+        goto cleanup;
+    }
+
+    size_t size;
+    buffer = gpgme_data_release_and_get_mem(data, &size);
+    data   = NULL;
+
+    if ((err = split_keys((const unsigned char*)buffer, size, &table, blocks,
+                          count))) {
+        log_error("Failed to parse exported keys.\n");
+        goto cleanup;
+    }
+
+    size_t updated   = 0;
+    size_t unchanged = 0;
+
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/keyring.gpg", output_dir);
+    int written = write_if_changed(path, buffer, size);
+    if (written > 0) {
+        err = 1;
+        goto cleanup;
+    }
+
+    err = publish_wkd(output_dir, buffer, keys, blocks, count, &updated,
+                      &unchanged);
+
+    size_t exported = 0;
+    for (size_t i = 0; i < count; ++i) {
+        int missing = blocks[i].end <= blocks[i].start;
+        if (missing)
+            log_error("Key %s is missing from the export.\n", keys[i]->fpr);
+        else
+            exported++;
+        audit_event(PHASE_EXPORT_KEYS, missing || err, key_username(keys[i]),
+                    keys[i]->fpr, NULL);
+    }
+
+    log_info("Exported %zu public keys out of %zu to \"%s\" (keyring %s, "
+             "%zu WKD entries updated, %zu unchanged).\n",
+             exported, count, output_dir, written ? "unchanged" : "updated",
+             updated, unchanged);
+
+    if (!err && exported != count)
+        err = 1;
+
+cleanup:
+    gpgme_free(buffer);
+    gpgme_data_release(data);
+    free(fprs);
+    free(blocks);
+    string_table_release(&table);
+    keylist_release(keys);
+    gpgme_release(context);
+
+    return err;
+}
+
+int export_keys(const char** patterns, const char* output_dir)
+{
+    struct phase_span span;
+
+    phase_begin(&span, PHASE_EXPORT_KEYS);
+    return phase_end(&span, export_public_keys(patterns, output_dir));
+}
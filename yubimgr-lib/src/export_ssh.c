@@ -0,0 +1,230 @@
+/*
+Copyright (C) 2016 Aurelien Vallee
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <yubimgr/yubimgr.h>
+#include <yubimgr/logging.h>
+
+#include "audit_log.h"
+#include "bootstrap.h"
+#include "keylist.h"
+#include "openpgp.h"
+#include "phase.h"
+#include "ssh.h"
+#include "string_table.h"
+
+#include <gpgme.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+// Several keys may share a username, the later ones are appended
+static FILE* open_user_file(const char* output_dir, gpgme_key_t key, int append)
+{
+    char path[1024];
+    char name[256];
+
+    // Usernames end up in a path, keep them on a single component
+    strncpy(name, key_username(key), sizeof(name) - 1);
+    name[sizeof(name) - 1] = 0;
+    for (char* c = name; *c; ++c)
+        if (*c == '/')
+            *c = '_';
+
+    snprintf(path, sizeof(path), "%s/%s.pub", output_dir, name);
+    log_trace("Writing SSH public key to \"%s\".\n", path);
+
+    FILE* file = fopen(path, append ? "a" : "w");
+    if (!file)
+        log_error("Failed to open \"%s\": %s\n", path, strerror(errno));
+
+    return file;
+}
+
+static int export_ssh_keys(const char** patterns, const char* output_dir)
+{
+    int err;
+    struct gpgme_context* context = NULL;
+    gpgme_key_t* keys             = NULL;
+    size_t count                  = 0;
+    struct string_table table     = {0};
+    struct string_table users     = {0};
+    gpgme_data_t data             = NULL;
+    char* buffer                  = NULL;
+    FILE* bundle                  = NULL;
+    FILE* user_file               = NULL;
+
+    if ((err = check_gpgme()) != 0 || (err = check_gcrypt()) != 0)
+        return err;
+
+    if (mkdir(output_dir, 0755) && errno != EEXIST) {
+        log_error("Failed to create \"%s\": %s\n", output_dir,
+                  strerror(errno));
+        return 1;
+    }
+
+    if ((err = open_keyring(&context)))
+        return err;
+
+    if ((err = keylist_collect(context, patterns, 0, &keys, &count)))
+        goto cleanup;
+
+    // Only keep keys having an authentication subkey
+    size_t usable = 0;
+    for (size_t i = 0; i < count; ++i) {
+        if (find_auth_subkey(keys[i]))
+            keys[usable++] = keys[i];
+        else
+            gpgme_key_unref(keys[i]);
+    }
+    keys[usable] = NULL;
+    count        = usable;
+
+    if (!count) {
+        log_error("No key with an authentication subkey found.\n");
+        err = 1;
+        goto cleanup;
+    }
+
+    if ((err = string_table_init(&table, count)) ||
+        (err = string_table_init(&users, count)))
+        goto cleanup;
+    for (size_t i = 0; i < count; ++i)
+        string_table_insert(&table, find_auth_subkey(keys[i])->fpr, i);
+
+    // Export every public key at once, in binary form
+    if ((err = gpgme_data_new(&data))) {
+        log_error("Failed to create new data.\n");
+        goto cleanup;
+    }
+
+    gpgme_set_armor(context, 0);
+    if ((err = gpgme_op_export_keys(context, keys, 0, data))) {
+        log_error("Failed to export keys. %s: %s\n", gpgme_strsource(err),
+                  gpgme_strerror(err));
+        goto cleanup;
+    }
+
+    size_t size;
+    buffer = gpgme_data_release_and_get_mem(data, &size);
+    data   = NULL;
+
+    char bundle_path[1024];
+    snprintf(bundle_path, sizeof(bundle_path), "%s/authorized_keys",
+             output_dir);
+    if (!(bundle = fopen(bundle_path, "w"))) {
+        log_error("Failed to open \"%s\": %s\n", bundle_path,
+                  strerror(errno));
+        err = 1;
+        goto cleanup;
+    }
+
+    size_t exported    = 0;
+    size_t failed      = 0;
+    size_t current_key = count;
+    size_t offset      = 0;
+    struct openpgp_packet packet;
+    while (!(err = openpgp_next_packet((const unsigned char*)buffer, size,
+                                       &offset, &packet))) {
+        if (packet.tag != OPENPGP_TAG_PUBLIC_SUBKEY)
+            continue;
+
+        char fpr[41];
+        size_t key;
+        if (openpgp_fingerprint(&packet, fpr) ||
+            !string_table_find(&table, fpr, &key))
+            continue;
+
+        const char* email = keys[key]->uids ? keys[key]->uids->email : NULL;
+        char comment[256];
+        if (email && *email)
+            snprintf(comment, sizeof(comment), "%s", email);
+        else
+            snprintf(comment, sizeof(comment), "openpgp:0x%s", fpr + 32);
+
+        char* line = ssh_format_key(&packet, comment);
+        if (!line) {
+            log_error("Failed to convert subkey %s to SSH.\n", fpr);
+            continue;
+        }
+
+        // Keys come out grouped, so only one user file is open at a time
+        if (key != current_key) {
+            if (user_file && fclose(user_file))
+                failed++;
+            const char* username = key_username(keys[key]);
+            size_t user;
+            int append  = string_table_find(&users, username, &user);
+            current_key = key;
+            user_file   = open_user_file(output_dir, keys[key], append);
+            if (!append)
+                string_table_insert(&users, username, key);
+            audit_event(PHASE_EXPORT_SSH, !user_file, username,
+                        keys[key]->fpr, NULL);
+        }
+        fputs(line, bundle);
+        if (user_file) {
+            fputs(line, user_file);
+            exported++;
+        } else {
+            failed++;
+        }
+        free(line);
+    }
+
+    // The packet loop ends with -1 on a clean end of stream
+    err = err < 0 ? 0 : err;
+
+    if (user_file && fclose(user_file))
+        failed++;
+    user_file = NULL;
+
+    log_info("Exported %zu SSH public keys out of %zu to \"%s\" "
+             "(%zu failed).\n",
+             exported, count, output_dir, failed);
+
+    if (!err && (failed || exported != count))
+        err = 1;
+
+cleanup:
+    if (user_file)
+        fclose(user_file);
+    if (bundle && fclose(bundle))
+        err = err ? err : 1;
+    gpgme_free(buffer);
+    gpgme_data_release(data);
+    string_table_release(&table);
+    string_table_release(&users);
+    keylist_release(keys);
+    gpgme_release(context);
+
+    return err;
+}
+
+int export_ssh(const char** patterns, const char* output_dir)
+{
+    struct phase_span span;
+
+    phase_begin(&span, PHASE_EXPORT_SSH);
+    return phase_end(&span, export_ssh_keys(patterns, output_dir));
+}
@@ -0,0 +1,53 @@
+/*
+Copyright (C) 2016 Aurelien Vallee
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <yubimgr/logging.h>
+
+#include "file.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+char* read_file(const char* path, size_t* size)
+{
+    char* buffer = NULL;
+    long length;
+
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        log_error("Failed to open \"%s\": %s\n", path, strerror(errno));
+        return NULL;
+    }
+
+    if (!fseek(file, 0, SEEK_END) && (length = ftell(file)) >= 0 &&
+        !fseek(file, 0, SEEK_SET) && (buffer = (char*)malloc(length + 1))) {
+        *size         = fread(buffer, 1, length, file);
+        buffer[*size] = 0;
+    } else {
+        log_error("Failed to read \"%s\".\n", path);
+    }
+
+    fclose(file);
+
+    return buffer;
+}
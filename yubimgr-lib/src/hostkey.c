@@ -0,0 +1,216 @@
+/*
+Copyright (C) 2016 Aurelien Vallee
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <yubimgr/keygen.h>
+#include <yubimgr/logging.h>
+
+#include "hostkey.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static enum KEYGEN_MODE _mode;
+static enum KEYGEN_PROFILE _profile;
+static const char* _backup_dir;
+
+static const char* _profile_names[KEYGEN_PROFILE_COUNT] = {
+    "rsa2048", "rsa3072", "rsa4096", "ed25519",
+};
+
+// libgcrypt key generation parameters, by profile and usage
+static const char* _genkey_params[KEYGEN_PROFILE_COUNT][SUBKEY_COUNT] = {
+    {"(genkey(rsa(nbits 4:2048)))", "(genkey(rsa(nbits 4:2048)))",
+     "(genkey(rsa(nbits 4:2048)))"},
+    {"(genkey(rsa(nbits 4:3072)))", "(genkey(rsa(nbits 4:3072)))",
+     "(genkey(rsa(nbits 4:3072)))"},
+    {"(genkey(rsa(nbits 4:4096)))", "(genkey(rsa(nbits 4:4096)))",
+     "(genkey(rsa(nbits 4:4096)))"},
+    {"(genkey(ecc(curve Ed25519)(flags eddsa)))",
+     "(genkey(ecc(curve Curve25519)(flags djb-tweak comp)))",
+     "(genkey(ecc(curve Ed25519)(flags eddsa)))"},
+};
+
+void set_keygen(enum KEYGEN_MODE mode, enum KEYGEN_PROFILE profile)
+{
+    _mode    = mode;
+    _profile = profile;
+}
+
+const char* keygen_profile_name(enum KEYGEN_PROFILE profile)
+{
+    return profile < KEYGEN_PROFILE_COUNT ? _profile_names[profile]
+                                          : "unknown";
+}
+
+int keygen_parse_profile(const char* name, enum KEYGEN_PROFILE* profile)
+{
+    for (int i = 0; i < KEYGEN_PROFILE_COUNT; ++i) {
+        if (!strcmp(name, _profile_names[i])) {
+            *profile = (enum KEYGEN_PROFILE)i;
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+void set_backup_dir(const char* path)
+{
+    _backup_dir = path;
+}
+
+enum KEYGEN_MODE keygen_mode()
+{
+    return _mode;
+}
+
+enum KEYGEN_PROFILE keygen_profile()
+{
+    return _profile;
+}
+
+const char* backup_dir()
+{
+    return _backup_dir;
+}
+
+int hostkey_is_rsa(enum KEYGEN_PROFILE profile)
+{
+    return profile != KEYGEN_ED25519;
+}
+
+static void* hostkey_run(void* opaque)
+{
+    struct hostkey* key = (struct hostkey*)opaque;
+    gcry_sexp_t params  = NULL;
+    gcry_sexp_t pair    = NULL;
+    unsigned char grip[20];
+
+    key->err = gcry_sexp_new(
+        &params, _genkey_params[key->profile][key->usage], 0, 1);
+    if (!key->err)
+        key->err = gcry_pk_genkey(&pair, params);
+    if (!key->err && !(key->private_key =
+                           gcry_sexp_find_token(pair, "private-key", 0)))
+        key->err = gpg_error(GPG_ERR_INV_SEXP);
+    if (!key->err && !gcry_pk_get_keygrip(key->private_key, grip))
+        key->err = gpg_error(GPG_ERR_INV_SEXP);
+
+    if (!key->err)
+        for (size_t i = 0; i < sizeof(grip); ++i)
+            snprintf(key->keygrip + 2 * i, 3, "%02X", grip[i]);
+
+    gcry_sexp_release(pair);
+    gcry_sexp_release(params);
+
+    return NULL;
+}
+
+int hostkey_generate(enum KEYGEN_PROFILE profile,
+                     struct hostkey keys[SUBKEY_COUNT],
+                     int parallel)
+{
+    pthread_t threads[SUBKEY_COUNT];
+    int started[SUBKEY_COUNT] = {0};
+    int err                   = 0;
+
+    memset(keys, 0, SUBKEY_COUNT * sizeof(struct hostkey));
+
+    // Keys are independent, and RSA prime search is CPU bound: one thread
+    // per key brings the wait down to the slowest key
+    for (int i = 0; i < SUBKEY_COUNT; ++i) {
+        keys[i].profile = profile;
+        keys[i].usage   = (enum SUBKEY_USAGE)i;
+        started[i]      = parallel && !pthread_create(&threads[i], NULL,
+                                                     hostkey_run, &keys[i]);
+        if (!started[i])
+            hostkey_run(&keys[i]);
+    }
+
+    for (int i = 0; i < SUBKEY_COUNT; ++i) {
+        if (started[i])
+            pthread_join(threads[i], NULL);
+        if (keys[i].err) {
+            log_error("Failed to generate %s subkey. %s: %s\n",
+                      keygen_profile_name(profile),
+                      gcry_strsource(keys[i].err),
+                      gcry_strerror(keys[i].err));
+            err = keys[i].err;
+        }
+    }
+
+    if (err)
+        hostkey_release(keys);
+
+    return err;
+}
+
+int hostkey_store(const struct hostkey* key, const char* homedir)
+{
+    char path[1024];
+
+    snprintf(path, sizeof(path), "%s/private-keys-v1.d", homedir);
+    if (mkdir(path, 0700) && errno != EEXIST) {
+        log_error("Failed to create \"%s\": %s\n", path, strerror(errno));
+        return 1;
+    }
+
+    size_t size  = gcry_sexp_sprint(key->private_key, GCRYSEXP_FMT_CANON,
+                                    NULL, 0);
+    char* buffer = (char*)malloc(size);
+    if (!buffer)
+        return 1;
+    size = gcry_sexp_sprint(key->private_key, GCRYSEXP_FMT_CANON, buffer,
+                            size);
+
+    snprintf(path, sizeof(path), "%s/private-keys-v1.d/%s.key", homedir,
+             key->keygrip);
+    log_trace("Writing private key to \"%s\".\n", path);
+
+    int err = 0;
+    int fd  = open(path, O_WRONLY | O_CREAT | O_EXCL, 0600);
+    if (fd < 0 || write(fd, buffer, size) != (ssize_t)size) {
+        log_error("Failed to write \"%s\": %s\n", path, strerror(errno));
+        err = 1;
+    }
+    if (fd >= 0 && close(fd))
+        err = 1;
+
+    // The buffer held the secret key
+    memset(buffer, 0, size);
+    free(buffer);
+
+    return err;
+}
+
+void hostkey_release(struct hostkey keys[SUBKEY_COUNT])
+{
+    for (int i = 0; i < SUBKEY_COUNT; ++i) {
+        gcry_sexp_release(keys[i].private_key);
+        keys[i].private_key = NULL;
+    }
+}
@@ -0,0 +1,70 @@
+/*
+Copyright (C) 2016 Aurelien Vallee
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef YUBIMGR_HOSTKEY_H
+#define YUBIMGR_HOSTKEY_H
+
+#include <yubimgr/keygen.h>
+
+#include <gcrypt.h>
+
+// Subkeys of a masterkey, in the order they are added to it
+enum SUBKEY_USAGE {
+    SUBKEY_SIGN = 0,
+    SUBKEY_ENCRYPT,
+    SUBKEY_AUTH,
+    SUBKEY_COUNT,
+};
+
+// A key pair generated by libgcrypt, in the gpg-agent private key format
+struct hostkey {
+    enum KEYGEN_PROFILE profile;
+    enum SUBKEY_USAGE usage;
+    gcry_sexp_t private_key;
+    char keygrip[41];
+    int err;
+};
+
+enum KEYGEN_MODE keygen_mode();
+
+enum KEYGEN_PROFILE keygen_profile();
+
+// NULL when no backup directory was set
+const char* backup_dir();
+
+// Whether the OpenPGP algorithm of a subkey is RSA
+int hostkey_is_rsa(enum KEYGEN_PROFILE profile);
+
+// Generates every subkey of profile, each in its own worker thread when
+// parallel is set, one after the other otherwise. keys must be released
+// with hostkey_release().
+int hostkey_generate(enum KEYGEN_PROFILE profile,
+                     struct hostkey keys[SUBKEY_COUNT],
+                     int parallel);
+
+// Hands a key over to the gpg-agent of homedir, by writing it (unprotected)
+// to its private-keys-v1.d directory. The caller protects it once added to
+// a key.
+int hostkey_store(const struct hostkey* key, const char* homedir);
+
+void hostkey_release(struct hostkey keys[SUBKEY_COUNT]);
+
+#endif  // YUBIMGR_HOSTKEY_H
@@ -0,0 +1,275 @@
+/*
+Copyright (C) 2016 Aurelien Vallee
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <yubimgr/identity.h>
+#include <yubimgr/logging.h>
+
+#include "file.h"
+#include "identity_index.h"
+#include "index.h"
+#include "string_table.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ROSTER_FIELD_COUNT 4
+
+static const char* _index_path;
+
+void set_identity_index(const char* path)
+{
+    _index_path = path;
+}
+
+int identity_indexed()
+{
+    return _index_path != NULL;
+}
+
+int identity_key(const char* field, const char* value, char* key, size_t size)
+{
+    int upper = !strcmp(field, "fpr");
+
+    int length = snprintf(key, size, "%s:", field);
+    if (length < 0 || (size_t)length >= size || !*value)
+        return 1;
+
+    for (; *value; ++value) {
+        if ((size_t)length + 1 >= size)
+            return 1;
+        key[length++] = upper ? toupper((unsigned char)*value)
+                              : tolower((unsigned char)*value);
+    }
+    key[length] = 0;
+
+    return 0;
+}
+
+static int open_index(struct index** index)
+{
+    return index_open(index, _index_path, 0);
+}
+
+static const char* find_in(const struct index* index,
+                           const char* username,
+                           const char* email)
+{
+    char key[INDEX_KEY_SIZE];
+    const char* fpr = NULL;
+
+    if (!index)
+        return NULL;
+    if (username && !identity_key("user", username, key, sizeof(key)))
+        fpr = index_get(index, key);
+    if (!fpr && email && !identity_key("email", email, key, sizeof(key)))
+        fpr = index_get(index, key);
+
+    return fpr;
+}
+
+int identity_find(const char* username,
+                  const char* email,
+                  char* fpr,
+                  size_t size)
+{
+    struct index* index;
+
+    if (!_index_path)
+        return 0;
+    // A duplicate could go unnoticed
+    if (open_index(&index))
+        return -1;
+
+    const char* found = find_in(index, username, email);
+    if (found)
+        snprintf(fpr, size, "%s", found);
+    index_close(index);
+
+    return found != NULL;
+}
+
+int identity_record(const char* username, const char* email, const char* fpr)
+{
+    int err = 0;
+    char key[INDEX_KEY_SIZE];
+    struct index* index;
+
+    if (index_open(&index, _index_path, 1))
+        return 1;
+
+    if (!identity_key("user", username, key, sizeof(key)))
+        err |= index_put(index, key, fpr);
+    if (!identity_key("email", email, key, sizeof(key)))
+        err |= index_put(index, key, fpr);
+    if (!identity_key("fpr", fpr, key, sizeof(key)))
+        err |= index_put(index, key, username);
+
+    index_close(index);
+
+    if (err)
+        log_error("Failed to index %s in \"%s\".\n", username, _index_path);
+
+    return err;
+}
+
+// Reads a whole roster, and counts its lines
+static char* read_roster(const char* path, size_t* lines)
+{
+    size_t size;
+    char* buffer = read_file(path, &size);
+
+    *lines = 1;
+    for (const char* c = buffer; c && *c; ++c)
+        *lines += *c == '\n';
+
+    return buffer;
+}
+
+static char* trim(char* s)
+{
+    while (isspace((unsigned char)*s))
+        s++;
+    size_t length = strlen(s);
+    while (length && isspace((unsigned char)s[length - 1]))
+        s[--length] = 0;
+    return s;
+}
+
+// Splits a row in place. Returns the number of fields.
+static size_t split_row(char* row, char** fields)
+{
+    size_t count = 0;
+
+    for (char* field = row; field && count <= ROSTER_FIELD_COUNT; ++count) {
+        char* separator = strchr(field, ',');
+        if (separator)
+            *separator = 0;
+        if (count < ROSTER_FIELD_COUNT)
+            fields[count] = trim(field);
+        field = separator ? separator + 1 : NULL;
+    }
+
+    return count;
+}
+
+int roster_load(const char* path, FILE* rejected, struct roster* roster)
+{
+    int err                  = 0;
+    size_t lines             = 0;
+    struct index* index      = NULL;
+    struct string_table seen = {0};
+    size_t seen_count        = 0;
+    size_t rejected_count    = 0;
+    char(*seen_keys)[INDEX_KEY_SIZE] = NULL;
+
+    memset(roster, 0, sizeof(*roster));
+
+    if (!(roster->buffer = read_roster(path, &lines)))
+        return 1;
+
+    // A username and an email per row are remembered, to catch rows
+    // repeating an earlier one
+    roster->identities =
+        (struct identity*)calloc(lines, sizeof(struct identity));
+    seen_keys = (char(*)[INDEX_KEY_SIZE])calloc(2 * lines, INDEX_KEY_SIZE);
+    if (!roster->identities || !seen_keys ||
+        string_table_init(&seen, 2 * lines) ||
+        (_index_path && open_index(&index))) {
+        err = 1;
+        goto cleanup;
+    }
+
+    char* next = roster->buffer;
+    for (size_t row = 1; next && *next; ++row) {
+        char* line = next;
+        next       = strchr(line, '\n');
+        if (next)
+            *next++ = 0;
+        line[strcspn(line, "\r")] = 0;
+
+        char* trimmed = trim(line);
+        if (!*trimmed || *trimmed == '#' ||
+            (row == 1 && !strncmp(trimmed, "username", 8)))
+            continue;
+
+        // Kept for the rejected output, the row is split in place
+        char original[1024];
+        snprintf(original, sizeof(original), "%s", trimmed);
+
+        char reason[128] = "";
+        char* fields[ROSTER_FIELD_COUNT];
+        char keys[2][INDEX_KEY_SIZE];
+        const char* fpr;
+        size_t first;
+
+        if (split_row(trimmed, fields) != ROSTER_FIELD_COUNT ||
+            !*fields[0] || !strchr(fields[3], '@') ||
+            identity_key("user", fields[0], keys[0], INDEX_KEY_SIZE) ||
+            identity_key("email", fields[3], keys[1], INDEX_KEY_SIZE))
+            snprintf(reason, sizeof(reason), "malformed");
+        else if ((fpr = find_in(index, fields[0], fields[3])))
+            snprintf(reason, sizeof(reason), "has masterkey %s", fpr);
+        else if (string_table_find(&seen, keys[0], &first) ||
+                 string_table_find(&seen, keys[1], &first))
+            snprintf(reason, sizeof(reason), "duplicate of row %zu", first);
+
+        if (*reason) {
+            log_warning("Roster row %zu rejected: %s.\n", row, reason);
+            if (rejected)
+                fprintf(rejected, "%s,%s\n", original, reason);
+            rejected_count++;
+            continue;
+        }
+
+        for (int i = 0; i < 2; ++i) {
+            memcpy(seen_keys[seen_count], keys[i], INDEX_KEY_SIZE);
+            string_table_insert(&seen, seen_keys[seen_count++], row);
+        }
+
+        struct identity* identity = &roster->identities[roster->count++];
+        identity->username        = fields[0];
+        identity->firstname       = fields[1];
+        identity->lastname        = fields[2];
+        identity->email           = fields[3];
+    }
+
+    log_info("Loaded %zu identities from \"%s\" (%zu rejected).\n",
+             roster->count, path, rejected_count);
+
+cleanup:
+    index_close(index);
+    string_table_release(&seen);
+    free(seen_keys);
+    if (err)
+        roster_release(roster);
+
+    return err;
+}
+
+void roster_release(struct roster* roster)
+{
+    free(roster->identities);
+    free(roster->buffer);
+    memset(roster, 0, sizeof(*roster));
+}
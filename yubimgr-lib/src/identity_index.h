@@ -0,0 +1,37 @@
+/*
+Copyright (C) 2016 Aurelien Vallee
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef YUBIMGR_IDENTITY_INDEX_H
+#define YUBIMGR_IDENTITY_INDEX_H
+
+#include <yubimgr/identity.h>
+
+// Whether an identity index was set
+int identity_indexed();
+
+// Indexes a completed bootstrap
+int identity_record(const char* username, const char* email, const char* fpr);
+
+// Normalizes an identity field into its index key: "user:<lowercase>",
+// "email:<lowercase>" or "fpr:<FPR>". field is "user", "email" or "fpr".
+int identity_key(const char* field, const char* value, char* key, size_t size);
+
+#endif  // YUBIMGR_IDENTITY_INDEX_H
@@ -0,0 +1,347 @@
+/*
+Copyright (C) 2016 Aurelien Vallee
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <yubimgr/logging.h>
+
+#include "index.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define INDEX_MAGIC "YMINDEX2"
+#define INDEX_INITIAL_CAPACITY 64
+
+struct index_header {
+    char magic[8];
+    uint32_t capacity;
+    uint32_t count;
+    // Slots holding an entry or a tombstone
+    uint32_t used;
+};
+
+// An empty slot has a zero hash. A slot is never written again once its
+// hash is published: an update fills a fresh slot and turns the previous
+// one into a tombstone, so that readers holding the old value keep reading
+// a complete one.
+#define INDEX_TOMBSTONE UINT64_MAX
+
+struct index_slot {
+    uint64_t hash;
+    char key[INDEX_KEY_SIZE];
+    char value[INDEX_VALUE_SIZE];
+};
+
+struct index {
+    char path[1024];
+    int fd;
+    int lock_fd;
+    int writable;
+    size_t size;
+    struct index_header* header;
+    struct index_slot* slots;
+};
+
+uint64_t index_hash(const char* key)
+{
+    uint64_t h = 14695981039346656037ull;
+    while (*key)
+        h = (h ^ (unsigned char)*key++) * 1099511628211ull;
+
+    // Zero marks empty slots
+    return h && h != INDEX_TOMBSTONE ? h : 1;
+}
+
+static size_t index_file_size(uint32_t capacity)
+{
+    return sizeof(struct index_header) + capacity * sizeof(struct index_slot);
+}
+
+static int index_map(struct index* index)
+{
+    struct stat st;
+
+    if (fstat(index->fd, &st)) {
+        log_error("Failed to stat \"%s\": %s\n", index->path, strerror(errno));
+        return 1;
+    }
+
+    int prot   = PROT_READ | (index->writable ? PROT_WRITE : 0);
+    void* data = mmap(NULL, st.st_size, prot, MAP_SHARED, index->fd, 0);
+    if (data == MAP_FAILED) {
+        log_error("Failed to map \"%s\": %s\n", index->path, strerror(errno));
+        return 1;
+    }
+
+    index->size   = st.st_size;
+    index->header = (struct index_header*)data;
+    index->slots  = (struct index_slot*)(index->header + 1);
+
+    if ((size_t)st.st_size < sizeof(struct index_header) ||
+        memcmp(index->header->magic, INDEX_MAGIC, 8) ||
+        index_file_size(index->header->capacity) != (size_t)st.st_size) {
+        log_error("Corrupted index \"%s\".\n", index->path);
+        return 1;
+    }
+
+    return 0;
+}
+
+static void index_unmap(struct index* index)
+{
+    if (index->header)
+        munmap(index->header, index->size);
+    index->header = NULL;
+    index->slots  = NULL;
+}
+
+// Creates an empty table file of the given capacity (a power of two)
+static int index_create(const char* path, uint32_t capacity)
+{
+    struct index_header header = {{0}, capacity, 0, 0};
+
+    memcpy(header.magic, INDEX_MAGIC, sizeof(header.magic));
+
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        log_error("Failed to create \"%s\": %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    if (ftruncate(fd, index_file_size(capacity)) ||
+        write(fd, &header, sizeof(header)) != sizeof(header)) {
+        log_error("Failed to initialize \"%s\": %s\n", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+int index_open(struct index** index, const char* path, int writable)
+{
+    char lock_path[1040];
+
+    *index = (struct index*)calloc(1, sizeof(struct index));
+    if (!*index)
+        return 1;
+
+    (*index)->fd       = -1;
+    (*index)->lock_fd  = -1;
+    (*index)->writable = writable;
+    snprintf((*index)->path, sizeof((*index)->path), "%s", path);
+
+    if (writable) {
+        // Growing replaces the table file, so writers lock a separate file
+        snprintf(lock_path, sizeof(lock_path), "%s.lock", path);
+        (*index)->lock_fd = open(lock_path, O_RDWR | O_CREAT, 0644);
+        if ((*index)->lock_fd < 0 || flock((*index)->lock_fd, LOCK_EX)) {
+            log_error("Failed to lock \"%s\": %s\n", lock_path,
+                      strerror(errno));
+            goto error;
+        }
+
+        if (access(path, F_OK))
+            (*index)->fd = index_create(path, INDEX_INITIAL_CAPACITY);
+        else
+            (*index)->fd = open(path, O_RDWR);
+    } else {
+        (*index)->fd = open(path, O_RDONLY);
+        // A table that was never written to has no entry yet
+        if ((*index)->fd < 0 && errno == ENOENT)
+            return 0;
+    }
+
+    if ((*index)->fd < 0) {
+        log_error("Failed to open \"%s\": %s\n", path, strerror(errno));
+        goto error;
+    }
+
+    if (index_map(*index))
+        goto error;
+
+    return 0;
+
+error:
+    index_close(*index);
+    *index = NULL;
+    return 1;
+}
+
+void index_close(struct index* index)
+{
+    if (!index)
+        return;
+
+    index_unmap(index);
+    if (index->fd >= 0)
+        close(index->fd);
+    if (index->lock_fd >= 0)
+        close(index->lock_fd);
+    free(index);
+}
+
+static struct index_slot* index_probe(struct index_slot* slots,
+                                      uint32_t capacity,
+                                      const char* key,
+                                      uint64_t hash)
+{
+    uint32_t mask = capacity - 1;
+    uint32_t i    = hash & mask;
+
+    // The load factor (tombstones included) is kept under 1/2, there
+    // always is an empty slot
+    while (slots[i].hash &&
+           (slots[i].hash != hash || strcmp(slots[i].key, key)))
+        i = (i + 1) & mask;
+
+    return &slots[i];
+}
+
+static int index_grow(struct index* index)
+{
+    char tmp_path[1040];
+    uint32_t capacity = index->header->capacity * 2;
+
+    log_debug("Growing index \"%s\" to %u slots.\n", index->path, capacity);
+
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", index->path);
+    int fd = index_create(tmp_path, capacity);
+    if (fd < 0)
+        return 1;
+
+    size_t size = index_file_size(capacity);
+    void* data  = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+        log_error("Failed to map \"%s\": %s\n", tmp_path, strerror(errno));
+        close(fd);
+        unlink(tmp_path);
+        return 1;
+    }
+
+    struct index_header* header = (struct index_header*)data;
+    struct index_slot* slots    = (struct index_slot*)(header + 1);
+    for (uint32_t i = 0; i < index->header->capacity; ++i) {
+        const struct index_slot* slot = &index->slots[i];
+        if (slot->hash && slot->hash != INDEX_TOMBSTONE)
+            *index_probe(slots, capacity, slot->key, slot->hash) = *slot;
+    }
+    header->count = index->header->count;
+    header->used  = index->header->count;
+
+    // Readers still see the previous table until the rename
+    if (msync(data, size, MS_SYNC) || rename(tmp_path, index->path)) {
+        log_error("Failed to replace \"%s\": %s\n", index->path,
+                  strerror(errno));
+        munmap(data, size);
+        close(fd);
+        unlink(tmp_path);
+        return 1;
+    }
+
+    index_unmap(index);
+    close(index->fd);
+    index->fd     = fd;
+    index->size   = size;
+    index->header = header;
+    index->slots  = slots;
+
+    return 0;
+}
+
+int index_put(struct index* index, const char* key, const char* value)
+{
+    if (!index->writable)
+        return 1;
+
+    size_t key_size   = strlen(key) + 1;
+    size_t value_size = strlen(value) + 1;
+    if (key_size > INDEX_KEY_SIZE || value_size > INDEX_VALUE_SIZE) {
+        log_error("Index entry \"%s\" is too long.\n", key);
+        return 1;
+    }
+
+    if (2 * (index->header->used + 1) > index->header->capacity &&
+        index_grow(index))
+        return 1;
+
+    uint32_t mask           = index->header->capacity - 1;
+    uint64_t hash           = index_hash(key);
+    struct index_slot* slot = index_probe(index->slots,
+                                          index->header->capacity, key, hash);
+    struct index_slot* previous = NULL;
+
+    if (slot->hash) {
+        if (!strcmp(slot->value, value))
+            return 0;
+        // The fresh slot comes later in the probe sequence, readers find
+        // the previous value until it is turned into a tombstone
+        previous = slot;
+        size_t i = (size_t)(slot - index->slots);
+        while (index->slots[i].hash)
+            i = (i + 1) & mask;
+        slot = &index->slots[i];
+    }
+
+    memcpy(slot->key, key, key_size);
+    memcpy(slot->value, value, value_size);
+    // Readers match on the hash, publish it once the slot is filled
+    __atomic_store_n(&slot->hash, hash, __ATOMIC_RELEASE);
+    index->header->used++;
+
+    if (previous)
+        __atomic_store_n(&previous->hash, INDEX_TOMBSTONE, __ATOMIC_RELEASE);
+    else
+        index->header->count++;
+
+    return 0;
+}
+
+const char* index_get(const struct index* index, const char* key)
+{
+    if (!index->header)
+        return NULL;
+
+    uint64_t hash = index_hash(key);
+    uint32_t mask = index->header->capacity - 1;
+    uint32_t i    = hash & mask;
+    uint64_t slot_hash;
+
+    while ((slot_hash = __atomic_load_n(&index->slots[i].hash,
+                                        __ATOMIC_ACQUIRE))) {
+        if (slot_hash == hash && !strcmp(index->slots[i].key, key))
+            return index->slots[i].value;
+        i = (i + 1) & mask;
+    }
+
+    return NULL;
+}
+
+size_t index_count(const struct index* index)
+{
+    return index->header ? index->header->count : 0;
+}
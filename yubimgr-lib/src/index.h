@@ -0,0 +1,55 @@
+/*
+Copyright (C) 2016 Aurelien Vallee
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef YUBIMGR_INDEX_H
+#define YUBIMGR_INDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// On-disk open addressing hash table from string keys to short string
+// values, memory mapped so that a lookup costs a few page reads regardless
+// of the number of entries. A single writer at a time is allowed (through
+// a lock file), readers never block and keep a consistent view across
+// updates (written to a fresh slot) and table growth (the file is rebuilt
+// and atomically renamed).
+#define INDEX_KEY_SIZE 128
+#define INDEX_VALUE_SIZE 64
+
+struct index;
+
+// A missing table opened read only is empty.
+int index_open(struct index** index, const char* path, int writable);
+
+void index_close(struct index* index);
+
+// Inserts or updates key. Returns 0 on success.
+int index_put(struct index* index, const char* key, const char* value);
+
+// Returns the value of key, or NULL.
+const char* index_get(const struct index* index, const char* key);
+
+size_t index_count(const struct index* index);
+
+// 64 bits FNV-1a
+uint64_t index_hash(const char* key);
+
+#endif  // YUBIMGR_INDEX_H
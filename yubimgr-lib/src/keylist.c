@@ -0,0 +1,137 @@
+/*
+Copyright (C) 2016 Aurelien Vallee
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "keylist.h"
+
+#include <yubimgr/logging.h>
+
+#include <stdlib.h>
+
+int open_keyring(struct gpgme_context** context)
+{
+    gpgme_error_t err;
+
+    if ((err = gpgme_new(context)) != GPG_ERR_NO_ERROR) {
+        log_error("Failed to create GPGME context.\n");
+        return 1;
+    }
+
+    if ((err = gpgme_set_protocol(*context, GPGME_PROTOCOL_OpenPGP)) !=
+        GPG_ERR_NO_ERROR) {
+        log_error("Failed to use OpenPGP protocol.\n");
+        gpgme_release(*context);
+        *context = NULL;
+        return 1;
+    }
+
+    return 0;
+}
+
+int keylist_collect(struct gpgme_context* context,
+                    const char** patterns,
+                    int secret_only,
+                    gpgme_key_t** keys,
+                    size_t* count)
+{
+    gpgme_error_t err;
+    size_t capacity = 64;
+    gpgme_key_t key;
+
+    *count = 0;
+    *keys  = (gpgme_key_t*)malloc((capacity + 1) * sizeof(gpgme_key_t));
+    if (!*keys)
+        return 1;
+
+    if (patterns && !patterns[0])
+        patterns = NULL;
+
+    if ((err = gpgme_op_keylist_ext_start(context, patterns, secret_only, 0))) {
+        log_error("Failed to list keys. %s: %s\n", gpgme_strsource(err),
+                  gpgme_strerror(err));
+        free(*keys);
+        return err;
+    }
+
+    while (!(err = gpgme_op_keylist_next(context, &key))) {
+        if (*count == capacity) {
+            capacity *= 2;
+            gpgme_key_t* grown = (gpgme_key_t*)realloc(
+                *keys, (capacity + 1) * sizeof(gpgme_key_t));
+            if (!grown) {
+                gpgme_key_unref(key);
+                err = 1;
+                break;
+            }
+            *keys = grown;
+        }
+        (*keys)[(*count)++] = key;
+    }
+    (*keys)[*count] = NULL;
+
+    if (gpgme_err_code(err) != GPG_ERR_EOF) {
+        log_error("Failed to list keys.\n");
+        gpgme_op_keylist_end(context);
+        keylist_release(*keys);
+        return err ? err : 1;
+    }
+
+    if ((err = gpgme_op_keylist_end(context))) {
+        log_error("Failed to list keys.\n");
+        keylist_release(*keys);
+        return err;
+    }
+
+    log_debug("Listed %zu keys.\n", *count);
+
+    return 0;
+}
+
+void keylist_release(gpgme_key_t* keys)
+{
+    if (!keys)
+        return;
+
+    for (gpgme_key_t* key = keys; *key; ++key)
+        gpgme_key_unref(*key);
+    free(keys);
+}
+
+const char* key_username(gpgme_key_t key)
+{
+    if (key->uids && key->uids->comment && *key->uids->comment)
+        return key->uids->comment;
+    if (key->uids && key->uids->email && *key->uids->email)
+        return key->uids->email;
+    return key->subkeys->fpr;
+}
+
+gpgme_subkey_t find_auth_subkey(gpgme_key_t key)
+{
+    if (key->revoked || key->expired || key->disabled || key->invalid)
+        return NULL;
+
+    for (gpgme_subkey_t subkey = key->subkeys; subkey; subkey = subkey->next)
+        if (subkey->can_authenticate && !subkey->revoked &&
+            !subkey->expired && !subkey->disabled && !subkey->invalid)
+            return subkey;
+
+    return NULL;
+}
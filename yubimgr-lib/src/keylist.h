@@ -0,0 +1,51 @@
+/*
+Copyright (C) 2016 Aurelien Vallee
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef YUBIMGR_KEYLIST_H
+#define YUBIMGR_KEYLIST_H
+
+#include <gpgme.h>
+
+#include <stddef.h>
+
+// Creates an OpenPGP context on the current keyring ($GNUPGHOME).
+int open_keyring(struct gpgme_context** context);
+
+// Lists every key matching one of the NULL terminated patterns in a single
+// keylist pass. A NULL or empty pattern array matches the whole keyring.
+// The returned array is NULL terminated and must be released with
+// keylist_release().
+int keylist_collect(struct gpgme_context* context,
+                    const char** patterns,
+                    int secret_only,
+                    gpgme_key_t** keys,
+                    size_t* count);
+
+void keylist_release(gpgme_key_t* keys);
+
+// Returns the name used for per-user output files: the uid comment (where
+// bootstrap() stores the username), the email, or the fingerprint.
+const char* key_username(gpgme_key_t key);
+
+// Returns the first usable authentication subkey, or NULL.
+gpgme_subkey_t find_auth_subkey(gpgme_key_t key);
+
+#endif  // YUBIMGR_KEYLIST_H
@@ -0,0 +1,257 @@
+/*
+Copyright (C) 2016 Aurelien Vallee
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <yubimgr/metrics.h>
+#include <yubimgr/logging.h>
+
+#include "audit_log.h"
+#include "deadline.h"
+#include "phase.h"
+#include "probes.h"
+#include "simulation.h"
+#include "trace_events.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+static const char* _phase_names[PHASE_COUNT] = {
+    "setup",      "masterkey",  "subkey", "export_masterkey",
+    "reset",      "status",     "piv",    "export_ssh",
+    "export_csr", "revocation", "revoke", "export_keys",
+    "keytocard",  "personalize", "renew",
+};
+
+static const struct {
+    const char* family;
+    const char* labels;
+} _counters[COUNTER_COUNT] = {
+    {"yubimgr_cards_processed_total", "action=\"bootstrap\""},
+    {"yubimgr_cards_processed_total", "action=\"reset\""},
+    {"yubimgr_cards_processed_total", "action=\"piv\""},
+    {"yubimgr_resets_total", "outcome=\"success\""},
+    {"yubimgr_resets_total", "outcome=\"failure\""},
+    {"yubimgr_agent_restarts_total", NULL},
+    {"yubimgr_timeouts_total", NULL},
+    {"yubimgr_card_retries_total", NULL},
+};
+
+// Upper bounds (in seconds) of the phase duration histogram buckets
+static const double _buckets[] = {0.1, 0.25, 0.5, 1,  2.5, 5,
+                                  10,  30,   60,  120, 300};
+#define BUCKET_COUNT (sizeof(_buckets) / sizeof(_buckets[0]))
+
+struct histogram {
+    uint64_t buckets[BUCKET_COUNT];
+    uint64_t count;
+    uint64_t sum_us;
+};
+
+// Updated with atomic builtins, metrics may be bumped from worker threads
+static uint64_t _counter_values[COUNTER_COUNT];
+static uint64_t _phase_failures[PHASE_COUNT];
+static struct histogram _phase_durations[PHASE_COUNT];
+static uint64_t _queue_depth;
+
+// Renewal workers each flush the metrics, through the same temporary file
+static pthread_mutex_t _write_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+const char* phase_name(enum PHASE phase)
+{
+    return phase < PHASE_COUNT ? _phase_names[phase] : "unknown";
+}
+
+int phase_parse(const char* name, enum PHASE* phase)
+{
+    for (int i = 0; i < PHASE_COUNT; ++i) {
+        if (!strcmp(name, _phase_names[i])) {
+            *phase = (enum PHASE)i;
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+void set_queue_depth(size_t depth)
+{
+    __atomic_store_n(&_queue_depth, depth, __ATOMIC_RELAXED);
+}
+
+double monotonic_now()
+{
+    struct timespec ts;
+
+    if (simulating())
+        return simulation_clock();
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void metrics_increment(enum COUNTER counter)
+{
+    // Simulated cards are only accounted for in the simulation report
+    if (simulating())
+        return;
+
+    __atomic_fetch_add(&_counter_values[counter], 1, __ATOMIC_RELAXED);
+}
+
+static void observe(struct histogram* histogram, double seconds)
+{
+    for (size_t i = 0; i < BUCKET_COUNT; ++i)
+        if (seconds <= _buckets[i])
+            __atomic_fetch_add(&histogram->buckets[i], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&histogram->count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&histogram->sum_us, (uint64_t)(seconds * 1e6),
+                       __ATOMIC_RELAXED);
+}
+
+void phase_begin(struct phase_span* span, enum PHASE phase)
+{
+    span->phase          = phase;
+    span->start          = monotonic_now();
+    span->outer_deadline = deadline_enter(phase_timeout(phase));
+
+    YUBIMGR_PROBE2(phase__begin, phase_name(phase), trace_current_card());
+}
+
+int phase_end(struct phase_span* span, int err)
+{
+    double duration = monotonic_now() - span->start;
+
+    // Virtual durations must not end up in the metrics nor the audit log
+    int simulated = simulating();
+    if (!simulated) {
+        observe(&_phase_durations[span->phase], duration);
+        if (err)
+            __atomic_fetch_add(&_phase_failures[span->phase], 1,
+                               __ATOMIC_RELAXED);
+    }
+
+    log_trace("Phase %s took %.3fs.\n", phase_name(span->phase), duration);
+
+    if (err && deadline_expired()) {
+        metrics_increment(COUNTER_TIMEOUTS);
+        log_error("Phase %s timed out after %.1fs.\n", phase_name(span->phase),
+                  duration);
+    }
+
+    if (!simulated)
+        audit_phase(span->phase, err, duration);
+    trace_span(span->phase, span->start, duration, err);
+    YUBIMGR_PROBE4(phase__end, phase_name(span->phase), trace_current_card(),
+                   err, (long)(duration * 1e6));
+    deadline_leave(span->outer_deadline);
+
+    return err;
+}
+
+static uint64_t load(const uint64_t* value)
+{
+    return __atomic_load_n(value, __ATOMIC_RELAXED);
+}
+
+static void write_counters(FILE* file)
+{
+    const char* family = NULL;
+
+    for (int i = 0; i < COUNTER_COUNT; ++i) {
+        if (!family || strcmp(family, _counters[i].family)) {
+            family = _counters[i].family;
+            fprintf(file, "# TYPE %s counter\n", family);
+        }
+        if (_counters[i].labels)
+            fprintf(file, "%s{%s} %llu\n", family, _counters[i].labels,
+                    (unsigned long long)load(&_counter_values[i]));
+        else
+            fprintf(file, "%s %llu\n", family,
+                    (unsigned long long)load(&_counter_values[i]));
+    }
+}
+
+static void write_phases(FILE* file)
+{
+    fputs("# TYPE yubimgr_phase_failures_total counter\n", file);
+    for (int i = 0; i < PHASE_COUNT; ++i)
+        fprintf(file, "yubimgr_phase_failures_total{phase=\"%s\"} %llu\n",
+                _phase_names[i], (unsigned long long)load(&_phase_failures[i]));
+
+    fputs("# TYPE yubimgr_phase_duration_seconds histogram\n", file);
+    for (int i = 0; i < PHASE_COUNT; ++i) {
+        const struct histogram* histogram = &_phase_durations[i];
+        for (size_t j = 0; j < BUCKET_COUNT; ++j)
+            fprintf(file,
+                    "yubimgr_phase_duration_seconds_bucket"
+                    "{phase=\"%s\",le=\"%g\"} %llu\n",
+                    _phase_names[i], _buckets[j],
+                    (unsigned long long)load(&histogram->buckets[j]));
+        fprintf(file,
+                "yubimgr_phase_duration_seconds_bucket"
+                "{phase=\"%s\",le=\"+Inf\"} %llu\n",
+                _phase_names[i], (unsigned long long)load(&histogram->count));
+        fprintf(file,
+                "yubimgr_phase_duration_seconds_sum{phase=\"%s\"} %.6f\n",
+                _phase_names[i], load(&histogram->sum_us) / 1e6);
+        fprintf(file,
+                "yubimgr_phase_duration_seconds_count{phase=\"%s\"} %llu\n",
+                _phase_names[i], (unsigned long long)load(&histogram->count));
+    }
+}
+
+int write_metrics(const char* path)
+{
+    char tmp_path[1024];
+    int err = 0;
+
+    // Write aside and rename, so that collectors never see a partial file
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    pthread_mutex_lock(&_write_mutex);
+    FILE* file = fopen(tmp_path, "w");
+    if (!file) {
+        log_error("Failed to open \"%s\": %s\n", tmp_path, strerror(errno));
+        pthread_mutex_unlock(&_write_mutex);
+        return 1;
+    }
+
+    write_counters(file);
+    write_phases(file);
+    fputs("# TYPE yubimgr_queue_depth gauge\n", file);
+    fprintf(file, "yubimgr_queue_depth %llu\n",
+            (unsigned long long)load(&_queue_depth));
+
+    if (fclose(file) || rename(tmp_path, path)) {
+        log_error("Failed to write metrics to \"%s\": %s\n", path,
+                  strerror(errno));
+        remove(tmp_path);
+        err = 1;
+    }
+    pthread_mutex_unlock(&_write_mutex);
+
+    if (!err)
+        log_debug("Wrote metrics to \"%s\".\n", path);
+
+    return err;
+}
@@ -0,0 +1,157 @@
+/*
+Copyright (C) 2016 Aurelien Vallee
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "openpgp.h"
+
+#include <yubimgr/logging.h>
+
+#include <gcrypt.h>
+
+#include <stdio.h>
+#include <string.h>
+
+int openpgp_next_packet(const unsigned char* data,
+                        size_t size,
+                        size_t* offset,
+                        struct openpgp_packet* packet)
+{
+    size_t off = *offset;
+    size_t len;
+
+    if (off >= size)
+        return -1;
+
+    unsigned char ctb = data[off++];
+    if (!(ctb & 0x80)) {
+        log_error("Invalid OpenPGP packet header at offset %zu.\n", off - 1);
+        return 1;
+    }
+
+    if (ctb & 0x40) {
+        // New format packet
+        packet->tag = ctb & 0x3f;
+        if (off >= size)
+            return 1;
+        unsigned char c = data[off++];
+        if (c < 192) {
+            len = c;
+        } else if (c < 224) {
+            if (off >= size)
+                return 1;
+            len = ((c - 192) << 8) + data[off++] + 192;
+        } else if (c == 255) {
+            if (off + 4 > size)
+                return 1;
+            len = ((size_t)data[off] << 24) | (data[off + 1] << 16) |
+                  (data[off + 2] << 8) | data[off + 3];
+            off += 4;
+        } else {
+            // Partial body lengths are never used for key material
+            log_error("Unsupported partial OpenPGP packet length.\n");
+            return 1;
+        }
+    } else {
+        // Old format packet
+        packet->tag = (ctb >> 2) & 0x0f;
+        switch (ctb & 0x03) {
+            case 0:
+                if (off + 1 > size)
+                    return 1;
+                len = data[off];
+                off += 1;
+                break;
+            case 1:
+                if (off + 2 > size)
+                    return 1;
+                len = (data[off] << 8) | data[off + 1];
+                off += 2;
+                break;
+            case 2:
+                if (off + 4 > size)
+                    return 1;
+                len = ((size_t)data[off] << 24) | (data[off + 1] << 16) |
+                      (data[off + 2] << 8) | data[off + 3];
+                off += 4;
+                break;
+            default:
+                len = size - off;
+                break;
+        }
+    }
+
+    if (len > size - off) {
+        log_error("Truncated OpenPGP packet at offset %zu.\n", *offset);
+        return 1;
+    }
+
+    packet->body = data + off;
+    packet->size = len;
+    *offset      = off + len;
+
+    return 0;
+}
+
+int openpgp_fingerprint(const struct openpgp_packet* packet, char* fpr)
+{
+    unsigned char digest[20];
+
+    if (packet->size < 6 || packet->size > 0xffff || packet->body[0] != 4)
+        return 1;
+
+    gcry_md_hd_t md;
+    if (gcry_md_open(&md, GCRY_MD_SHA1, 0))
+        return 1;
+
+    unsigned char header[3] = {0x99, packet->size >> 8, packet->size & 0xff};
+    gcry_md_write(md, header, sizeof(header));
+    gcry_md_write(md, packet->body, packet->size);
+    memcpy(digest, gcry_md_read(md, GCRY_MD_SHA1), sizeof(digest));
+    gcry_md_close(md);
+
+    for (size_t i = 0; i < sizeof(digest); ++i)
+        sprintf(fpr + 2 * i, "%02X", digest[i]);
+
+    return 0;
+}
+
+int openpgp_read_mpi(const struct openpgp_packet* packet,
+                     size_t* offset,
+                     const unsigned char** mpi,
+                     size_t* mpi_size)
+{
+    size_t off = *offset;
+
+    if (off + 2 > packet->size)
+        return 1;
+
+    size_t bits = (packet->body[off] << 8) | packet->body[off + 1];
+    size_t len  = (bits + 7) / 8;
+    off += 2;
+
+    if (len > packet->size - off)
+        return 1;
+
+    *mpi      = packet->body + off;
+    *mpi_size = len;
+    *offset   = off + len;
+
+    return 0;
+}
@@ -0,0 +1,69 @@
+/*
+Copyright (C) 2016 Aurelien Vallee
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef YUBIMGR_OPENPGP_H
+#define YUBIMGR_OPENPGP_H
+
+#include <stddef.h>
+
+enum OPENPGP_TAG {
+    OPENPGP_TAG_SIGNATURE     = 2,
+    OPENPGP_TAG_SECRET_KEY    = 5,
+    OPENPGP_TAG_PUBLIC_KEY    = 6,
+    OPENPGP_TAG_SECRET_SUBKEY = 7,
+    OPENPGP_TAG_USER_ID       = 13,
+    OPENPGP_TAG_PUBLIC_SUBKEY = 14,
+};
+
+enum OPENPGP_ALGO {
+    OPENPGP_ALGO_RSA       = 1,
+    OPENPGP_ALGO_RSA_SIGN  = 3,
+    OPENPGP_ALGO_ECDH      = 18,
+    OPENPGP_ALGO_ECDSA     = 19,
+    OPENPGP_ALGO_EDDSA     = 22,
+};
+
+// A packet as found in a binary (non armored) OpenPGP stream. The body points
+// into the parsed buffer, nothing is copied.
+struct openpgp_packet {
+    int tag;
+    const unsigned char* body;
+    size_t size;
+};
+
+// Reads the packet starting at *offset and advance *offset past it.
+// Returns 0 on success, -1 at the end of the stream, 1 on malformed input.
+int openpgp_next_packet(const unsigned char* data,
+                        size_t size,
+                        size_t* offset,
+                        struct openpgp_packet* packet);
+
+// Computes the v4 fingerprint of a (sub)key packet, as 40 uppercase hex
+// characters followed by \0.
+int openpgp_fingerprint(const struct openpgp_packet* packet, char* fpr);
+
+// Reads the MPI at *offset within a key packet body.
+int openpgp_read_mpi(const struct openpgp_packet* packet,
+                     size_t* offset,
+                     const unsigned char** mpi,
+                     size_t* mpi_size);
+
+#endif  // YUBIMGR_OPENPGP_H
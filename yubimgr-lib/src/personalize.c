@@ -0,0 +1,345 @@
+/*
+Copyright (C) 2016 Aurelien Vallee
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <yubimgr/personalize.h>
+#include <yubimgr/logging.h>
+
+#include "apdu.h"
+#include "audit_log.h"
+#include "personalization.h"
+#include "phase.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define OPENPGP_PW1 0x81
+#define OPENPGP_PW3 0x83
+
+#define OPENPGP_TAG_NAME 0x5B
+#define OPENPGP_TAG_LOGIN 0x5E
+#define OPENPGP_TAG_LANGUAGE 0x5F2D
+#define OPENPGP_TAG_URL 0x5F50
+#define OPENPGP_TAG_RESET_CODE 0xD3
+#define OPENPGP_TAG_UIF_SIGNATURE 0xD6
+
+// Button as the only supported user interaction
+#define UIF_BUTTON 0x20
+
+static const char* openpgp_default_user_pin  = "123456";
+static const char* openpgp_default_admin_pin = "12345678";
+
+static const struct personalization* _config;
+static struct personalization _config_copy;
+
+static const char* _card_key_names[CARD_KEY_COUNT] = {"sig", "dec", "aut"};
+
+// Policy names, in enum TOUCH_POLICY order (TOUCH_UNSET excluded)
+static const char* _touch_policy_names[] = {
+    "off", "on", "fixed", "cached", "cached-fixed",
+};
+
+int touch_parse_key(const char* name, enum CARD_KEY* key)
+{
+    for (int i = 0; i < CARD_KEY_COUNT; ++i) {
+        if (!strcmp(name, _card_key_names[i])) {
+            *key = (enum CARD_KEY)i;
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+int touch_parse_policy(const char* name, enum TOUCH_POLICY* policy)
+{
+    for (size_t i = 0; i < sizeof(_touch_policy_names) /
+                               sizeof(_touch_policy_names[0]);
+         ++i) {
+        if (!strcmp(name, _touch_policy_names[i])) {
+            *policy = (enum TOUCH_POLICY)(i + TOUCH_OFF);
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+void set_personalization(const struct personalization* config)
+{
+    if (config)
+        _config_copy = *config;
+    _config = config ? &_config_copy : NULL;
+}
+
+const struct personalization* personalization_config()
+{
+    return _config;
+}
+
+const char* personalization_admin_pin()
+{
+    return _config && _config->admin_pin ? _config->admin_pin
+                                         : openpgp_default_admin_pin;
+}
+
+// Sends an APDU to the OpenPGP applet, returns the status word in *sw
+static int openpgp_transmit(struct card_session* session,
+                            unsigned char ins,
+                            unsigned char p1,
+                            unsigned char p2,
+                            const unsigned char* data,
+                            size_t size,
+                            unsigned int* sw)
+{
+    unsigned char apdu[APDU_MAX_SIZE];
+
+    size_t apdu_size = apdu_build(apdu, 0x00, ins, p1, p2, data, size);
+    int err          = card_apdu(session, apdu, apdu_size, sw);
+    memset(apdu, 0, sizeof(apdu));
+
+    return err;
+}
+
+static int check_length(const char* what,
+                        const char* value,
+                        size_t min,
+                        size_t max)
+{
+    size_t size = strlen(value);
+
+    if (size < min || size > max) {
+        log_error("Card %s must be %zu to %zu characters long.\n", what, min,
+                  max);
+        return 1;
+    }
+
+    return 0;
+}
+
+static int verify_pin(struct card_session* session,
+                      unsigned char reference,
+                      const char* pin)
+{
+    int err;
+    unsigned int sw;
+
+    if ((err = openpgp_transmit(session, 0x20, 0x00, reference,
+                                (const unsigned char*)pin, strlen(pin), &sw)))
+        return err;
+
+    if (sw != SW_OK) {
+        log_error("Failed to verify %s PIN (%04X).\n",
+                  reference == OPENPGP_PW3 ? "admin" : "user", sw);
+        return 1;
+    }
+
+    return 0;
+}
+
+static int change_pin(struct card_session* session,
+                      unsigned char reference,
+                      const char* old_pin,
+                      const char* new_pin)
+{
+    int err;
+    unsigned int sw;
+    unsigned char data[255];
+    size_t old_size = strlen(old_pin);
+    size_t new_size = strlen(new_pin);
+    const char* what = reference == OPENPGP_PW3 ? "admin" : "user";
+
+    if (old_size + new_size > sizeof(data)) {
+        log_error("Card %s PINs are too long.\n", what);
+        return 1;
+    }
+
+    memcpy(data, old_pin, old_size);
+    memcpy(data + old_size, new_pin, new_size);
+    err = openpgp_transmit(session, 0x24, 0x00, reference, data,
+                           old_size + new_size, &sw);
+    memset(data, 0, sizeof(data));
+
+    if (err)
+        return err;
+
+    if (sw != SW_OK) {
+        log_error("Failed to change %s PIN (%04X).\n", what, sw);
+        return 1;
+    }
+
+    log_debug("Changed card %s PIN.\n", what);
+
+    return 0;
+}
+
+// Writes a data object. A refused object is logged and counted in *failed,
+// only transport errors are returned.
+static int put_data(struct card_session* session,
+                    const char* what,
+                    unsigned int tag,
+                    const unsigned char* data,
+                    size_t size,
+                    size_t* failed)
+{
+    int err;
+    unsigned int sw;
+
+    if (size > APDU_MAX_SIZE - 6) {
+        log_error("Card %s is too long.\n", what);
+        ++*failed;
+        return 0;
+    }
+
+    if ((err = openpgp_transmit(session, 0xDA, tag >> 8, tag & 0xFF, data,
+                                size, &sw)))
+        return err;
+
+    if (sw != SW_OK) {
+        log_error("Failed to write card %s (%04X).\n", what, sw);
+        ++*failed;
+        return 0;
+    }
+
+    log_debug("Wrote card %s.\n", what);
+
+    return 0;
+}
+
+// ISO/IEC 7501-1 name: "Lastname<<Firstname", spaces as '<'
+static void format_name(const char* firstname,
+                        const char* lastname,
+                        char* out,
+                        size_t size)
+{
+    snprintf(out, size, "%s<<%s", lastname ? lastname : "",
+             firstname ? firstname : "");
+    for (char* c = out; *c; ++c)
+        if (*c == ' ')
+            *c = '<';
+}
+
+int personalize_session(struct card_session* session,
+                        const struct personalization* config)
+{
+    int err;
+    const char* admin_pin =
+        config->admin_pin ? config->admin_pin : openpgp_default_admin_pin;
+    const char* user_pin =
+        config->user_pin ? config->user_pin : openpgp_default_user_pin;
+
+    // Check lengths before spending a PIN retry
+    if ((config->new_admin_pin &&
+         check_length("admin PIN", config->new_admin_pin, 8, 127)) ||
+        (config->new_user_pin &&
+         check_length("user PIN", config->new_user_pin, 6, 127)) ||
+        (config->reset_code &&
+         check_length("reset code", config->reset_code, 8, 127)))
+        return 1;
+
+    if ((err = select_openpgp(session)) ||
+        (err = verify_pin(session, OPENPGP_PW3, admin_pin)))
+        return err;
+
+    // Every field is written and checked, only transport errors abort the
+    // batch
+    size_t failed = 0;
+    char name[40];
+    format_name(config->firstname, config->lastname, name, sizeof(name));
+
+    const struct {
+        const char* what;
+        unsigned int tag;
+        const char* value;
+    } strings[] = {
+        {"name", OPENPGP_TAG_NAME,
+         config->firstname || config->lastname ? name : NULL},
+        {"login data", OPENPGP_TAG_LOGIN, config->login},
+        {"language", OPENPGP_TAG_LANGUAGE, config->language},
+        {"URL", OPENPGP_TAG_URL, config->url},
+        {"reset code", OPENPGP_TAG_RESET_CODE, config->reset_code},
+    };
+    for (size_t i = 0; i < sizeof(strings) / sizeof(strings[0]); ++i) {
+        if (strings[i].value &&
+            (err = put_data(session, strings[i].what, strings[i].tag,
+                            (const unsigned char*)strings[i].value,
+                            strlen(strings[i].value), &failed)))
+            return err;
+    }
+
+    for (int key = 0; key < CARD_KEY_COUNT; ++key) {
+        if (config->touch[key] == TOUCH_UNSET)
+            continue;
+        char what[32];
+        unsigned char uif[2] = {config->touch[key] - TOUCH_OFF, UIF_BUTTON};
+        snprintf(what, sizeof(what), "%s touch policy", _card_key_names[key]);
+        if ((err = put_data(session, what, OPENPGP_TAG_UIF_SIGNATURE + key,
+                            uif, sizeof(uif), &failed)))
+            return err;
+    }
+
+    if (failed) {
+        log_error("Failed to write %zu card fields, PINs left unchanged.\n",
+                  failed);
+        return 1;
+    }
+
+    // The admin PIN first: should the user PIN change fail, the new admin
+    // PIN still allows to unblock or set the user PIN
+    if (config->new_admin_pin &&
+        (err = change_pin(session, OPENPGP_PW3, admin_pin,
+                          config->new_admin_pin)))
+        return err;
+    if (config->new_user_pin &&
+        (err = change_pin(session, OPENPGP_PW1, user_pin,
+                          config->new_user_pin))) {
+        if (config->new_admin_pin)
+            log_error("The admin PIN was changed, the user PIN was not.\n");
+        return err;
+    }
+
+    log_info("Successfully personalized the card.\n");
+
+    return 0;
+}
+
+int personalize_card(const struct personalization* config)
+{
+    struct card_session* session;
+    int err;
+
+    if (!(err = card_open(&session))) {
+        err = personalize_session(session, config);
+        card_close(session);
+    }
+
+    return err;
+}
+
+int personalize(const struct personalization* config)
+{
+    struct phase_span span;
+
+    phase_begin(&span, PHASE_PERSONALIZE);
+    int err = phase_end(&span, personalize_card(config));
+    audit_clear();
+
+    return err;
+}
@@ -0,0 +1,54 @@
+/*
+Copyright (C) 2016 Aurelien Vallee
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef YUBIMGR_PHASE_H
+#define YUBIMGR_PHASE_H
+
+#include <yubimgr/metrics.h>
+
+enum COUNTER {
+    COUNTER_BOOTSTRAP_CARDS = 0,
+    COUNTER_RESET_CARDS,
+    COUNTER_PIV_CARDS,
+    COUNTER_RESET_SUCCESS,
+    COUNTER_RESET_FAILURE,
+    COUNTER_AGENT_RESTARTS,
+    COUNTER_TIMEOUTS,
+    COUNTER_RETRIES,
+    COUNTER_COUNT,
+};
+
+struct phase_span {
+    enum PHASE phase;
+    double start;
+    double outer_deadline;
+};
+
+void metrics_increment(enum COUNTER counter);
+
+// Marks the boundaries of a phase, which is bounded by its timeout until
+// phase_end(). phase_end() records the phase duration and failure, and
+// returns err unchanged.
+void phase_begin(struct phase_span* span, enum PHASE phase);
+
+int phase_end(struct phase_span* span, int err);
+
+#endif  // YUBIMGR_PHASE_H
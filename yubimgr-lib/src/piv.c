@@ -0,0 +1,747 @@
+/*
+Copyright (C) 2016 Aurelien Vallee
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <yubimgr/piv.h>
+#include <yubimgr/logging.h>
+
+#include "apdu.h"
+#include "audit_log.h"
+#include "bootstrap.h"
+#include "deadline.h"
+#include "encoding.h"
+#include "phase.h"
+#include "trace_events.h"
+
+#include <gcrypt.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#define PIV_KEY_PIN 0x80
+#define PIV_KEY_PUK 0x81
+#define PIV_KEY_MANAGEMENT 0x9B
+#define PIV_MAX_OBJECT_SIZE 3072
+#define PIV_MAX_PUBLIC_KEY_SIZE 1024
+
+static const unsigned char piv_aid[] = {0xA0, 0x00, 0x00, 0x03, 0x08};
+
+static const unsigned char piv_default_management_key[24] = {
+    0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x01, 0x02, 0x03, 0x04,
+    0x05, 0x06, 0x07, 0x08, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08};
+
+static const char* piv_default_pin = "123456";
+static const char* piv_default_puk = "12345678";
+
+static const struct {
+    const char* name;
+    unsigned char key_ref;
+    unsigned long object_id;
+} piv_slots[PIV_SLOT_COUNT] = {
+    {"9a", 0x9A, 0x5FC105},
+    {"9c", 0x9C, 0x5FC10A},
+    {"9d", 0x9D, 0x5FC10B},
+    {"9e", 0x9E, 0x5FC101},
+};
+
+static const struct {
+    const char* name;
+    enum PIV_ALGO algorithm;
+} piv_algorithms[] = {
+    {"rsa1024", PIV_ALGO_RSA1024},
+    {"rsa2048", PIV_ALGO_RSA2048},
+    {"eccp256", PIV_ALGO_ECCP256},
+    {"eccp384", PIV_ALGO_ECCP384},
+};
+
+static const struct {
+    const char* name;
+    enum PIV_ALGO algorithm;
+    int cipher;
+    size_t key_size;
+    size_t block_size;
+} piv_management_algorithms[] = {
+    {"3des", PIV_ALGO_3DES, GCRY_CIPHER_3DES, 24, 8},
+    {"aes128", PIV_ALGO_AES128, GCRY_CIPHER_AES128, 16, 16},
+    {"aes192", PIV_ALGO_AES192, GCRY_CIPHER_AES192, 24, 16},
+    {"aes256", PIV_ALGO_AES256, GCRY_CIPHER_AES256, 32, 16},
+};
+
+#define PIV_MANAGEMENT_ALGORITHM_COUNT \
+    (sizeof(piv_management_algorithms) / sizeof(piv_management_algorithms[0]))
+
+int piv_parse_slot(const char* name, enum PIV_SLOT* slot)
+{
+    for (int i = 0; i < PIV_SLOT_COUNT; ++i) {
+        if (!strcasecmp(name, piv_slots[i].name)) {
+            *slot = (enum PIV_SLOT)i;
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+int piv_parse_algorithm(const char* name, enum PIV_ALGO* algorithm)
+{
+    for (size_t i = 0; i < sizeof(piv_algorithms) / sizeof(piv_algorithms[0]);
+         ++i) {
+        if (!strcasecmp(name, piv_algorithms[i].name)) {
+            *algorithm = piv_algorithms[i].algorithm;
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+int piv_parse_management_algorithm(const char* name, enum PIV_ALGO* algorithm)
+{
+    for (size_t i = 0; i < PIV_MANAGEMENT_ALGORITHM_COUNT; ++i) {
+        if (!strcasecmp(name, piv_management_algorithms[i].name)) {
+            *algorithm = piv_management_algorithms[i].algorithm;
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+// Returns the index of a management key algorithm, or -1
+static int management_algorithm(enum PIV_ALGO algorithm)
+{
+    for (size_t i = 0; i < PIV_MANAGEMENT_ALGORITHM_COUNT; ++i)
+        if (piv_management_algorithms[i].algorithm == algorithm)
+            return (int)i;
+
+    return -1;
+}
+
+// Finds tag in a flat BER-TLV list (single byte tags). Returns its value,
+// or NULL.
+static const unsigned char* tlv_find(const unsigned char* data,
+                                     size_t size,
+                                     unsigned char tag,
+                                     size_t* length)
+{
+    size_t off = 0;
+
+    while (off + 2 <= size) {
+        unsigned char current = data[off++];
+        size_t value_size     = data[off++];
+        if (value_size == 0x81 && off + 1 <= size) {
+            value_size = data[off++];
+        } else if (value_size == 0x82 && off + 2 <= size) {
+            value_size = (data[off] << 8) | data[off + 1];
+            off += 2;
+        } else if (value_size > 0x80) {
+            return NULL;
+        }
+        if (value_size > size - off)
+            return NULL;
+        if (current == tag) {
+            *length = value_size;
+            return data + off;
+        }
+        off += value_size;
+    }
+
+    return NULL;
+}
+
+static int piv_transmit(struct card_session* session,
+                        const char* what,
+                        unsigned char ins,
+                        unsigned char p1,
+                        unsigned char p2,
+                        const unsigned char* data,
+                        size_t size)
+{
+    int err;
+    unsigned int sw;
+    unsigned char apdu[APDU_MAX_SIZE];
+
+    size_t apdu_size = apdu_build(apdu, 0x00, ins, p1, p2, data, size);
+    if ((err = card_apdu(session, apdu, apdu_size, &sw)))
+        return err;
+
+    if (sw != SW_OK) {
+        log_error("Failed to %s (%04X).\n", what, sw);
+        return 1;
+    }
+
+    return 0;
+}
+
+static void pad_pin(const char* pin, unsigned char* out)
+{
+    size_t size = strlen(pin);
+
+    memset(out, 0xFF, 8);
+    memcpy(out, pin, size > 8 ? 8 : size);
+}
+
+static int piv_block(struct card_session* session,
+                     const char* what,
+                     unsigned char ins,
+                     size_t size)
+{
+    int err;
+    unsigned int sw = 0;
+    unsigned char apdu[APDU_MAX_SIZE];
+    unsigned char wrong[16];
+
+    memset(wrong, 0x40, sizeof(wrong));
+    size_t apdu_size = apdu_build(apdu, 0x00, ins, 0x00, PIV_KEY_PIN, wrong,
+                                  size);
+
+    // Retry counters never go above 255
+    for (int i = 0; i < 256; ++i) {
+        if ((err = card_apdu(session, apdu, apdu_size, &sw)))
+            return err;
+        if (!card_pin_retry(sw))
+            break;
+    }
+
+    if (sw != SW_AUTH_BLOCKED) {
+        log_error("Failed to block PIV %s (%04X).\n", what, sw);
+        return 1;
+    }
+
+    return 0;
+}
+
+static int piv_reset(struct card_session* session)
+{
+    int err;
+
+    log_info("Resetting PIV applet...\n");
+
+    // The applet can only be reset once both PIN and PUK are blocked. The
+    // PUK is blocked through RESET RETRY COUNTER with a wrong PUK.
+    if ((err = piv_block(session, "PIN", 0x20, 8)) ||
+        (err = piv_block(session, "PUK", 0x2C, 16)))
+        return err;
+
+    return piv_transmit(session, "reset PIV applet", 0xFB, 0x00, 0x00, NULL,
+                        0);
+}
+
+static int piv_change_reference(struct card_session* session,
+                                const char* what,
+                                unsigned char key_ref,
+                                const char* old_value,
+                                const char* new_value)
+{
+    unsigned char data[16];
+    char description[64];
+
+    size_t size = strlen(new_value);
+    if (size < 6 || size > 8) {
+        log_error("PIV %s must be 6 to 8 characters long.\n", what);
+        return 1;
+    }
+
+    pad_pin(old_value, data);
+    pad_pin(new_value, data + 8);
+    snprintf(description, sizeof(description), "change PIV %s", what);
+
+    int err = piv_transmit(session, description, 0x24, 0x00, key_ref, data,
+                           sizeof(data));
+    memset(data, 0, sizeof(data));
+
+    return err;
+}
+
+// Algorithm of the management key as reported by the card. Cards without
+// GET METADATA (YubiKey before 5.3) all use 3DES.
+static int piv_management_metadata(struct card_session* session,
+                                   enum PIV_ALGO* algorithm)
+{
+    int err;
+    unsigned int sw;
+    unsigned char apdu[APDU_MAX_SIZE];
+    size_t length;
+
+    size_t size = apdu_build(apdu, 0x00, 0xF7, 0x00, PIV_KEY_MANAGEMENT, NULL,
+                             0);
+    if ((err = card_apdu(session, apdu, size, &sw)))
+        return err;
+
+    const unsigned char* value =
+        sw == SW_OK ? tlv_find(session->response, session->response_size,
+                               0x01, &length)
+                    : NULL;
+    *algorithm = value && length == 1 ? (enum PIV_ALGO)value[0]
+                                      : PIV_ALGO_3DES;
+    log_debug("PIV management key algorithm is %02X%s.\n", *algorithm,
+              value ? "" : " (assumed)");
+
+    return 0;
+}
+
+static int piv_authenticate(struct card_session* session,
+                            enum PIV_ALGO algorithm,
+                            const unsigned char* management_key,
+                            size_t management_key_size)
+{
+    int err;
+    unsigned int sw;
+    unsigned char apdu[APDU_MAX_SIZE];
+    unsigned char data[20] = {0x7C, 0x02, 0x81, 0x00};
+
+    int i = management_algorithm(algorithm);
+    if (i < 0) {
+        log_error("Unsupported PIV management key algorithm %02X.\n",
+                  algorithm);
+        return 1;
+    }
+    size_t block_size = piv_management_algorithms[i].block_size;
+    if (management_key_size != piv_management_algorithms[i].key_size) {
+        log_error("PIV %s management key must be %zu bytes long.\n",
+                  piv_management_algorithms[i].name,
+                  piv_management_algorithms[i].key_size);
+        return 1;
+    }
+
+    // Ask the card for a challenge, and answer it with the management key
+    size_t size = apdu_build(apdu, 0x00, 0x87, algorithm, PIV_KEY_MANAGEMENT,
+                             data, 4);
+    if ((err = card_apdu(session, apdu, size, &sw)))
+        return err;
+
+    const unsigned char* response = session->response;
+    if (sw != SW_OK || session->response_size < 4 + block_size ||
+        response[0] != 0x7C || response[2] != 0x81 ||
+        response[3] != block_size) {
+        log_error("Failed to get PIV management challenge (%04X).\n", sw);
+        return 1;
+    }
+
+    gcry_cipher_hd_t cipher;
+    if ((err = gcry_cipher_open(&cipher, piv_management_algorithms[i].cipher,
+                                GCRY_CIPHER_MODE_ECB, 0))) {
+        log_error("Failed to open %s cipher.\n",
+                  piv_management_algorithms[i].name);
+        return err;
+    }
+
+    data[1] = 2 + block_size;
+    data[2] = 0x82;
+    data[3] = block_size;
+    if ((err = gcry_cipher_setkey(cipher, management_key,
+                                  management_key_size)) ||
+        (err = gcry_cipher_encrypt(cipher, data + 4, block_size, response + 4,
+                                   block_size))) {
+        log_error("Failed to answer PIV management challenge.\n");
+        gcry_cipher_close(cipher);
+        return err;
+    }
+    gcry_cipher_close(cipher);
+
+    return piv_transmit(session, "authenticate PIV management key", 0x87,
+                        algorithm, PIV_KEY_MANAGEMENT, data, 4 + block_size);
+}
+
+static int piv_set_management_key(struct card_session* session,
+                                  enum PIV_ALGO algorithm,
+                                  const unsigned char* management_key,
+                                  size_t management_key_size)
+{
+    unsigned char data[3 + PIV_MANAGEMENT_KEY_MAX_SIZE] = {
+        algorithm, PIV_KEY_MANAGEMENT, management_key_size};
+
+    int i = management_algorithm(algorithm);
+    if (i < 0 || management_key_size != piv_management_algorithms[i].key_size) {
+        log_error("Invalid new PIV management key.\n");
+        return 1;
+    }
+
+    memcpy(data + 3, management_key, management_key_size);
+
+    int err = piv_transmit(session, "set PIV management key", 0xFF, 0xFF,
+                           0xFF, data, 3 + management_key_size);
+    memset(data, 0, sizeof(data));
+
+    return err;
+}
+
+static size_t put_length(unsigned char* out, size_t size)
+{
+    if (size < 0x80) {
+        out[0] = size;
+        return 1;
+    } else if (size < 0x100) {
+        out[0] = 0x81;
+        out[1] = size;
+        return 2;
+    }
+
+    out[0] = 0x82;
+    out[1] = size >> 8;
+    out[2] = size & 0xFF;
+    return 3;
+}
+
+// Appends a DER element
+static size_t der_put(unsigned char* out,
+                      unsigned char tag,
+                      const unsigned char* value,
+                      size_t size)
+{
+    size_t off = 0;
+
+    out[off++] = tag;
+    off += put_length(out + off, size);
+    memmove(out + off, value, size);
+
+    return off + size;
+}
+
+// Appends a DER INTEGER from a big endian unsigned value
+static size_t der_put_integer(unsigned char* out,
+                              const unsigned char* value,
+                              size_t size)
+{
+    unsigned char integer[PIV_MAX_PUBLIC_KEY_SIZE];
+
+    while (size > 1 && !value[0]) {
+        value++;
+        size--;
+    }
+    if (size + 1 > sizeof(integer))
+        return 0;
+
+    // Keep the value positive
+    size_t off = 0;
+    if (value[0] & 0x80)
+        integer[off++] = 0;
+    memcpy(integer + off, value, size);
+
+    return der_put(out, 0x02, integer, off + size);
+}
+
+// Builds the SubjectPublicKeyInfo of a generated key from its public key
+// template (7F49). Returns its size, or 0.
+static size_t piv_public_key_der(const unsigned char* template,
+                                 size_t template_size,
+                                 enum PIV_ALGO algorithm,
+                                 unsigned char* out)
+{
+    // AlgorithmIdentifier of rsaEncryption, and of ecPublicKey on P-256 and
+    // P-384
+    static const unsigned char rsa[] = {0x30, 0x0D, 0x06, 0x09, 0x2A, 0x86,
+                                        0x48, 0x86, 0xF7, 0x0D, 0x01, 0x01,
+                                        0x01, 0x05, 0x00};
+    static const unsigned char p256[] = {
+        0x30, 0x13, 0x06, 0x07, 0x2A, 0x86, 0x48, 0xCE, 0x3D, 0x02, 0x01,
+        0x06, 0x08, 0x2A, 0x86, 0x48, 0xCE, 0x3D, 0x03, 0x01, 0x07};
+    static const unsigned char p384[] = {0x30, 0x10, 0x06, 0x07, 0x2A, 0x86,
+                                         0x48, 0xCE, 0x3D, 0x02, 0x01, 0x06,
+                                         0x05, 0x2B, 0x81, 0x04, 0x00, 0x22};
+    unsigned char key[PIV_MAX_PUBLIC_KEY_SIZE];
+    unsigned char info[PIV_MAX_PUBLIC_KEY_SIZE];
+    size_t key_size = 1;
+    size_t info_size;
+    size_t size;
+
+    // The template tag is 7F 49, look for 49 past its first byte
+    if (template_size < 2 || template[0] != 0x7F)
+        return 0;
+    const unsigned char* keys = tlv_find(template + 1, template_size - 1, 0x49,
+                                         &size);
+    if (!keys)
+        return 0;
+
+    // The key is a BIT STRING without unused bits
+    key[0] = 0;
+    if (algorithm == PIV_ALGO_RSA1024 || algorithm == PIV_ALGO_RSA2048) {
+        size_t modulus_size, exponent_size;
+        const unsigned char* modulus = tlv_find(keys, size, 0x81,
+                                                &modulus_size);
+        const unsigned char* exponent = tlv_find(keys, size, 0x82,
+                                                 &exponent_size);
+        if (!modulus || !exponent ||
+            modulus_size + exponent_size + 16 > sizeof(info))
+            return 0;
+        info_size = der_put_integer(info, modulus, modulus_size);
+        info_size += der_put_integer(info + info_size, exponent,
+                                     exponent_size);
+        key_size += der_put(key + key_size, 0x30, info, info_size);
+        memcpy(info, rsa, sizeof(rsa));
+        info_size = sizeof(rsa);
+    } else {
+        size_t point_size;
+        const unsigned char* point = tlv_find(keys, size, 0x86, &point_size);
+        if (!point || point_size + 8 > sizeof(key))
+            return 0;
+        memcpy(key + key_size, point, point_size);
+        key_size += point_size;
+        const unsigned char* curve = algorithm == PIV_ALGO_ECCP256 ? p256
+                                                                   : p384;
+        info_size = algorithm == PIV_ALGO_ECCP256 ? sizeof(p256)
+                                                  : sizeof(p384);
+        memcpy(info, curve, info_size);
+    }
+
+    info_size += der_put(info + info_size, 0x03, key, key_size);
+
+    return der_put(out, 0x30, info, info_size);
+}
+
+static int piv_write_public_key(const unsigned char* der,
+                                size_t size,
+                                const char* path)
+{
+    char pem[BASE64_SIZE(PIV_MAX_PUBLIC_KEY_SIZE)];
+
+    FILE* file = fopen(path, "w");
+    if (!file) {
+        log_error("Failed to open \"%s\": %s\n", path, strerror(errno));
+        return 1;
+    }
+
+    size_t pem_size = base64_encode(der, size, pem);
+    fputs("-----BEGIN PUBLIC KEY-----\n", file);
+    for (size_t off = 0; off < pem_size; off += 64)
+        fprintf(file, "%.64s\n", pem + off);
+    fputs("-----END PUBLIC KEY-----\n", file);
+
+    if (fclose(file)) {
+        log_error("Failed to write \"%s\": %s\n", path, strerror(errno));
+        return 1;
+    }
+
+    return 0;
+}
+
+static int piv_generate(struct card_session* session,
+                        enum PIV_SLOT slot,
+                        enum PIV_ALGO algorithm,
+                        const char* public_key)
+{
+    int err;
+    unsigned char der[PIV_MAX_PUBLIC_KEY_SIZE];
+    unsigned char data[] = {0xAC, 0x03, 0x80, 0x01, algorithm};
+    char description[64];
+
+    log_info("Generating PIV key in slot %s...\n", piv_slots[slot].name);
+
+    snprintf(description, sizeof(description), "generate PIV key in slot %s",
+             piv_slots[slot].name);
+    if ((err = piv_transmit(session, description, 0x47, 0x00,
+                            piv_slots[slot].key_ref, data, sizeof(data))))
+        return err;
+
+    // The response is the public key template
+    if (session->response_size < 2 || session->response[0] != 0x7F ||
+        session->response[1] != 0x49) {
+        log_error("Unexpected PIV key generation response.\n");
+        return 1;
+    }
+
+    size_t der_size = piv_public_key_der(session->response,
+                                         session->response_size, algorithm,
+                                         der);
+    if (!der_size) {
+        log_error("Failed to parse PIV public key of slot %s.\n",
+                  piv_slots[slot].name);
+        return 1;
+    }
+
+    if (public_key) {
+        log_info("Writing PIV public key of slot %s to \"%s\"...\n",
+                 piv_slots[slot].name, public_key);
+        return piv_write_public_key(der, der_size, public_key);
+    }
+
+    return 0;
+}
+
+static int piv_import_certificate(struct card_session* session,
+                                  enum PIV_SLOT slot,
+                                  const char* path)
+{
+    int err;
+    unsigned char certificate[PIV_MAX_OBJECT_SIZE];
+    unsigned char object[PIV_MAX_OBJECT_SIZE + 32];
+
+    log_info("Importing certificate \"%s\" in PIV slot %s...\n", path,
+             piv_slots[slot].name);
+
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        log_error("Failed to open \"%s\": %s\n", path, strerror(errno));
+        return 1;
+    }
+    size_t size = fread(certificate, 1, sizeof(certificate), file);
+    int truncated = !feof(file);
+    fclose(file);
+
+    if (!size || truncated) {
+        log_error("Certificate \"%s\" is empty or too large.\n", path);
+        return 1;
+    }
+
+    // Certificate container: 70 cert, 71 compression (none), FE LRC
+    size_t inner = 1 + (size < 0x80 ? 1 : size < 0x100 ? 2 : 3) + size + 5;
+    size_t off   = 0;
+
+    object[off++] = 0x5C;
+    object[off++] = 0x03;
+    object[off++] = piv_slots[slot].object_id >> 16;
+    object[off++] = (piv_slots[slot].object_id >> 8) & 0xFF;
+    object[off++] = piv_slots[slot].object_id & 0xFF;
+    object[off++] = 0x53;
+    off += put_length(object + off, inner);
+    object[off++] = 0x70;
+    off += put_length(object + off, size);
+    memcpy(object + off, certificate, size);
+    off += size;
+    static const unsigned char trailer[] = {0x71, 0x01, 0x00, 0xFE, 0x00};
+    memcpy(object + off, trailer, sizeof(trailer));
+    off += sizeof(trailer);
+
+    // PUT DATA with command chaining, 255 bytes at a time
+    for (size_t sent = 0; sent < off;) {
+        unsigned int sw;
+        unsigned char apdu[APDU_MAX_SIZE];
+        size_t chunk = off - sent > 255 ? 255 : off - sent;
+        unsigned char cla = sent + chunk < off ? 0x10 : 0x00;
+
+        size_t apdu_size = apdu_build(apdu, cla, 0xDB, 0x3F, 0xFF,
+                                      object + sent, chunk);
+        if ((err = card_apdu(session, apdu, apdu_size, &sw)))
+            return err;
+        if (sw != SW_OK) {
+            log_error("Failed to import certificate in PIV slot %s (%04X).\n",
+                      piv_slots[slot].name, sw);
+            return 1;
+        }
+        sent += chunk;
+    }
+
+    return 0;
+}
+
+int piv_provision_session(struct card_session* session,
+                          const struct piv_config* config)
+{
+    int err;
+
+    // A wrong current value would cost a retry, never guess it
+    const char* current_pin = config->reset ? piv_default_pin
+                                            : config->current_pin;
+    const char* current_puk = config->reset ? piv_default_puk
+                                            : config->current_puk;
+    if ((config->pin && !current_pin) || (config->puk && !current_puk)) {
+        log_error("Changing the PIV PIN or PUK requires the current one, "
+                  "or a reset.\n");
+        return 1;
+    }
+
+    if ((err = check_gcrypt()) != 0)
+        return err;
+
+    if ((err = piv_transmit(session, "select PIV applet", 0xA4, 0x04, 0x00,
+                            piv_aid, sizeof(piv_aid))))
+        return err;
+
+    if (config->reset && (err = piv_reset(session)))
+        return err;
+
+    if (config->pin &&
+        (err = piv_change_reference(session, "PIN", PIV_KEY_PIN,
+                                    current_pin, config->pin)))
+        return err;
+
+    if (config->puk &&
+        (err = piv_change_reference(session, "PUK", PIV_KEY_PUK,
+                                    current_puk, config->puk)))
+        return err;
+
+    // Everything else requires the management key
+    enum PIV_ALGO algorithm = config->management_algorithm;
+    if (algorithm == PIV_ALGO_NONE &&
+        (err = piv_management_metadata(session, &algorithm)))
+        return err;
+    if (config->management_key)
+        err = piv_authenticate(session, algorithm, config->management_key,
+                               config->management_key_size);
+    else
+        err = piv_authenticate(session, algorithm, piv_default_management_key,
+                               sizeof(piv_default_management_key));
+    if (err)
+        return err;
+
+    for (int slot = 0; slot < PIV_SLOT_COUNT; ++slot) {
+        const struct piv_slot_config* slot_config = &config->slots[slot];
+        if (slot_config->algorithm != PIV_ALGO_NONE &&
+            (err = piv_generate(session, (enum PIV_SLOT)slot,
+                                slot_config->algorithm,
+                                slot_config->public_key)))
+            return err;
+        if (slot_config->certificate &&
+            (err = piv_import_certificate(session, (enum PIV_SLOT)slot,
+                                          slot_config->certificate)))
+            return err;
+    }
+
+    // Changed last, the current authentication still holds until then
+    if (config->new_management_key &&
+        (err = piv_set_management_key(
+             session,
+             config->new_management_algorithm != PIV_ALGO_NONE
+                 ? config->new_management_algorithm
+                 : algorithm,
+             config->new_management_key, config->new_management_key_size)))
+        return err;
+
+    log_info("Successfully provisioned the PIV applet.\n");
+
+    return 0;
+}
+
+int piv_provision(const struct piv_config* config)
+{
+    struct card_session* session;
+    struct phase_span span;
+    int attempt = 0;
+    int err;
+
+    trace_card("piv");
+
+    // Only a provisioning starting with a reset can safely be replayed
+    phase_begin(&span, PHASE_PIV);
+    do {
+        if (!(err = card_open(&session))) {
+            err = piv_provision_session(session, config);
+            card_close(session);
+        }
+    } while (config->reset && card_transient(err) && !retry_backoff(&attempt));
+    metrics_increment(COUNTER_PIV_CARDS);
+    phase_end(&span, err);
+    audit_clear();
+
+    return err;
+}
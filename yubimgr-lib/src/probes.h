@@ -0,0 +1,60 @@
+/*
+Copyright (C) 2016 Aurelien Vallee
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef YUBIMGR_PROBES_H
+#define YUBIMGR_PROBES_H
+
+// USDT probes of the "yubimgr" provider, e.g.
+//   bpftrace -l 'usdt:/usr/lib/libyubimgr.so:yubimgr:*'
+// They compile to a nop (and no code at all without <sys/sdt.h>).
+//
+// phase__begin(const char* phase, size_t card)
+// phase__end(const char* phase, size_t card, int err, long duration_us)
+// keyedit__prompt(int status, const char* prompt, size_t step)
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+
+#define YUBIMGR_PROBE2(name, a, b) DTRACE_PROBE2(yubimgr, name, a, b)
+#define YUBIMGR_PROBE3(name, a, b, c) DTRACE_PROBE3(yubimgr, name, a, b, c)
+#define YUBIMGR_PROBE4(name, a, b, c, d) \
+    DTRACE_PROBE4(yubimgr, name, a, b, c, d)
+#else
+#define YUBIMGR_PROBE2(name, a, b) \
+    do {                           \
+        (void)(a);                 \
+        (void)(b);                 \
+    } while (0)
+#define YUBIMGR_PROBE3(name, a, b, c) \
+    do {                              \
+        (void)(a);                    \
+        (void)(b);                    \
+        (void)(c);                    \
+    } while (0)
+#define YUBIMGR_PROBE4(name, a, b, c, d) \
+    do {                                 \
+        (void)(a);                       \
+        (void)(b);                       \
+        (void)(c);                       \
+        (void)(d);                       \
+    } while (0)
+#endif
+
+#endif  // YUBIMGR_PROBES_H
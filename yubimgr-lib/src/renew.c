@@ -0,0 +1,430 @@
+/*
+Copyright (C) 2016 Aurelien Vallee
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <yubimgr/renew.h>
+#include <yubimgr/logging.h>
+
+#include "audit_log.h"
+#include "bootstrap.h"
+#include "deadline.h"
+#include "keylist.h"
+#include "phase.h"
+#include "trace_events.h"
+
+#include <gpgme.h>
+
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+// Primary key excluded, more subkeys than that is not a bootstrap() key
+#define RENEW_MAX_SUBKEYS 8
+
+// A masterkey of the vault, and the outcome of its renewal
+struct renewal_job {
+    char fpr[41];
+    char user[64];
+    int err;
+    char* exported;
+    size_t exported_size;
+};
+
+// Jobs are handed out one at a time to whichever worker is free
+struct renewal_pool {
+    const struct renewal* config;
+    struct renewal_job* jobs;
+    size_t count;
+    size_t next;
+    size_t workers;
+    pthread_mutex_t mutex;
+};
+
+static int job_compare(const void* a, const void* b)
+{
+    return strcasecmp(((const struct renewal_job*)a)->fpr,
+                      ((const struct renewal_job*)b)->fpr);
+}
+
+// Whether a vault file name is a bootstrap() export, FINGERPRINT.asc. The
+// fingerprint keeps the case of the name, the file is opened from it.
+static int vault_fingerprint(const char* name, char* fpr)
+{
+    if (strlen(name) != 44 || strcmp(name + 40, ".asc"))
+        return 0;
+
+    for (size_t i = 0; i < 40; ++i) {
+        if (!isxdigit((unsigned char)name[i]))
+            return 0;
+        fpr[i] = name[i];
+    }
+    fpr[40] = 0;
+
+    return 1;
+}
+
+// Patterns are fingerprints or key IDs (trailing part of the fingerprint)
+static int vault_match(const char* fpr, const char** patterns)
+{
+    if (!patterns || !*patterns)
+        return 1;
+
+    for (; *patterns; ++patterns) {
+        const char* pattern = *patterns;
+        if (!strncasecmp(pattern, "0x", 2))
+            pattern += 2;
+        size_t size = strlen(pattern);
+        if (size >= 8 && size <= 40 && !strcasecmp(fpr + 40 - size, pattern))
+            return 1;
+    }
+
+    return 0;
+}
+
+static int vault_scan(const char* vault,
+                      const char** patterns,
+                      struct renewal_job** jobs,
+                      size_t* count)
+{
+    size_t capacity = 0;
+    char fpr[41];
+
+    DIR* dir = opendir(vault);
+    if (!dir) {
+        log_error("Failed to open vault \"%s\": %s\n", vault, strerror(errno));
+        return 1;
+    }
+
+    *jobs  = NULL;
+    *count = 0;
+
+    struct dirent* entry;
+    while ((entry = readdir(dir))) {
+        if (!vault_fingerprint(entry->d_name, fpr) ||
+            !vault_match(fpr, patterns))
+            continue;
+        if (*count == capacity) {
+            capacity = capacity ? 2 * capacity : 64;
+            struct renewal_job* grown = (struct renewal_job*)realloc(
+                *jobs, capacity * sizeof(struct renewal_job));
+            if (!grown) {
+                closedir(dir);
+                return 1;
+            }
+            *jobs = grown;
+        }
+        memset(&(*jobs)[*count], 0, sizeof(struct renewal_job));
+        memcpy((*jobs)[(*count)++].fpr, fpr, sizeof(fpr));
+    }
+    closedir(dir);
+
+    // The bundle lists the keys in a stable order, whatever the scheduling
+    if (*count)
+        qsort(*jobs, *count, sizeof(struct renewal_job), job_compare);
+
+    return 0;
+}
+
+static int import_masterkey(struct gpgme_context* context,
+                            const char* vault,
+                            const char* fpr)
+{
+    int err;
+    char path[1024];
+    gpgme_data_t data = NULL;
+
+    snprintf(path, sizeof(path), "%s/%s.asc", vault, fpr);
+    if ((err = gpgme_data_new_from_file(&data, path, 1))) {
+        log_error("Failed to read \"%s\". %s: %s\n", path,
+                  gpgme_strsource(err), gpgme_strerror(err));
+        return err;
+    }
+
+    err = gpgme_op_import(context, data);
+    gpgme_data_release(data);
+    if (err) {
+        log_error("Failed to import masterkey %s. %s: %s\n", fpr,
+                  gpgme_strsource(err), gpgme_strerror(err));
+        return err;
+    }
+
+    gpgme_import_result_t result = gpgme_op_import_result(context);
+    if (!result || !(result->secret_imported + result->secret_unchanged)) {
+        log_error("No secret masterkey in \"%s\".\n", path);
+        return 1;
+    }
+
+    return 0;
+}
+
+// Selects every subkey, then sets their expiration at once
+static int expire_subkeys(struct gpgme_context* context,
+                          gpgme_key_t key,
+                          const char* expire)
+{
+    struct step steps[RENEW_MAX_SUBKEYS + 4];
+    char selections[RENEW_MAX_SUBKEYS][16];
+    size_t count   = 0;
+    size_t subkeys = 0;
+
+    for (gpgme_subkey_t subkey = key->subkeys->next; subkey;
+         subkey                = subkey->next) {
+        if (subkeys == RENEW_MAX_SUBKEYS) {
+            log_error("Masterkey %s has too many subkeys.\n", key->fpr);
+            return 1;
+        }
+        snprintf(selections[subkeys], sizeof(selections[subkeys]), "key %zu",
+                 subkeys + 1);
+        steps[count++] = (struct step){"keyedit.prompt", selections[subkeys]};
+        subkeys++;
+    }
+
+    if (!subkeys) {
+        log_error("Masterkey %s has no subkey.\n", key->fpr);
+        return 1;
+    }
+
+    steps[count++] = (struct step){"keyedit.prompt", "expire"};
+    if (subkeys > 1)
+        steps[count++] =
+            (struct step){"keyedit.expire_multiple_subkeys.okay", "y"};
+    steps[count++] = (struct step){"keygen.valid", expire};
+    steps[count++] = (struct step){"keyedit.prompt", "save"};
+
+    return edit_masterkey(context, key->fpr, steps, count);
+}
+
+static int renew_masterkey(struct gpgme_context* context,
+                           const struct renewal* config,
+                           struct renewal_job* job)
+{
+    int err;
+    gpgme_key_t key   = NULL;
+    gpgme_data_t data = NULL;
+
+    if ((err = import_masterkey(context, config->vault, job->fpr)))
+        return err;
+
+    if ((err = gpgme_get_key(context, job->fpr, &key, 0))) {
+        log_error("Failed to find masterkey %s.\n", job->fpr);
+        return err;
+    }
+
+    snprintf(job->user, sizeof(job->user), "%s", key_username(key));
+    audit_subject(job->user, job->fpr, NULL);
+    log_debug("Renewing subkeys of %s (%s).\n", job->user, job->fpr);
+
+    if ((err = expire_subkeys(context, key, config->expire)))
+        goto cleanup;
+
+    if ((err = gpgme_data_new(&data))) {
+        log_error("Failed to create new data.\n");
+        goto cleanup;
+    }
+
+    if ((err = gpgme_op_export(context, job->fpr, 0, data))) {
+        log_error("Failed to export %s. %s: %s\n", job->fpr,
+                  gpgme_strsource(err), gpgme_strerror(err));
+        goto cleanup;
+    }
+
+    job->exported = gpgme_data_release_and_get_mem(data, &job->exported_size);
+    data          = NULL;
+    if (!job->exported_size) {
+        log_error("Empty export of %s.\n", job->fpr);
+        err = 1;
+    }
+
+cleanup:
+    // Keep the worker keyring down to the key at hand
+    if (gpgme_op_delete_ext(context, key,
+                            GPGME_DELETE_ALLOW_SECRET | GPGME_DELETE_FORCE))
+        log_warning("Failed to remove %s from the worker keyring.\n",
+                    job->fpr);
+    gpgme_data_release(data);
+    gpgme_key_unref(key);
+
+    return err;
+}
+
+static struct renewal_job* next_job(struct renewal_pool* pool)
+{
+    struct renewal_job* job = NULL;
+
+    pthread_mutex_lock(&pool->mutex);
+    if (pool->next < pool->count)
+        job = &pool->jobs[pool->next++];
+    set_queue_depth(pool->count - pool->next);
+    pthread_mutex_unlock(&pool->mutex);
+
+    return job;
+}
+
+// A worker owns a keyring and its gpg-agent for the whole run, and renews
+// masterkeys until the pool is drained
+static void* renewal_worker(void* opaque)
+{
+    struct renewal_pool* pool     = (struct renewal_pool*)opaque;
+    struct gpgme_context* context = NULL;
+    struct renewal_job* job;
+    struct phase_span span;
+    char homedir[256];
+
+    // Each worker gets its own lane in the trace
+    pthread_mutex_lock(&pool->mutex);
+    trace_reader(pool->workers++);
+    pthread_mutex_unlock(&pool->mutex);
+
+    if (!mk_tmpdir(homedir, sizeof(homedir))) {
+        log_error("Failed to create worker keyring.\n");
+        return NULL;
+    }
+
+    if (!setup_homedir(&context, homedir) &&
+        !set_passphrase(homedir, pool->config->passphrase)) {
+        gpgme_set_armor(context, 0);
+        while ((job = next_job(pool))) {
+            audit_subject(NULL, job->fpr, NULL);
+            trace_card(job->fpr);
+            phase_begin(&span, PHASE_RENEW);
+            job->err = phase_end(&span,
+                                 renew_masterkey(context, pool->config, job));
+            audit_clear();
+            if (pool->config->metrics)
+                write_metrics(pool->config->metrics);
+        }
+    }
+
+    gpgme_release(context);
+    const char* kill_agent[] = {"gpgconf", "--homedir", homedir, "--kill",
+                                "gpg-agent", NULL};
+    run_command(kill_agent, 1);
+    rm_tmpdir(homedir);
+
+    return NULL;
+}
+
+static int write_bundle(const char* output,
+                        const struct renewal_job* jobs,
+                        size_t count)
+{
+    FILE* file = fopen(output, "w");
+    if (!file) {
+        log_error("Failed to open \"%s\": %s\n", output, strerror(errno));
+        return 1;
+    }
+
+    int err = 0;
+    for (size_t i = 0; i < count && !err; ++i)
+        if (!jobs[i].err && fwrite(jobs[i].exported, 1, jobs[i].exported_size,
+                                   file) != jobs[i].exported_size)
+            err = 1;
+
+    if (fclose(file) || err) {
+        log_error("Failed to write \"%s\": %s\n", output, strerror(errno));
+        return 1;
+    }
+
+    return 0;
+}
+
+int renew(const struct renewal* config,
+          const char** patterns,
+          const char* output)
+{
+    int err;
+    struct renewal_pool pool = {
+        config, NULL, 0, 0, 0, PTHREAD_MUTEX_INITIALIZER,
+    };
+
+    if (!config->vault || !config->expire || !config->passphrase) {
+        log_error("Renewal requires a vault, an expiration and a "
+                  "passphrase.\n");
+        return 1;
+    }
+
+    if ((err = check_gpgme()) != 0)
+        return err;
+
+    if ((err = vault_scan(config->vault, patterns, &pool.jobs, &pool.count)))
+        return err;
+
+    if (!pool.count) {
+        log_error("No masterkey to renew in \"%s\".\n", config->vault);
+        free(pool.jobs);
+        return 1;
+    }
+
+    // Jobs no worker got to are failures
+    for (size_t i = 0; i < pool.count; ++i)
+        pool.jobs[i].err = 1;
+
+    size_t workers = config->workers;
+    if (!workers) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        workers   = cpus > 0 ? (size_t)cpus : 1;
+    }
+    if (workers > pool.count)
+        workers = pool.count;
+
+    log_info("Renewing %zu masterkeys with %zu workers...\n", pool.count,
+             workers);
+    set_queue_depth(pool.count);
+
+    pthread_t* threads = (pthread_t*)calloc(workers, sizeof(pthread_t));
+    int* started       = (int*)calloc(workers, sizeof(int));
+    if (!threads || !started) {
+        err = 1;
+        goto cleanup;
+    }
+
+    for (size_t i = 0; i < workers; ++i)
+        started[i] = !pthread_create(&threads[i], NULL, renewal_worker, &pool);
+    for (size_t i = 0; i < workers; ++i)
+        if (started[i])
+            pthread_join(threads[i], NULL);
+
+    size_t renewed = 0;
+    for (size_t i = 0; i < pool.count; ++i)
+        renewed += !pool.jobs[i].err;
+
+    log_info("Renewed %zu masterkeys out of %zu (%zu failed).\n", renewed,
+             pool.count, pool.count - renewed);
+
+    if (renewed && write_bundle(output, pool.jobs, pool.count))
+        err = 1;
+    else if (renewed != pool.count)
+        err = 1;
+
+cleanup:
+    for (size_t i = 0; i < pool.count; ++i)
+        gpgme_free(pool.jobs[i].exported);
+    free(pool.jobs);
+    free(started);
+    free(threads);
+
+    return err;
+}
@@ -20,36 +20,125 @@ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 SOFTWARE.
 */
 #include <yubimgr/yubimgr.h>
+#include <yubimgr/card.h>
 #include <yubimgr/logging.h>
 
+#include "apdu.h"
+#include "audit_log.h"
+#include "deadline.h"
+#include "phase.h"
+#include "simulation.h"
+#include "trace_events.h"
+
 #include <stdio.h>
 
+static const unsigned char openpgp_aid[] = {0xD2, 0x76, 0x00, 0x01, 0x24, 0x01};
+
+int select_openpgp(struct card_session* session)
+{
+    int err;
+    unsigned int sw;
+    unsigned char apdu[APDU_MAX_SIZE];
+
+    size_t size = apdu_build(apdu, 0x00, 0xA4, 0x04, 0x00, openpgp_aid,
+                             sizeof(openpgp_aid));
+    if ((err = card_apdu(session, apdu, size, &sw)))
+        return err;
+
+    if (sw != SW_OK) {
+        log_error("Failed to select OpenPGP applet (%04X).\n", sw);
+        return 1;
+    }
+
+    return 0;
+}
+
+static int block_password(struct card_session* session, unsigned char pw)
+{
+    int err;
+    unsigned int sw = 0;
+    unsigned char apdu[APDU_MAX_SIZE];
+    static const unsigned char wrong_pin[8] = {0x40, 0x40, 0x40, 0x40,
+                                               0x40, 0x40, 0x40, 0x40};
+
+    size_t size =
+        apdu_build(apdu, 0x00, 0x20, 0x00, pw, wrong_pin, sizeof(wrong_pin));
+
+    // Retry counters never go above 255
+    for (int i = 0; i < 256; ++i) {
+        if ((err = card_apdu(session, apdu, size, &sw)))
+            return err;
+        if (!card_pin_retry(sw))
+            break;
+    }
+
+    if (sw != SW_AUTH_BLOCKED) {
+        log_error("Failed to block PW%d (%04X).\n", pw - 0x80, sw);
+        return 1;
+    }
+
+    return 0;
+}
+
+int reset_session(struct card_session* session)
+{
+    int err;
+    unsigned int sw;
+    static const unsigned char terminate[] = {0x00, 0xE6, 0x00, 0x00};
+    static const unsigned char activate[]  = {0x00, 0x44, 0x00, 0x00};
+
+    // The applet can only be terminated once both PW1 and PW3 are blocked
+    if ((err = select_openpgp(session)) ||
+        (err = block_password(session, 0x81)) ||
+        (err = block_password(session, 0x83)))
+        return err;
+
+    if ((err = card_apdu(session, terminate, sizeof(terminate), &sw)))
+        return err;
+    if (sw != SW_OK) {
+        log_error("Failed to terminate OpenPGP applet (%04X).\n", sw);
+        return 1;
+    }
+
+    if ((err = card_command(session, "SCD RESET")) ||
+        (err = card_command(session, "SCD SERIALNO undefined")) ||
+        (err = select_openpgp(session)))
+        return err;
+
+    if ((err = card_apdu(session, activate, sizeof(activate), &sw)))
+        return err;
+    if (sw != SW_OK) {
+        log_error("Failed to activate OpenPGP applet (%04X).\n", sw);
+        return 1;
+    }
+
+    return 0;
+}
+
 int reset()
 {
-    FILE* in;
-
-    static const char* commands =
-        "scd reset\n"
-        "scd serialno undefined\n"
-        "scd apdu 00 A4 04 00 06 D2 76 00 01 24 01\n"
-        "scd apdu 00 20 00 81 08 40 40 40 40 40 40 40 40\n"
-        "scd apdu 00 20 00 81 08 40 40 40 40 40 40 40 40\n"
-        "scd apdu 00 20 00 81 08 40 40 40 40 40 40 40 40\n"
-        "scd apdu 00 20 00 81 08 40 40 40 40 40 40 40 40\n"
-        "scd apdu 00 20 00 83 08 40 40 40 40 40 40 40 40\n"
-        "scd apdu 00 20 00 83 08 40 40 40 40 40 40 40 40\n"
-        "scd apdu 00 20 00 83 08 40 40 40 40 40 40 40 40\n"
-        "scd apdu 00 20 00 83 08 40 40 40 40 40 40 40 40\n"
-        "scd apdu 00 e6 00 00\n"
-        "scd reset\n"
-        "scd serialno undefined\n"
-        "scd apdu 00 A4 04 00 06 D2 76 00 01 24 01\n"
-        "scd apdu 00 44 00 00\n"
-        "/bye\n";
-
-    in = popen("gpg-connect-agent >/dev/null", "w");
-    fputs(commands, in);
-    int err = pclose(in);
+    struct card_session* session;
+    struct phase_span span;
+    int attempt = 0;
+    int err;
+
+    trace_card("reset");
+
+    // A reset restarts from scratch, transient card errors can be retried
+    phase_begin(&span, PHASE_RESET);
+    do {
+        if (simulating())
+            err = simulate_phase(PHASE_RESET);
+        else if (!(err = card_open(&session))) {
+            err = reset_session(session);
+            card_close(session);
+        }
+    } while (card_transient(err) && !retry_backoff(&attempt));
+    phase_end(&span, err);
+    audit_clear();
+
+    metrics_increment(COUNTER_RESET_CARDS);
+    metrics_increment(err ? COUNTER_RESET_FAILURE : COUNTER_RESET_SUCCESS);
 
     if (!err)
         log_info("Successfully reset the smartcard.\n");
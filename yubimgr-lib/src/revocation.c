@@ -0,0 +1,436 @@
+/*
+Copyright (C) 2016 Aurelien Vallee
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <yubimgr/revocation.h>
+#include <yubimgr/logging.h>
+
+#include "audit_log.h"
+#include "bootstrap.h"
+#include "file.h"
+#include "index.h"
+#include "keylist.h"
+#include "phase.h"
+#include "revocation_store.h"
+#include "string_table.h"
+
+#include <gpgme.h>
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+static const char* _store;
+
+void set_revocation_store(const char* path)
+{
+    _store = path;
+}
+
+static int is_hex(const char* s, size_t size)
+{
+    for (size_t i = 0; i < size; ++i)
+        if (!isxdigit((unsigned char)s[i]))
+            return 0;
+    return s[size] == 0;
+}
+
+int revocation_key(const char* query, char* key, size_t size)
+{
+    char normalized[INDEX_KEY_SIZE];
+    const char* prefix;
+    size_t length;
+
+    if (strchr(query, '@')) {
+        prefix = "email:";
+        for (length = 0; query[length] && length < sizeof(normalized) - 1;
+             ++length)
+            normalized[length] = tolower((unsigned char)query[length]);
+        normalized[length] = 0;
+    } else {
+        if (!strncmp(query, "0x", 2) || !strncmp(query, "0X", 2))
+            query += 2;
+
+        length = strlen(query);
+        if (length == 40 && is_hex(query, length)) {
+            prefix = "fpr:";
+        } else if (length && length <= 8 && is_hex(query, length)) {
+            // Card serials are printed without their leading zeros
+            prefix = "serial:";
+            while (*query == '0' && query[1])
+                query++;
+        } else {
+            return 1;
+        }
+
+        for (length = 0; query[length]; ++length)
+            normalized[length] = toupper((unsigned char)query[length]);
+        normalized[length] = 0;
+    }
+
+    return snprintf(key, size, "%s%s", prefix, normalized) >= (int)size;
+}
+
+static int index_revocation(const char* fpr,
+                            const char* email,
+                            const char* serial)
+{
+    int err = 0;
+    char path[1024];
+    char key[INDEX_KEY_SIZE];
+    struct index* index;
+
+    snprintf(path, sizeof(path), "%s/index", _store);
+    if (index_open(&index, path, 1))
+        return 1;
+
+    if (!revocation_key(fpr, key, sizeof(key)))
+        err |= index_put(index, key, fpr);
+    if (email && *email && !revocation_key(email, key, sizeof(key)))
+        err |= index_put(index, key, fpr);
+    if (*serial && !revocation_key(serial, key, sizeof(key)))
+        err |= index_put(index, key, fpr);
+
+    index_close(index);
+
+    return err;
+}
+
+int store_revocation(struct gpgme_context* context,
+                     const char* temporary_keyring,
+                     const char* email,
+                     const char* fpr,
+                     const char* serial)
+{
+    int err;
+    char path[1024];
+    char tmp_path[1040];
+    size_t size;
+    gpgme_data_t data = NULL;
+    char* public_key  = NULL;
+    size_t public_key_size;
+
+    if (!_store) {
+        log_warning("No revocation store set, skipping revocation.\n");
+        return 0;
+    }
+
+    log_info("Storing revocation certificate...\n");
+
+    if (mkdir(_store, 0700) && errno != EEXIST) {
+        log_error("Failed to create \"%s\": %s\n", _store, strerror(errno));
+        return 1;
+    }
+
+    // gpg writes a revocation certificate along with every new key
+    snprintf(path, sizeof(path), "%s/openpgp-revocs.d/%s.rev",
+             temporary_keyring, fpr);
+    char* certificate = read_file(path, &size);
+    if (!certificate)
+        return 1;
+
+    // Its armor header is escaped against accidental imports
+    char* armor = strstr(certificate, "\n:-----BEGIN");
+    if (armor)
+        armor[1] = '\n';
+
+    // The public key is stored too, so that revocations can be imported in
+    // keyrings missing the key
+    if ((err = gpgme_data_new(&data))) {
+        log_error("Failed to create new data.\n");
+        goto cleanup;
+    }
+
+    gpgme_set_armor(context, 1);
+    if ((err = gpgme_op_export(context, fpr, 0, data))) {
+        log_error("Failed to export public key. %s: %s\n",
+                  gpgme_strsource(err), gpgme_strerror(err));
+        goto cleanup;
+    }
+    public_key = gpgme_data_release_and_get_mem(data, &public_key_size);
+    data       = NULL;
+
+    snprintf(path, sizeof(path), "%s/%s.rev", _store, fpr);
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    FILE* file = fopen(tmp_path, "w");
+    if (!file) {
+        log_error("Failed to open \"%s\": %s\n", tmp_path, strerror(errno));
+        err = 1;
+        goto cleanup;
+    }
+    fwrite(public_key, 1, public_key_size, file);
+    fwrite(certificate, 1, size, file);
+    if (fclose(file) || rename(tmp_path, path)) {
+        log_error("Failed to write \"%s\": %s\n", path, strerror(errno));
+        err = 1;
+        goto cleanup;
+    }
+
+    if ((err = index_revocation(fpr, email, serial)))
+        goto cleanup;
+
+    log_info("Stored revocation certificate for %s.\n", fpr);
+
+cleanup:
+    gpgme_data_release(data);
+    gpgme_free(public_key);
+    free(certificate);
+
+    return err;
+}
+
+// Looks every query up and concatenates the matching certificates. Returns
+// the number of queries without certificate.
+static size_t collect_revocations(const char** queries,
+                                  size_t query_count,
+                                  gpgme_data_t certificates,
+                                  char (*fprs)[41],
+                                  size_t* count)
+{
+    char path[1024];
+    char key[INDEX_KEY_SIZE];
+    struct index* index;
+    struct string_table collected;
+    size_t missing = 0;
+    size_t found;
+
+    *count = 0;
+
+    snprintf(path, sizeof(path), "%s/index", _store);
+    if (index_open(&index, path, 0))
+        return 1;
+
+    if (string_table_init(&collected, query_count)) {
+        string_table_release(&collected);
+        index_close(index);
+        return 1;
+    }
+
+    for (const char** query = queries; *query; ++query) {
+        const char* fpr = NULL;
+        if (!revocation_key(*query, key, sizeof(key)))
+            fpr = index_get(index, key);
+        if (!fpr) {
+            log_error("No revocation certificate for \"%s\".\n", *query);
+            missing++;
+            continue;
+        }
+
+        // The same key may be designated by several queries
+        if (string_table_find(&collected, fpr, &found))
+            continue;
+
+        size_t size;
+        snprintf(path, sizeof(path), "%s/%s.rev", _store, fpr);
+        char* certificate = read_file(path, &size);
+        if (!certificate) {
+            missing++;
+            continue;
+        }
+
+        log_debug("Revoking %s (\"%s\").\n", fpr, *query);
+        gpgme_data_write(certificates, certificate, size);
+        free(certificate);
+        snprintf(fprs[*count], 41, "%s", fpr);
+        string_table_insert(&collected, fprs[*count], *count);
+        (*count)++;
+    }
+
+    string_table_release(&collected);
+    index_close(index);
+
+    return missing;
+}
+
+static int export_revoked(struct gpgme_context* context,
+                          char (*fprs)[41],
+                          size_t count,
+                          const char* output,
+                          int publish)
+{
+    int err = 0;
+    gpgme_data_t data = NULL;
+    FILE* file        = NULL;
+    size_t failed     = 0;
+
+    // keys is the export list, owners maps every fingerprint to its key
+    gpgme_key_t* keys   = (gpgme_key_t*)calloc(count + 1, sizeof(gpgme_key_t));
+    gpgme_key_t* owners = (gpgme_key_t*)calloc(count, sizeof(gpgme_key_t));
+    if (!keys || !owners) {
+        free(keys);
+        free(owners);
+        return 1;
+    }
+
+    // A key the import did not leave revoked is a failed revocation
+    size_t found = 0;
+    for (size_t i = 0; i < count; ++i) {
+        if (gpgme_get_key(context, fprs[i], &owners[i], 0)) {
+            log_error("Key %s is not in the keyring.\n", fprs[i]);
+            owners[i] = NULL;
+            failed++;
+            continue;
+        }
+        if (!owners[i]->revoked) {
+            log_error("Key %s is still not revoked.\n", fprs[i]);
+            failed++;
+        }
+        keys[found++] = owners[i];
+    }
+
+    if (!found) {
+        err = 1;
+        goto cleanup;
+    }
+
+    if (output) {
+        if ((err = gpgme_data_new(&data))) {
+            log_error("Failed to create new data.\n");
+            goto cleanup;
+        }
+
+        gpgme_set_armor(context, 1);
+        if ((err = gpgme_op_export_keys(context, keys, 0, data))) {
+            log_error("Failed to export revoked keys. %s: %s\n",
+                      gpgme_strsource(err), gpgme_strerror(err));
+            goto cleanup;
+        }
+
+        size_t size;
+        char* buffer = gpgme_data_release_and_get_mem(data, &size);
+        data         = NULL;
+        if (!(file = fopen(output, "w")) ||
+            fwrite(buffer, 1, size, file) != size) {
+            log_error("Failed to write \"%s\": %s\n", output,
+                      strerror(errno));
+            err = 1;
+        }
+        gpgme_free(buffer);
+        if (err)
+            goto cleanup;
+    }
+
+    // All keys go to the keyservers in a single dirmngr request
+    if (publish &&
+        (err = gpgme_op_export_keys(context, keys, GPGME_EXPORT_MODE_EXTERN,
+                                    NULL))) {
+        log_error("Failed to publish revoked keys. %s: %s\n",
+                  gpgme_strsource(err), gpgme_strerror(err));
+        goto cleanup;
+    }
+
+cleanup:
+    if (file && fclose(file))
+        err = err ? err : 1;
+
+    // Every key is audited with its own outcome, under its owner when it
+    // is known. A failed export or publication fails them all.
+    for (size_t i = 0; i < count; ++i) {
+        int revoked = owners[i] && owners[i]->revoked;
+        audit_event(PHASE_REVOKE, err || !revoked,
+                    owners[i] ? key_username(owners[i]) : NULL, fprs[i],
+                    NULL);
+    }
+
+    gpgme_data_release(data);
+    for (size_t i = 0; i < found; ++i)
+        gpgme_key_unref(keys[i]);
+    free(keys);
+    free(owners);
+
+    return err || failed;
+}
+
+static int revoke_from_store(const char** queries,
+                             const char* output,
+                             int publish)
+{
+    int err;
+    size_t count                  = 0;
+    struct gpgme_context* context = NULL;
+    gpgme_data_t certificates     = NULL;
+
+    if ((err = check_gpgme()) != 0)
+        return err;
+
+    if (!_store) {
+        log_error("No revocation store set.\n");
+        return 1;
+    }
+
+    size_t query_count = 0;
+    while (queries[query_count])
+        query_count++;
+
+    char (*fprs)[41] = (char (*)[41])calloc(query_count + 1, 41);
+    if (!fprs)
+        return 1;
+
+    if ((err = gpgme_data_new(&certificates))) {
+        log_error("Failed to create new data.\n");
+        goto cleanup;
+    }
+
+    size_t missing = collect_revocations(queries, query_count, certificates,
+                                         fprs, &count);
+    if (!count) {
+        err = 1;
+        goto cleanup;
+    }
+
+    // Every revocation is applied in a single import
+    if ((err = open_keyring(&context)))
+        goto cleanup;
+
+    gpgme_data_seek(certificates, 0, SEEK_SET);
+    if ((err = gpgme_op_import(context, certificates))) {
+        log_error("Failed to import revocations. %s: %s\n",
+                  gpgme_strsource(err), gpgme_strerror(err));
+        goto cleanup;
+    }
+
+    gpgme_import_result_t result = gpgme_op_import_result(context);
+    if (result)
+        log_info("Imported %d new revocations for %zu keys.\n",
+                 result->new_revocations, count);
+
+    if ((err = export_revoked(context, fprs, count, output, publish)))
+        goto cleanup;
+
+    err = missing != 0;
+
+cleanup:
+    gpgme_data_release(certificates);
+    gpgme_release(context);
+    free(fprs);
+
+    return err;
+}
+
+int revoke_keys(const char** queries, const char* output, int publish)
+{
+    struct phase_span span;
+
+    phase_begin(&span, PHASE_REVOKE);
+    return phase_end(&span, revoke_from_store(queries, output, publish));
+}
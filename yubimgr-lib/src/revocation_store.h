@@ -0,0 +1,44 @@
+/*
+Copyright (C) 2016 Aurelien Vallee
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef YUBIMGR_REVOCATION_STORE_H
+#define YUBIMGR_REVOCATION_STORE_H
+
+#include <yubimgr/revocation.h>
+
+#include <gpgme.h>
+
+#include <stddef.h>
+
+// Saves the revocation certificate gpg generated along with the masterkey
+// in the revocation store, indexed by card serial too unless it is empty.
+// Does nothing when no store is set.
+int store_revocation(struct gpgme_context* context,
+                     const char* temporary_keyring,
+                     const char* email,
+                     const char* fpr,
+                     const char* serial);
+
+// Normalizes a revocation store query into its index key:
+// "fpr:<FPR>", "email:<lowercase email>" or "serial:<serial>".
+int revocation_key(const char* query, char* key, size_t size);
+
+#endif  // YUBIMGR_REVOCATION_STORE_H
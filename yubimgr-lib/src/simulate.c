@@ -0,0 +1,289 @@
+/*
+Copyright (C) 2016 Aurelien Vallee
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <yubimgr/simulate.h>
+#include <yubimgr/logging.h>
+
+#include "deadline.h"
+#include "phase.h"
+#include "simulation.h"
+#include "trace_events.h"
+
+#include <gpgme.h>
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MODEL_MAX_BUCKETS 32
+
+// Phase duration histogram, as read back from a metrics file
+struct latency_model {
+    double bounds[MODEL_MAX_BUCKETS];
+    double cumulative[MODEL_MAX_BUCKETS];
+    size_t size;
+    double count;
+    double sum;
+    double failures;
+    int warned;
+};
+
+static struct latency_model _models[PHASE_COUNT];
+static int _simulating;
+static double _clock;
+static uint64_t _random_state;
+
+int simulating()
+{
+    return _simulating;
+}
+
+double simulation_clock()
+{
+    return _clock;
+}
+
+void simulation_sleep(double seconds)
+{
+    _clock += seconds;
+}
+
+// Uniform in [0, 1) (xorshift64*), seeded for reproducible runs
+static double simulation_random()
+{
+    _random_state ^= _random_state >> 12;
+    _random_state ^= _random_state << 25;
+    _random_state ^= _random_state >> 27;
+    return ((_random_state * 2685821657736338717ull) >> 11) * 0x1.0p-53;
+}
+
+// Inverse of the histogram CDF, interpolating linearly within buckets.
+// Samples past the last bound get the mean of the overflow.
+static double sample_duration(const struct latency_model* model)
+{
+    double target     = simulation_random() * model->count;
+    double lower      = 0;
+    double previous   = 0;
+    double finite_sum = 0;
+
+    for (size_t i = 0; i < model->size; ++i) {
+        double in_bucket = model->cumulative[i] - previous;
+        if (model->cumulative[i] > target)
+            return lower +
+                   (model->bounds[i] - lower) * (target - previous) / in_bucket;
+        finite_sum += in_bucket * (lower + model->bounds[i]) / 2;
+        lower    = model->bounds[i];
+        previous = model->cumulative[i];
+    }
+
+    double overflow = model->count - previous;
+    double mean     = overflow > 0 ? (model->sum - finite_sum) / overflow : 0;
+
+    return mean > lower ? mean : lower;
+}
+
+int simulate_phase(enum PHASE phase)
+{
+    struct latency_model* model = &_models[phase];
+
+    if (!model->count) {
+        if (!model->warned)
+            log_warning("No recorded timings for phase %s, assuming 0s.\n",
+                        phase_name(phase));
+        model->warned = 1;
+        return 0;
+    }
+
+    double duration = sample_duration(model);
+    double deadline = deadline_current();
+    if (deadline && _clock + duration >= deadline) {
+        _clock = deadline;
+        return gpgme_error(GPG_ERR_TIMEOUT);
+    }
+    _clock += duration;
+
+    if (simulation_random() * model->count < model->failures)
+        return gpgme_error(GPG_ERR_CARD);
+
+    return 0;
+}
+
+static struct latency_model* model_of(const char* name)
+{
+    enum PHASE phase;
+    return phase_parse(name, &phase) ? NULL : &_models[phase];
+}
+
+static int load_model(const char* path)
+{
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        log_error("Failed to open \"%s\": %s\n", path, strerror(errno));
+        return 1;
+    }
+
+    memset(_models, 0, sizeof(_models));
+
+    char line[512];
+    char name[64];
+    char bound[32];
+    double value;
+    size_t phases = 0;
+    while (fgets(line, sizeof(line), file)) {
+        struct latency_model* model;
+        if (sscanf(line,
+                   "yubimgr_phase_duration_seconds_bucket"
+                   "{phase=\"%63[^\"]\",le=\"%31[^\"]\"} %lf",
+                   name, bound, &value) == 3) {
+            // The +Inf bucket is the count
+            if ((model = model_of(name)) && strcmp(bound, "+Inf") &&
+                model->size < MODEL_MAX_BUCKETS) {
+                model->bounds[model->size]       = strtod(bound, NULL);
+                model->cumulative[model->size++] = value;
+            }
+        } else if (sscanf(line,
+                          "yubimgr_phase_duration_seconds_sum"
+                          "{phase=\"%63[^\"]\"} %lf",
+                          name, &value) == 2) {
+            if ((model = model_of(name)))
+                model->sum = value;
+        } else if (sscanf(line,
+                          "yubimgr_phase_duration_seconds_count"
+                          "{phase=\"%63[^\"]\"} %lf",
+                          name, &value) == 2) {
+            if ((model = model_of(name)) && (model->count = value) > 0)
+                phases++;
+        } else if (sscanf(line,
+                          "yubimgr_phase_failures_total"
+                          "{phase=\"%63[^\"]\"} %lf",
+                          name, &value) == 2) {
+            if ((model = model_of(name)))
+                model->failures = value;
+        }
+    }
+
+    fclose(file);
+
+    if (!phases) {
+        log_error("No phase timings found in \"%s\".\n", path);
+        return 1;
+    }
+
+    log_debug("Loaded latency model of %zu phases from \"%s\".\n", phases,
+              path);
+
+    return 0;
+}
+
+static int compare_double(const void* a, const void* b)
+{
+    double lhs = *(const double*)a;
+    double rhs = *(const double*)b;
+    return (lhs > rhs) - (lhs < rhs);
+}
+
+int simulate(const struct simulation* config,
+             int (*card)(void* opaque),
+             void* opaque,
+             struct simulation_report* report)
+{
+    memset(report, 0, sizeof(*report));
+    report->cards   = config->cards;
+    report->readers = config->readers;
+
+    if (!config->cards || !config->readers) {
+        log_error("Simulation needs at least one card and one reader.\n");
+        return 1;
+    }
+
+    if (!config->model || load_model(config->model))
+        return 1;
+
+    // Time at which every reader is done with its current card
+    double* free_at = (double*)calloc(config->readers, sizeof(double));
+    double* waits   = (double*)calloc(config->cards, sizeof(double));
+    if (!free_at || !waits) {
+        free(free_at);
+        free(waits);
+        return 1;
+    }
+
+    _random_state = config->seed ? config->seed : 1;
+    _simulating   = 1;
+
+    // The whole roster is queued at 0, each card goes to the first reader
+    // to free up. Cards do not interact, so they can run one after the
+    // other on the virtual clock.
+    double busy = 0;
+    for (size_t i = 0; i < config->cards; ++i) {
+        size_t reader = 0;
+        for (size_t r = 1; r < config->readers; ++r)
+            if (free_at[r] < free_at[reader])
+                reader = r;
+
+        _clock   = free_at[reader];
+        waits[i] = _clock;
+        log_debug("Simulating card %zu on reader %zu at %.1fs.\n", i + 1,
+                  reader + 1, _clock);
+
+        trace_reader(reader);
+        if (card(opaque))
+            report->failures++;
+
+        busy += _clock - free_at[reader];
+        free_at[reader] = _clock;
+        if (_clock > report->makespan)
+            report->makespan = _clock;
+    }
+
+    _simulating = 0;
+    trace_reader(0);
+
+    qsort(waits, config->cards, sizeof(double), compare_double);
+    for (size_t i = 0; i < config->cards; ++i)
+        report->mean_wait += waits[i] / config->cards;
+    report->p95_wait = waits[(config->cards - 1) * 95 / 100];
+    report->max_wait = waits[config->cards - 1];
+
+    if (report->makespan > 0) {
+        report->throughput  = config->cards * 3600 / report->makespan;
+        report->utilization = busy / (config->readers * report->makespan);
+    }
+
+    free(free_at);
+    free(waits);
+
+    return 0;
+}
+
+void write_simulation_report(const struct simulation_report* report,
+                             FILE* out)
+{
+    fprintf(out, "cards:              %zu (%zu failed)\n", report->cards,
+            report->failures);
+    fprintf(out, "readers:            %zu\n", report->readers);
+    fprintf(out, "makespan:           %.1fs\n", report->makespan);
+    fprintf(out, "throughput:         %.1f cards/hour\n", report->throughput);
+    fprintf(out, "reader utilization: %.1f%%\n", report->utilization * 100);
+    fprintf(out, "queue wait:         mean %.1fs, p95 %.1fs, max %.1fs\n",
+            report->mean_wait, report->p95_wait, report->max_wait);
+}
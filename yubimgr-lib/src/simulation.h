@@ -0,0 +1,43 @@
+/*
+Copyright (C) 2016 Aurelien Vallee
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef YUBIMGR_SIMULATION_H
+#define YUBIMGR_SIMULATION_H
+
+#include <yubimgr/simulate.h>
+#include <yubimgr/metrics.h>
+
+// Set while simulate() runs. Steps talking to a card or generating keys
+// call simulate_phase() instead.
+int simulating();
+
+// Virtual time in seconds, returned by monotonic_now() while simulating.
+double simulation_clock();
+
+void simulation_sleep(double seconds);
+
+// Advances the virtual clock by a duration drawn from the latency model of
+// phase, without going past the current deadline. Returns 0,
+// GPG_ERR_TIMEOUT once the deadline is reached, or GPG_ERR_CARD for a
+// failure drawn from the recorded failure rate.
+int simulate_phase(enum PHASE phase);
+
+#endif  // YUBIMGR_SIMULATION_H
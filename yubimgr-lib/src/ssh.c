@@ -0,0 +1,185 @@
+/*
+Copyright (C) 2016 Aurelien Vallee
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "ssh.h"
+#include "encoding.h"
+
+#include <yubimgr/logging.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+struct ssh_curve {
+    const char* name;
+    const char* key_type;
+    size_t oid_size;
+    const unsigned char oid[9];
+};
+
+static const struct ssh_curve ssh_curves[] = {
+    {"ed25519", "ssh-ed25519", 9,
+     {0x2b, 0x06, 0x01, 0x04, 0x01, 0xda, 0x47, 0x0f, 0x01}},
+    {"nistp256", "ecdsa-sha2-nistp256", 8,
+     {0x2a, 0x86, 0x48, 0xce, 0x3d, 0x03, 0x01, 0x07}},
+    {"nistp384", "ecdsa-sha2-nistp384", 5, {0x2b, 0x81, 0x04, 0x00, 0x22}},
+    {"nistp521", "ecdsa-sha2-nistp521", 5, {0x2b, 0x81, 0x04, 0x00, 0x23}},
+};
+
+struct ssh_blob {
+    unsigned char* data;
+    size_t size;
+};
+
+static void blob_put_u32(struct ssh_blob* blob, size_t value)
+{
+    blob->data[blob->size++] = (value >> 24) & 0xff;
+    blob->data[blob->size++] = (value >> 16) & 0xff;
+    blob->data[blob->size++] = (value >> 8) & 0xff;
+    blob->data[blob->size++] = value & 0xff;
+}
+
+static void blob_put_string(struct ssh_blob* blob,
+                            const void* data,
+                            size_t size)
+{
+    blob_put_u32(blob, size);
+    memcpy(blob->data + blob->size, data, size);
+    blob->size += size;
+}
+
+static void blob_put_mpint(struct ssh_blob* blob,
+                           const unsigned char* mpi,
+                           size_t size)
+{
+    while (size && !*mpi) {
+        ++mpi;
+        --size;
+    }
+
+    // Positive integers with the high bit set need a leading zero byte
+    int pad = size && (*mpi & 0x80);
+    blob_put_u32(blob, size + pad);
+    if (pad)
+        blob->data[blob->size++] = 0;
+    memcpy(blob->data + blob->size, mpi, size);
+    blob->size += size;
+}
+
+static const struct ssh_curve* find_curve(const struct openpgp_packet* packet,
+                                          size_t* offset)
+{
+    size_t off = *offset;
+
+    if (off >= packet->size)
+        return NULL;
+
+    size_t oid_size = packet->body[off++];
+    if (oid_size > packet->size - off)
+        return NULL;
+
+    for (size_t i = 0; i < sizeof(ssh_curves) / sizeof(ssh_curves[0]); ++i) {
+        if (ssh_curves[i].oid_size == oid_size &&
+            !memcmp(ssh_curves[i].oid, packet->body + off, oid_size)) {
+            *offset = off + oid_size;
+            return &ssh_curves[i];
+        }
+    }
+
+    return NULL;
+}
+
+char* ssh_format_key(const struct openpgp_packet* packet, const char* comment)
+{
+    const char* key_type = NULL;
+    struct ssh_blob blob = {0};
+
+    // version(1) creation time(4) algorithm(1)
+    if (packet->size < 6 || packet->body[0] != 4) {
+        log_error("Unsupported OpenPGP key packet version.\n");
+        return NULL;
+    }
+
+    // The blob can never be larger than the key material plus the headers
+    blob.data = (unsigned char*)malloc(packet->size + 64);
+    if (!blob.data)
+        return NULL;
+
+    size_t off = 6;
+    switch (packet->body[5]) {
+        case OPENPGP_ALGO_RSA:
+        case OPENPGP_ALGO_RSA_SIGN: {
+            const unsigned char *n, *e;
+            size_t n_size, e_size;
+            if (openpgp_read_mpi(packet, &off, &n, &n_size) ||
+                openpgp_read_mpi(packet, &off, &e, &e_size))
+                goto invalid;
+            key_type = "ssh-rsa";
+            blob_put_string(&blob, key_type, strlen(key_type));
+            blob_put_mpint(&blob, e, e_size);
+            blob_put_mpint(&blob, n, n_size);
+            break;
+        }
+        case OPENPGP_ALGO_ECDSA:
+        case OPENPGP_ALGO_EDDSA: {
+            const struct ssh_curve* curve = find_curve(packet, &off);
+            const unsigned char* q;
+            size_t q_size;
+            if (!curve || openpgp_read_mpi(packet, &off, &q, &q_size))
+                goto invalid;
+            key_type = curve->key_type;
+            blob_put_string(&blob, key_type, strlen(key_type));
+            if (packet->body[5] == OPENPGP_ALGO_EDDSA) {
+                // Native Ed25519 points are prefixed with 0x40
+                if (q_size != 33 || q[0] != 0x40)
+                    goto invalid;
+                blob_put_string(&blob, q + 1, 32);
+            } else {
+                blob_put_string(&blob, curve->name, strlen(curve->name));
+                blob_put_string(&blob, q, q_size);
+            }
+            break;
+        }
+        default:
+            log_error("Unsupported key algorithm %d for SSH export.\n",
+                      packet->body[5]);
+            free(blob.data);
+            return NULL;
+    }
+
+    size_t line_size =
+        strlen(key_type) + BASE64_SIZE(blob.size) + strlen(comment) + 3;
+    char* line = (char*)malloc(line_size);
+    if (line) {
+        char* p = line + sprintf(line, "%s ", key_type);
+        p += base64_encode(blob.data, blob.size, p);
+        sprintf(p, " %s\n", comment);
+    }
+
+    free(blob.data);
+
+    return line;
+
+invalid:
+    log_error("Malformed OpenPGP key material.\n");
+    free(blob.data);
+    return NULL;
+}
@@ -21,12 +21,21 @@ SOFTWARE.
 */
 #include <yubimgr/yubimgr.h>
 
-#include <stdio.h>
-#include <stdlib.h>
+#include "deadline.h"
+#include "phase.h"
+#include "trace_events.h"
 
 int status()
 {
-    int r = system("gpg --card-status");
+    struct phase_span span;
 
-    return r;
+    static const char* const card_status[] = {"gpg", "--card-status", NULL};
+
+    trace_card("status");
+
+    // gpg blocks for as long as a wedged scdaemon does
+    phase_begin(&span, PHASE_STATUS);
+    int r = run_command(card_status, 0);
+
+    return phase_end(&span, r);
 }
@@ -0,0 +1,80 @@
+/*
+Copyright (C) 2016 Aurelien Vallee
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "string_table.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+static uint32_t string_hash(const char* string)
+{
+    // FNV-1a
+    uint32_t h = 2166136261u;
+    while (*string)
+        h = (h ^ (unsigned char)*string++) * 16777619u;
+    return h;
+}
+
+int string_table_init(struct string_table* table, size_t count)
+{
+    size_t capacity = 16;
+    while (capacity < 2 * count)
+        capacity *= 2;
+
+    table->mask    = capacity - 1;
+    table->strings = (const char**)calloc(capacity, sizeof(const char*));
+    table->values  = (size_t*)calloc(capacity, sizeof(size_t));
+
+    return !table->strings || !table->values;
+}
+
+void string_table_release(struct string_table* table)
+{
+    free(table->strings);
+    free(table->values);
+}
+
+void string_table_insert(struct string_table* table,
+                         const char* string,
+                         size_t value)
+{
+    size_t i = string_hash(string) & table->mask;
+    while (table->strings[i])
+        i = (i + 1) & table->mask;
+    table->strings[i] = string;
+    table->values[i]  = value;
+}
+
+int string_table_find(const struct string_table* table,
+                      const char* string,
+                      size_t* value)
+{
+    size_t i = string_hash(string) & table->mask;
+    while (table->strings[i]) {
+        if (!strcmp(table->strings[i], string)) {
+            *value = table->values[i];
+            return 1;
+        }
+        i = (i + 1) & table->mask;
+    }
+    return 0;
+}
@@ -0,0 +1,50 @@
+/*
+Copyright (C) 2016 Aurelien Vallee
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef YUBIMGR_STRING_TABLE_H
+#define YUBIMGR_STRING_TABLE_H
+
+#include <stddef.h>
+
+// Open addressing table from strings (fingerprints, user names, index keys)
+// to a caller defined value, typically an array index, so that matching or
+// deduplicating stays linear. The strings are not copied.
+struct string_table {
+    const char** strings;
+    size_t* values;
+    size_t mask;
+};
+
+// Sizes the table for count strings.
+int string_table_init(struct string_table* table, size_t count);
+
+void string_table_release(struct string_table* table);
+
+void string_table_insert(struct string_table* table,
+                         const char* string,
+                         size_t value);
+
+// Returns 1 and sets value if string is in the table.
+int string_table_find(const struct string_table* table,
+                      const char* string,
+                      size_t* value);
+
+#endif  // YUBIMGR_STRING_TABLE_H
@@ -0,0 +1,250 @@
+/*
+Copyright (C) 2016 Aurelien Vallee
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <yubimgr/trace.h>
+#include <yubimgr/logging.h>
+
+#include "trace_events.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct trace_span {
+    enum PHASE phase;
+    int err;
+    size_t card;
+    double start;
+    double duration;
+};
+
+struct trace_card {
+    char label[64];
+    size_t reader;
+};
+
+static int _tracing;
+static pthread_mutex_t _mutex = PTHREAD_MUTEX_INITIALIZER;
+static size_t _next_card      = 1;
+
+static struct trace_span* _spans;
+static size_t _span_count;
+static size_t _span_capacity;
+
+// Indexed by card, card 0 holds the spans outside of any card
+static struct trace_card* _cards;
+static size_t _card_count;
+static size_t _card_capacity;
+
+static __thread size_t _card;
+static __thread size_t _reader;
+
+void start_trace()
+{
+    _tracing = 1;
+}
+
+void trace_reader(size_t reader)
+{
+    _reader = reader;
+}
+
+size_t trace_current_card()
+{
+    return _card;
+}
+
+// Makes room for element index of array, new elements are zeroed. Returns
+// the array, or NULL (array unchanged) on allocation failure.
+static void* reserve(void* array, size_t* capacity, size_t index, size_t size)
+{
+    if (index < *capacity)
+        return array;
+
+    size_t grown_capacity = *capacity ? *capacity : 256;
+    while (grown_capacity <= index)
+        grown_capacity *= 2;
+
+    char* grown = (char*)realloc(array, grown_capacity * size);
+    if (!grown)
+        return NULL;
+    memset(grown + *capacity * size, 0, (grown_capacity - *capacity) * size);
+    *capacity = grown_capacity;
+
+    return grown;
+}
+
+void trace_card(const char* label)
+{
+    _card = __atomic_fetch_add(&_next_card, 1, __ATOMIC_RELAXED);
+    if (!_tracing)
+        return;
+
+    pthread_mutex_lock(&_mutex);
+    struct trace_card* cards = (struct trace_card*)reserve(
+        _cards, &_card_capacity, _card, sizeof(struct trace_card));
+    if (cards) {
+        _cards = cards;
+        snprintf(_cards[_card].label, sizeof(_cards[_card].label), "%s",
+                 label ? label : "");
+        _cards[_card].reader = _reader;
+        if (_card >= _card_count)
+            _card_count = _card + 1;
+    }
+    pthread_mutex_unlock(&_mutex);
+}
+
+void trace_card_serial(const char* serial)
+{
+    if (!_tracing || !_card || !serial || !*serial)
+        return;
+
+    pthread_mutex_lock(&_mutex);
+    if (_card < _card_count && !strstr(_cards[_card].label, serial)) {
+        char* label   = _cards[_card].label;
+        size_t length = strlen(label);
+        snprintf(label + length, sizeof(_cards[_card].label) - length, "%s%s",
+                 length ? " " : "", serial);
+    }
+    pthread_mutex_unlock(&_mutex);
+}
+
+void trace_span(enum PHASE phase, double start, double duration, int err)
+{
+    if (!_tracing)
+        return;
+
+    pthread_mutex_lock(&_mutex);
+    struct trace_span* spans = (struct trace_span*)reserve(
+        _spans, &_span_capacity, _span_count, sizeof(struct trace_span));
+    if (spans) {
+        _spans                = spans;
+        _spans[_span_count++] =
+            (struct trace_span){phase, err, _card, start, duration};
+    }
+    pthread_mutex_unlock(&_mutex);
+}
+
+static void write_string(FILE* file, const char* s)
+{
+    fputc('"', file);
+    for (; *s; ++s) {
+        if (*s == '"' || *s == '\\')
+            fprintf(file, "\\%c", *s);
+        else if ((unsigned char)*s < 0x20)
+            fprintf(file, "\\u%04x", (unsigned char)*s);
+        else
+            fputc(*s, file);
+    }
+    fputc('"', file);
+}
+
+// Reader of a card, spans outside of any card go to the first reader
+static size_t card_reader(size_t card)
+{
+    return card && card < _card_count ? _cards[card].reader : 0;
+}
+
+// Events are separated by commas, JSON has no trailing one
+static void next_event(FILE* file, int* first)
+{
+    fputs(*first ? "\n" : ",\n", file);
+    *first = 0;
+}
+
+static void write_events(FILE* file)
+{
+    double origin  = 0;
+    size_t readers = 1;
+    int first      = 1;
+
+    for (size_t i = 0; i < _span_count; ++i)
+        if (!i || _spans[i].start < origin)
+            origin = _spans[i].start;
+    for (size_t i = 1; i < _card_count; ++i)
+        if (_cards[i].reader + 1 > readers)
+            readers = _cards[i].reader + 1;
+
+    fputs("{\"traceEvents\":[", file);
+
+    // Names of the lanes: readers are processes, cards their threads
+    for (size_t reader = 0; reader < readers; ++reader) {
+        next_event(file, &first);
+        fprintf(file,
+                "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%zu,"
+                "\"args\":{\"name\":\"reader %zu\"}}",
+                reader + 1, reader + 1);
+    }
+    for (size_t card = 0; card < _card_count || !card; ++card) {
+        next_event(file, &first);
+        fprintf(file,
+                "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%zu,"
+                "\"tid\":%zu,\"args\":{\"name\":",
+                card_reader(card) + 1, card);
+        write_string(file, card && *_cards[card].label ? _cards[card].label
+                                                       : "host");
+        fputs("}}", file);
+    }
+
+    for (size_t i = 0; i < _span_count; ++i) {
+        const struct trace_span* span = &_spans[i];
+        next_event(file, &first);
+        fprintf(file,
+                "{\"name\":\"%s\",\"cat\":\"phase\",\"ph\":\"X\","
+                "\"ts\":%.0f,\"dur\":%.0f,\"pid\":%zu,\"tid\":%zu,"
+                "\"args\":{\"err\":%d}}",
+                phase_name(span->phase), (span->start - origin) * 1e6,
+                span->duration * 1e6, card_reader(span->card) + 1,
+                span->card, span->err);
+    }
+
+    fputs("\n],\"displayTimeUnit\":\"ms\"}\n", file);
+}
+
+int write_trace(const char* path)
+{
+    char tmp_path[1024];
+
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    FILE* file = fopen(tmp_path, "w");
+    if (!file) {
+        log_error("Failed to open \"%s\": %s\n", tmp_path, strerror(errno));
+        return 1;
+    }
+
+    pthread_mutex_lock(&_mutex);
+    write_events(file);
+    size_t count = _span_count;
+    pthread_mutex_unlock(&_mutex);
+
+    if (fclose(file) || rename(tmp_path, path)) {
+        log_error("Failed to write trace to \"%s\": %s\n", path,
+                  strerror(errno));
+        remove(tmp_path);
+        return 1;
+    }
+
+    log_debug("Wrote %zu trace spans to \"%s\".\n", count, path);
+
+    return 0;
+}
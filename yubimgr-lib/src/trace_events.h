@@ -0,0 +1,48 @@
+/*
+Copyright (C) 2016 Aurelien Vallee
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef YUBIMGR_TRACE_EVENTS_H
+#define YUBIMGR_TRACE_EVENTS_H
+
+#include <yubimgr/trace.h>
+#include <yubimgr/metrics.h>
+
+#include <stddef.h>
+
+// Starts a new card (or unit of work, e.g. a renewed key) on the current
+// thread, named label in the trace. The spans of the thread belong to it
+// from then on.
+void trace_card(const char* label);
+
+// Appends the serial of the card, once known, to the label of the current
+// card. A serial already in the label is not repeated.
+void trace_card_serial(const char* serial);
+
+// Sets the reader the next cards of the current thread are provisioned on
+void trace_reader(size_t reader);
+
+// Card of the current thread, 0 before the first trace_card()
+size_t trace_current_card();
+
+// Records a phase of the current card, times from monotonic_now()
+void trace_span(enum PHASE phase, double start, double duration, int err);
+
+#endif  // YUBIMGR_TRACE_EVENTS_H
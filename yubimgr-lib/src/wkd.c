@@ -0,0 +1,249 @@
+/*
+Copyright (C) 2016 Aurelien Vallee
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <yubimgr/logging.h>
+
+#include "openpgp.h"
+#include "wkd.h"
+
+#include <gcrypt.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// tolower() depends on the locale, addresses are folded as plain ASCII
+static char ascii_lower(char c)
+{
+    return c >= 'A' && c <= 'Z' ? (char)(c - 'A' + 'a') : c;
+}
+
+static int wkd_compare(const void* a, const void* b)
+{
+    const struct wkd_entry* lhs = (const struct wkd_entry*)a;
+    const struct wkd_entry* rhs = (const struct wkd_entry*)b;
+
+    int cmp = strcmp(lhs->domain, rhs->domain);
+    if (!cmp)
+        cmp = strcmp(lhs->hash, rhs->hash);
+    if (!cmp)
+        cmp = (lhs->key > rhs->key) - (lhs->key < rhs->key);
+    return cmp;
+}
+
+int wkd_entry_init(struct wkd_entry* entry, const char* email)
+{
+    const char* at = email ? strrchr(email, '@') : NULL;
+    if (!at || at == email || !at[1] || strlen(at + 1) >= sizeof(entry->domain))
+        return 1;
+
+    for (size_t i = 0; at[i + 1]; ++i)
+        entry->domain[i] = ascii_lower(at[i + 1]);
+    entry->domain[strlen(at + 1)] = 0;
+    if (entry->domain[0] == '.' || strchr(entry->domain, '/'))
+        return 1;
+
+    // Only ASCII is mapped to lower case, as per the WKD draft
+    size_t size = at - email;
+    char* local = (char*)malloc(size);
+    if (!local)
+        return 1;
+    for (size_t i = 0; i < size; ++i)
+        local[i] = ascii_lower(email[i]);
+
+    unsigned char digest[20];
+    gcry_md_hash_buffer(GCRY_MD_SHA1, digest, local, size);
+    zbase32_encode(digest, sizeof(digest), entry->hash);
+    free(local);
+
+    return 0;
+}
+
+int make_dir(const char* path, mode_t mode)
+{
+    if (mkdir(path, mode) && errno != EEXIST) {
+        log_error("Failed to create \"%s\": %s\n", path, strerror(errno));
+        return 1;
+    }
+    return 0;
+}
+
+// Returns 1 if the file at path already holds exactly data
+static int same_content(const char* path, const char* data, size_t size)
+{
+    struct stat st;
+    if (stat(path, &st) || (size_t)st.st_size != size)
+        return 0;
+
+    FILE* file = fopen(path, "r");
+    if (!file)
+        return 0;
+
+    char buffer[4096];
+    size_t offset = 0;
+    size_t read;
+    int same = 1;
+    while (same && (read = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        same = offset + read <= size && !memcmp(buffer, data + offset, read);
+        offset += read;
+    }
+    fclose(file);
+
+    return same && offset == size;
+}
+
+int write_if_changed(const char* path, const char* data, size_t size)
+{
+    char tmp_path[1024];
+
+    if (same_content(path, data, size))
+        return -1;
+
+    // Write aside and rename, so that web servers never see a partial key
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    FILE* file = fopen(tmp_path, "w");
+    if (!file) {
+        log_error("Failed to open \"%s\": %s\n", tmp_path, strerror(errno));
+        return 1;
+    }
+
+    size_t written = fwrite(data, 1, size, file);
+    if (fclose(file) || written != size || rename(tmp_path, path)) {
+        log_error("Failed to write \"%s\": %s\n", path, strerror(errno));
+        remove(tmp_path);
+        return 1;
+    }
+
+    log_trace("Wrote \"%s\".\n", path);
+
+    return 0;
+}
+
+int split_keys(const unsigned char* buffer,
+               size_t size,
+               const struct string_table* table,
+               struct key_block* blocks,
+               size_t count)
+{
+    int err;
+    size_t current = count;
+    size_t offset  = 0;
+    size_t start   = 0;
+    struct openpgp_packet packet;
+
+    while (!(err = openpgp_next_packet(buffer, size, &offset, &packet))) {
+        if (packet.tag == OPENPGP_TAG_PUBLIC_KEY) {
+            if (current < count)
+                blocks[current].end = start;
+
+            char fpr[41];
+            if (openpgp_fingerprint(&packet, fpr) ||
+                !string_table_find(table, fpr, &current))
+                current = count;
+            else
+                blocks[current].start = start;
+        }
+        start = offset;
+    }
+
+    if (current < count)
+        blocks[current].end = start;
+
+    // The packet loop ends with -1 on a clean end of stream
+    return err < 0 ? 0 : err;
+}
+
+int wkd_publish(const char* output_dir,
+                const char* buffer,
+                const struct key_block* blocks,
+                struct wkd_entry* entries,
+                size_t entries_count,
+                size_t* updated,
+                size_t* unchanged)
+{
+    int err    = 0;
+    char* file = NULL;
+
+    // Sorting brings together every key published under the same address,
+    // and every address of the same domain
+    qsort(entries, entries_count, sizeof(struct wkd_entry), wkd_compare);
+
+    char path[1024];
+    const char* domain = "";
+    for (size_t i = 0; i < entries_count && !err; ++i) {
+        if (strcmp(entries[i].domain, domain)) {
+            domain = entries[i].domain;
+            snprintf(path, sizeof(path), "%s/%s", output_dir, domain);
+            if (make_dir(path, 0755))
+                err = 1;
+            snprintf(path, sizeof(path), "%s/%s/hu", output_dir, domain);
+            if (!err && make_dir(path, 0755))
+                err = 1;
+            snprintf(path, sizeof(path), "%s/%s/policy", output_dir, domain);
+            if (!err && write_if_changed(path, "", 0) > 0)
+                err = 1;
+        }
+
+        // Concatenate every key of the address into a single file
+        size_t j    = i;
+        size_t size = 0;
+        for (; j < entries_count && !strcmp(entries[j].domain, domain) &&
+               !strcmp(entries[j].hash, entries[i].hash);
+             ++j)
+            if (j == i || entries[j].key != entries[j - 1].key)
+                size += blocks[entries[j].key].end -
+                        blocks[entries[j].key].start;
+
+        char* merged = (char*)realloc(file, size);
+        if (!merged) {
+            err = 1;
+            break;
+        }
+        file = merged;
+
+        size_t offset = 0;
+        for (size_t k = i; k < j; ++k) {
+            if (k > i && entries[k].key == entries[k - 1].key)
+                continue;
+            const struct key_block* block = &blocks[entries[k].key];
+            memcpy(file + offset, buffer + block->start,
+                   block->end - block->start);
+            offset += block->end - block->start;
+        }
+
+        snprintf(path, sizeof(path), "%s/%s/hu/%s", output_dir, domain,
+                 entries[i].hash);
+        int written = err ? 1 : write_if_changed(path, file, offset);
+        if (written > 0)
+            err = 1;
+        else if (written < 0)
+            (*unchanged)++;
+        else
+            (*updated)++;
+
+        i = j - 1;
+    }
+
+    free(file);
+
+    return err;
+}
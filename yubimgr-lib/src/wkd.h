@@ -0,0 +1,78 @@
+/*
+Copyright (C) 2016 Aurelien Vallee
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef YUBIMGR_WKD_H
+#define YUBIMGR_WKD_H
+
+#include "encoding.h"
+#include "string_table.h"
+
+#include <stddef.h>
+#include <sys/stat.h>
+
+// A Web Key Directory entry: one hashed local part of a domain, pointing to
+// one of the listed keys
+struct wkd_entry {
+    char domain[256];
+    char hash[ZBASE32_SIZE(20)];
+    size_t key;
+};
+
+// Byte range of every listed key within the exported stream
+struct key_block {
+    size_t start;
+    size_t end;
+};
+
+// Fills entry from an email address. Returns 1 when the address cannot be
+// published, e.g. its domain would not be a single path component.
+int wkd_entry_init(struct wkd_entry* entry, const char* email);
+
+// Splits an exported (binary) stream into one block per key of table. Keys
+// are exported one after the other, each starting with its public key
+// packet. Keys missing from the stream keep an empty block.
+int split_keys(const unsigned char* buffer,
+               size_t size,
+               const struct string_table* table,
+               struct key_block* blocks,
+               size_t count);
+
+// Writes the keys of entries to the Web Key Directory rooted at output_dir,
+// as output_dir/<domain>/hu/<hash>, every key of an address concatenated in
+// a single file, along with an empty output_dir/<domain>/policy. entries are
+// sorted in place, and key is an index in blocks.
+int wkd_publish(const char* output_dir,
+                const char* buffer,
+                const struct key_block* blocks,
+                struct wkd_entry* entries,
+                size_t entries_count,
+                size_t* updated,
+                size_t* unchanged);
+
+// Creates a directory, which may already exist.
+int make_dir(const char* path, mode_t mode);
+
+// Writes data to path unless it is already up to date, so that publishing
+// the same cohort again leaves the tree (and its mtimes) untouched.
+// Returns -1 if the file was unchanged, 0 if it was written, 1 on error.
+int write_if_changed(const char* path, const char* data, size_t size);
+
+#endif  // YUBIMGR_WKD_H
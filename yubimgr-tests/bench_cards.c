@@ -0,0 +1,171 @@
+/*
+Copyright (C) 2016 Aurelien Vallee
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+// Measures concurrent provisioning throughput and tail latency over virtual
+// cards (see mock-scdaemon.c).
+//
+// Usage: bench_cards [CARDS [CONCURRENCY]]
+//
+// Every card gets its own GNUPGHOME, gpg-agent and mock scdaemon, and is
+// reset from its own process. The mock latency/failure knobs
+// (YUBIMGR_MOCK_*) are taken from the environment.
+#include <yubimgr/yubimgr.h>
+#include <yubimgr/logging.h>
+#include <yubimgr/metrics.h>
+
+#include "mock_card.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+struct run {
+    char homedir[256];
+    pid_t pid;
+    int fd;
+    double latency;
+    int failed;
+};
+
+static int compare_double(const void* a, const void* b)
+{
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+static void start(struct run* run)
+{
+    int fds[2];
+
+    if (pipe(fds)) {
+        perror("pipe");
+        exit(EXIT_FAILURE);
+    }
+
+    run->pid = fork();
+    if (run->pid == 0) {
+        close(fds[0]);
+        setenv("GNUPGHOME", run->homedir, 1);
+
+        // Agent startup is not part of the measure
+        if (system("gpgconf --launch gpg-agent"))
+            _exit(EXIT_FAILURE);
+
+        double begin = monotonic_now();
+        int err      = reset();
+        double end   = monotonic_now() - begin;
+        if (write(fds[1], &end, sizeof(end)) != sizeof(end))
+            _exit(EXIT_FAILURE);
+        _exit(err ? EXIT_FAILURE : EXIT_SUCCESS);
+    }
+
+    close(fds[1]);
+    run->fd = fds[0];
+}
+
+// Waits for whichever card in flight finishes first
+static void finish_any(struct run* runs, size_t count)
+{
+    int status = 0;
+
+    for (;;) {
+        pid_t pid = waitpid(-1, &status, 0);
+        if (pid < 0) {
+            perror("waitpid");
+            exit(EXIT_FAILURE);
+        }
+        for (size_t i = 0; i < count; ++i) {
+            struct run* run = &runs[i];
+            if (run->pid != pid)
+                continue;
+            // The latency was written before exiting
+            if (read(run->fd, &run->latency, sizeof(run->latency)) !=
+                sizeof(run->latency))
+                run->latency = 0;
+            close(run->fd);
+            run->pid    = 0;
+            run->failed = !WIFEXITED(status) || WEXITSTATUS(status);
+            return;
+        }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    size_t cards       = argc > 1 ? (size_t)atoi(argv[1]) : 24;
+    size_t concurrency = argc > 2 ? (size_t)atoi(argv[2]) : cards;
+
+    set_log_file(stderr);
+    set_log_level(LOG_LEVEL_ERROR);
+
+    if (!cards || !concurrency)
+        return EXIT_FAILURE;
+
+    if (mock_card_available())
+        return TEST_SKIPPED;
+
+    struct run* runs = (struct run*)calloc(cards, sizeof(struct run));
+    for (size_t i = 0; i < cards; ++i)
+        if (mock_card_create(runs[i].homedir, sizeof(runs[i].homedir)))
+            return EXIT_FAILURE;
+
+    // Keep at most CONCURRENCY cards in flight, starting the next one as
+    // soon as any finishes
+    double begin    = monotonic_now();
+    size_t finished = 0;
+    for (size_t i = 0; i < cards; ++i) {
+        if (i >= concurrency) {
+            finish_any(runs, i);
+            finished++;
+        }
+        start(&runs[i]);
+    }
+    for (; finished < cards; ++finished)
+        finish_any(runs, cards);
+    double wall = monotonic_now() - begin;
+
+    size_t failures   = 0;
+    double* latencies = (double*)calloc(cards, sizeof(double));
+    for (size_t i = 0; i < cards; ++i) {
+        latencies[i] = runs[i].latency;
+        failures += runs[i].failed;
+        mock_card_destroy(runs[i].homedir);
+    }
+    qsort(latencies, cards, sizeof(double), compare_double);
+
+    printf("cards:       %zu\n", cards);
+    printf("concurrency: %zu\n", concurrency);
+    printf("failures:    %zu\n", failures);
+    printf("wall:        %.3fs\n", wall);
+    printf("throughput:  %.2f cards/s\n", cards / wall);
+    printf("latency p50: %.3fs\n", latencies[cards / 2]);
+    printf("latency p95: %.3fs\n", latencies[cards * 95 / 100]);
+    printf("latency p99: %.3fs\n", latencies[cards * 99 / 100]);
+    printf("latency max: %.3fs\n", latencies[cards - 1]);
+
+    free(latencies);
+    free(runs);
+
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,162 @@
+/*
+Copyright (C) 2016 Aurelien Vallee
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+// Compares subkey generation strategies for every key profile: the three
+// subkeys generated on the host one after the other, on the host in
+// parallel (bootstrap --keygen=host), and on the card.
+//
+// Usage: bench_keygen [ROUNDS]
+//
+// On-card generation goes through gpg-agent to a virtual card (see
+// mock-scdaemon.c, YUBIMGR_MOCK_LATENCY_47 sets its keygen latency), or to
+// the real card of $GNUPGHOME when YUBIMGR_BENCH_CARD is set. The latter
+// overwrites the OpenPGP keys of the card, and expects the default admin
+// PIN.
+#include <yubimgr/keygen.h>
+#include <yubimgr/logging.h>
+#include <yubimgr/metrics.h>
+
+#include "hostkey.h"
+#include "mock_card.h"
+
+#include <gcrypt.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static double bench_host(enum KEYGEN_PROFILE profile, int parallel)
+{
+    struct hostkey keys[SUBKEY_COUNT];
+
+    double begin = monotonic_now();
+    if (hostkey_generate(profile, keys, parallel))
+        return -1;
+    double duration = monotonic_now() - begin;
+    hostkey_release(keys);
+
+    return duration;
+}
+
+// OpenPGP card algorithm attributes (C1, C2, C3) of each profile
+static const char* _attributes[KEYGEN_PROFILE_COUNT][SUBKEY_COUNT] = {
+    {"010800002000", "010800002000", "010800002000"},
+    {"010C00002000", "010C00002000", "010C00002000"},
+    {"011000002000", "011000002000", "011000002000"},
+    {"162B06010401DA470F01", "122B060104019755010501",
+     "162B06010401DA470F01"},
+};
+
+// Control reference templates of the signature, decryption and
+// authentication keys
+static const char* _crts[SUBKEY_COUNT] = {"B600", "B800", "A400"};
+
+static double bench_card(const char* homedir, enum KEYGEN_PROFILE profile)
+{
+    char command[2048];
+    int size = snprintf(command, sizeof(command),
+                        "gpg-connect-agent %s%s%s "
+                        "\"SCD SERIALNO\" "
+                        "\"SCD APDU 00A4040006D27600012401\" "
+                        "\"SCD APDU 00200083083132333435363738\"",
+                        homedir ? "--homedir \"" : "", homedir ? homedir : "",
+                        homedir ? "\"" : "");
+
+    for (int i = 0; i < SUBKEY_COUNT; ++i)
+        size += snprintf(command + size, sizeof(command) - size,
+                         " \"SCD APDU 00DA00C%d%02zX%s\""
+                         " \"SCD APDU 0047800002%s\"",
+                         i + 1, strlen(_attributes[profile][i]) / 2,
+                         _attributes[profile][i], _crts[i]);
+    snprintf(command + size, sizeof(command) - size, " /bye >/dev/null");
+
+    double begin = monotonic_now();
+    if (system(command))
+        return -1;
+
+    return monotonic_now() - begin;
+}
+
+int main(int argc, char** argv)
+{
+    int rounds           = argc > 1 ? atoi(argv[1]) : 3;
+    const char* card_env = getenv("YUBIMGR_BENCH_CARD");
+    char homedir[256];
+    const char* card = NULL;
+
+    set_log_file(stderr);
+    set_log_level(LOG_LEVEL_ERROR);
+    gcry_check_version(NULL);
+
+    if (rounds <= 0)
+        return EXIT_FAILURE;
+
+    // NULL homedir means the current GNUPGHOME
+    int on_card = card_env && *card_env;
+    if (!on_card && !mock_card_available() &&
+        !mock_card_create(homedir, sizeof(homedir))) {
+        card    = homedir;
+        on_card = 1;
+    }
+
+    // Agent startup is not part of the measure
+    if (card) {
+        char command[512];
+        snprintf(command, sizeof(command),
+                 "gpgconf --homedir \"%s\" --launch gpg-agent", card);
+        if (system(command))
+            on_card = 0;
+    }
+
+    printf("%-8s %11s %11s %11s %9s %9s\n", "profile", "sequential",
+           "parallel", "card", "vs seq.", "vs card");
+
+    int err = 0;
+    for (int p = 0; p < KEYGEN_PROFILE_COUNT; ++p) {
+        double sequential = 0;
+        double parallel   = 0;
+        double on_card_s  = 0;
+
+        for (int r = 0; r < rounds && !err; ++r) {
+            double s = bench_host((enum KEYGEN_PROFILE)p, 0);
+            double q = bench_host((enum KEYGEN_PROFILE)p, 1);
+            double c = on_card ? bench_card(card, (enum KEYGEN_PROFILE)p) : 0;
+            err      = s < 0 || q < 0 || c < 0;
+            sequential += s / rounds;
+            parallel += q / rounds;
+            on_card_s += c / rounds;
+        }
+
+        // Speedups of the parallel host generation
+        printf("%-8s %10.3fs %10.3fs ", keygen_profile_name(p), sequential,
+               parallel);
+        if (on_card)
+            printf("%10.3fs %8.1fx %8.1fx\n", on_card_s,
+                   sequential / parallel, on_card_s / parallel);
+        else
+            printf("%11s %8.1fx %9s\n", "-", sequential / parallel, "-");
+    }
+
+    if (card)
+        mock_card_destroy(card);
+
+    return err ? EXIT_FAILURE : EXIT_SUCCESS;
+}
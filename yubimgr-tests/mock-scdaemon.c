@@ -0,0 +1,772 @@
+/*
+Copyright (C) 2016 Aurelien Vallee
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+// A stand-in for scdaemon emulating a YubiKey with OpenPGP and PIV applets.
+//
+// gpg-agent spawns it when its gpg-agent.conf holds
+// "scdaemon-program /path/to/mock-scdaemon", and talks Assuan on its
+// standard input/output. Each GNUPGHOME thus gets its own virtual card.
+//
+// Behavior is tuned from the environment (inherited through gpg-agent):
+//   YUBIMGR_MOCK_LATENCY_MS      Latency added to every APDU
+//   YUBIMGR_MOCK_LATENCY_<INS>   Latency for a given instruction (hex), for
+//                                instance YUBIMGR_MOCK_LATENCY_47 for keygen
+//   YUBIMGR_MOCK_FAIL_RATE       Probability (0-1) of a transport error
+//   YUBIMGR_MOCK_FAIL_INS        Instruction (hex) always failing with 6F00
+//   YUBIMGR_MOCK_SEED            Seed of the failure injection
+//   YUBIMGR_MOCK_SERIAL          Card serial number (8 hex digits)
+//   YUBIMGR_MOCK_PIV_MANAGEMENT  PIV management key algorithm (hex, 03 3DES)
+
+#include <gcrypt.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SW_OK 0x9000
+#define SW_WRONG_LENGTH 0x6700
+#define SW_SECURITY_STATUS 0x6982
+#define SW_AUTH_BLOCKED 0x6983
+#define SW_CONDITIONS 0x6985
+#define SW_WRONG_DATA 0x6A80
+#define SW_NOT_FOUND 0x6A82
+#define SW_DATA_NOT_FOUND 0x6A88
+#define SW_INS_UNKNOWN 0x6D00
+#define SW_TERMINATED 0x6285
+#define SW_UNKNOWN 0x6F00
+
+// GPG_ERR_CARD, GPG_ERR_BAD_PIN and GPG_ERR_CANCELED from GPG_ERR_SOURCE_SCD
+#define ERR_CARD ((6u << 24) | 108)
+#define ERR_BAD_PIN ((6u << 24) | 87)
+#define ERR_CANCELED ((6u << 24) | 99)
+
+#define MAX_OBJECTS 64
+#define MAX_OBJECT_SIZE 4096
+
+enum APP { APP_NONE = 0, APP_OPENPGP, APP_PIV };
+
+struct pin {
+    char value[128];
+    int retries;
+    int max_retries;
+    int verified;
+};
+
+struct object {
+    unsigned int tag;
+    unsigned char value[MAX_OBJECT_SIZE];
+    size_t size;
+};
+
+struct card {
+    enum APP app;
+    int terminated;
+    struct pin pw1;
+    struct pin pw3;
+    struct pin piv_pin;
+    struct pin piv_puk;
+    unsigned char management_algorithm;
+    unsigned char management_key[32];
+    size_t management_key_size;
+    unsigned char challenge[16];
+    int challenge_pending;
+    int management_verified;
+    struct object objects[MAX_OBJECTS];
+    size_t object_count;
+    unsigned char chain[MAX_OBJECT_SIZE];
+    size_t chain_size;
+};
+
+struct response {
+    unsigned char data[MAX_OBJECT_SIZE + 2];
+    size_t size;
+};
+
+static struct card card;
+static char serial[9] = "12345678";
+static unsigned int latency_ms;
+static double fail_rate;
+static int fail_ins = -1;
+static unsigned char default_management_algorithm = 0x03;
+
+static void set_pin(struct pin* pin, const char* value, int max_retries)
+{
+    strncpy(pin->value, value, sizeof(pin->value) - 1);
+    pin->retries     = max_retries;
+    pin->max_retries = max_retries;
+    pin->verified    = 0;
+}
+
+static void reset_openpgp()
+{
+    set_pin(&card.pw1, "123456", 3);
+    set_pin(&card.pw3, "12345678", 3);
+    card.terminated   = 0;
+    card.object_count = 0;
+}
+
+static void reset_piv()
+{
+    static const unsigned char default_key[24] = {
+        1, 2, 3, 4, 5, 6, 7, 8, 1, 2, 3, 4, 5, 6, 7, 8, 1, 2, 3, 4, 5, 6, 7, 8};
+
+    set_pin(&card.piv_pin, "123456", 3);
+    set_pin(&card.piv_puk, "12345678", 3);
+    memcpy(card.management_key, default_key, sizeof(default_key));
+    card.management_key_size  = sizeof(default_key);
+    card.management_algorithm = default_management_algorithm;
+    card.challenge_pending   = 0;
+    card.management_verified = 0;
+}
+
+static void put_sw(struct response* response, unsigned int sw)
+{
+    response->data[response->size++] = sw >> 8;
+    response->data[response->size++] = sw & 0xff;
+}
+
+static void put_data(struct response* response,
+                     const unsigned char* data,
+                     size_t size)
+{
+    memcpy(response->data + response->size, data, size);
+    response->size += size;
+}
+
+static unsigned int pin_status(const struct pin* pin)
+{
+    return pin->retries ? 0x63C0 | pin->retries : SW_AUTH_BLOCKED;
+}
+
+// Checks a PIN, PIV PINs being padded with 0xFF up to 8 bytes
+static unsigned int check_pin(struct pin* pin,
+                              const unsigned char* value,
+                              size_t size)
+{
+    while (size && value[size - 1] == 0xFF)
+        --size;
+
+    if (!pin->retries)
+        return SW_AUTH_BLOCKED;
+
+    if (size != strlen(pin->value) || memcmp(pin->value, value, size)) {
+        pin->verified = 0;
+        pin->retries--;
+        return pin_status(pin);
+    }
+
+    pin->retries  = pin->max_retries;
+    pin->verified = 1;
+    return SW_OK;
+}
+
+static struct object* find_object(unsigned int tag)
+{
+    for (size_t i = 0; i < card.object_count; ++i)
+        if (card.objects[i].tag == tag)
+            return &card.objects[i];
+    return NULL;
+}
+
+static unsigned int store_object(unsigned int tag,
+                                 const unsigned char* value,
+                                 size_t size)
+{
+    struct object* object = find_object(tag);
+
+    if (!object) {
+        if (card.object_count == MAX_OBJECTS)
+            return SW_UNKNOWN;
+        object      = &card.objects[card.object_count++];
+        object->tag = tag;
+    }
+
+    if (size > sizeof(object->value))
+        return SW_WRONG_LENGTH;
+
+    memcpy(object->value, value, size);
+    object->size = size;
+
+    return SW_OK;
+}
+
+static void put_public_key(struct response* response)
+{
+    // A fake RSA public key template: 7F49 { 81 modulus, 82 exponent }
+    static const unsigned char key[] = {0x7F, 0x49, 0x0B, 0x81, 0x04, 0xC0,
+                                        0x01, 0x02, 0x03, 0x82, 0x03, 0x01,
+                                        0x00, 0x01};
+    put_data(response, key, sizeof(key));
+}
+
+// A fake EC public key template: 7F49 { 86 uncompressed point }
+static void put_ec_public_key(struct response* response, size_t point_size)
+{
+    unsigned char key[5 + 97] = {0x7F, 0x49, 2 + point_size, 0x86,
+                                 point_size, 0x04};
+
+    for (size_t i = 1; i < point_size; ++i)
+        key[5 + i] = i;
+    put_data(response, key, 5 + point_size);
+}
+
+static int management_cipher(unsigned char algorithm, size_t* block_size)
+{
+    *block_size = 16;
+    switch (algorithm) {
+        case 0x08:
+            return GCRY_CIPHER_AES128;
+        case 0x0A:
+            return GCRY_CIPHER_AES192;
+        case 0x0C:
+            return GCRY_CIPHER_AES256;
+        default:
+            *block_size = 8;
+            return GCRY_CIPHER_3DES;
+    }
+}
+
+static unsigned int openpgp_apdu(const unsigned char* apdu,
+                                 size_t size,
+                                 const unsigned char* data,
+                                 size_t data_size,
+                                 struct response* response)
+{
+    unsigned char ins = apdu[1];
+    unsigned char p1  = apdu[2];
+    unsigned char p2  = apdu[3];
+
+    (void)size;
+
+    if (card.terminated && ins != 0x44)
+        return SW_TERMINATED;
+
+    switch (ins) {
+        case 0x20:  // VERIFY
+            if (p2 != 0x81 && p2 != 0x82 && p2 != 0x83)
+                return SW_WRONG_DATA;
+            if (!data_size)
+                return pin_status(p2 == 0x83 ? &card.pw3 : &card.pw1);
+            return check_pin(p2 == 0x83 ? &card.pw3 : &card.pw1, data,
+                             data_size);
+        case 0x24: {  // CHANGE REFERENCE DATA
+            struct pin* pin = p2 == 0x83 ? &card.pw3 : &card.pw1;
+            size_t old_size = strlen(pin->value);
+            if (data_size < old_size)
+                return SW_WRONG_LENGTH;
+            unsigned int sw = check_pin(pin, data, old_size);
+            if (sw != SW_OK)
+                return sw;
+            if (data_size - old_size >= sizeof(pin->value))
+                return SW_WRONG_LENGTH;
+            memcpy(pin->value, data + old_size, data_size - old_size);
+            pin->value[data_size - old_size] = 0;
+            return SW_OK;
+        }
+        case 0x2C:  // RESET RETRY COUNTER (with admin PIN)
+            if (!card.pw3.verified)
+                return SW_SECURITY_STATUS;
+            if (data_size >= sizeof(card.pw1.value))
+                return SW_WRONG_LENGTH;
+            memcpy(card.pw1.value, data, data_size);
+            card.pw1.value[data_size] = 0;
+            card.pw1.retries          = card.pw1.max_retries;
+            return SW_OK;
+        case 0xCA: {  // GET DATA
+            struct object* object = find_object((p1 << 8) | p2);
+            if (!object)
+                return SW_DATA_NOT_FOUND;
+            put_data(response, object->value, object->size);
+            return SW_OK;
+        }
+        case 0xDA: {  // PUT DATA
+            if (!card.pw3.verified)
+                return SW_SECURITY_STATUS;
+            // Fixed touch policies (UIF 02, 04) cannot be changed anymore
+            struct object* uif = find_object((p1 << 8) | p2);
+            if (p1 == 0x00 && p2 >= 0xD6 && p2 <= 0xD8 && uif &&
+                (uif->value[0] == 0x02 || uif->value[0] == 0x04))
+                return SW_CONDITIONS;
+            return store_object((p1 << 8) | p2, data, data_size);
+        }
+        case 0x47:  // GENERATE ASYMMETRIC KEY PAIR
+            if (p1 == 0x80 && !card.pw3.verified)
+                return SW_SECURITY_STATUS;
+            put_public_key(response);
+            return SW_OK;
+        case 0xE6:  // TERMINATE DF
+            if (card.pw3.retries && !card.pw3.verified)
+                return SW_CONDITIONS;
+            card.terminated = 1;
+            return SW_OK;
+        case 0x44:  // ACTIVATE FILE
+            if (card.terminated)
+                reset_openpgp();
+            return SW_OK;
+        default:
+            return SW_INS_UNKNOWN;
+    }
+}
+
+static unsigned int piv_authenticate(const unsigned char* data,
+                                     size_t size,
+                                     struct response* response)
+{
+    size_t block_size;
+    int algorithm = management_cipher(card.management_algorithm, &block_size);
+
+    // Challenge request: 7C 02 81 00
+    if (size == 4 && data[0] == 0x7C && data[2] == 0x81) {
+        unsigned char header[] = {0x7C, 2 + block_size, 0x81, block_size};
+        gcry_create_nonce(card.challenge, block_size);
+        card.challenge_pending = 1;
+        put_data(response, header, sizeof(header));
+        put_data(response, card.challenge, block_size);
+        return SW_OK;
+    }
+
+    // Challenge response: 7C L 82 B <ENC(challenge)>
+    if (size == 4 + block_size && data[0] == 0x7C && data[2] == 0x82 &&
+        card.challenge_pending) {
+        unsigned char expected[16];
+        gcry_cipher_hd_t cipher;
+        card.challenge_pending = 0;
+        if (gcry_cipher_open(&cipher, algorithm, GCRY_CIPHER_MODE_ECB, 0))
+            return SW_UNKNOWN;
+        gcry_cipher_setkey(cipher, card.management_key,
+                           card.management_key_size);
+        gcry_cipher_encrypt(cipher, expected, block_size, card.challenge,
+                            block_size);
+        gcry_cipher_close(cipher);
+        card.management_verified = !memcmp(expected, data + 4, block_size);
+        return card.management_verified ? SW_OK : SW_SECURITY_STATUS;
+    }
+
+    return SW_WRONG_DATA;
+}
+
+static unsigned int piv_apdu(const unsigned char* apdu,
+                             size_t size,
+                             const unsigned char* data,
+                             size_t data_size,
+                             struct response* response)
+{
+    unsigned char ins = apdu[1];
+    unsigned char p2  = apdu[3];
+    struct pin* pin   = p2 == 0x81 ? &card.piv_puk : &card.piv_pin;
+
+    (void)size;
+
+    switch (ins) {
+        case 0x20:  // VERIFY
+            if (!data_size)
+                return pin_status(&card.piv_pin);
+            return check_pin(&card.piv_pin, data, data_size);
+        case 0x24: {  // CHANGE REFERENCE DATA
+            if (data_size != 16)
+                return SW_WRONG_LENGTH;
+            unsigned int sw = check_pin(pin, data, 8);
+            if (sw != SW_OK)
+                return sw;
+            size_t new_size = 8;
+            while (new_size && data[8 + new_size - 1] == 0xFF)
+                --new_size;
+            memcpy(pin->value, data + 8, new_size);
+            pin->value[new_size] = 0;
+            return SW_OK;
+        }
+        case 0x2C: {  // RESET RETRY COUNTER
+            if (data_size != 16)
+                return SW_WRONG_LENGTH;
+            return check_pin(&card.piv_puk, data, 8);
+        }
+        case 0xFB:  // YubiKey applet reset
+            if (card.piv_pin.retries || card.piv_puk.retries)
+                return SW_CONDITIONS;
+            reset_piv();
+            return SW_OK;
+        case 0x87:  // GENERAL AUTHENTICATE
+            if (apdu[2] != card.management_algorithm)
+                return SW_WRONG_DATA;
+            return piv_authenticate(data, data_size, response);
+        case 0xF7: {  // YubiKey GET METADATA, management key only
+            unsigned char metadata[] = {0x01, 0x01, card.management_algorithm};
+            if (p2 != 0x9B)
+                return SW_NOT_FOUND;
+            put_data(response, metadata, sizeof(metadata));
+            return SW_OK;
+        }
+        case 0x47:  // GENERATE ASYMMETRIC KEY PAIR
+            if (!card.management_verified)
+                return SW_SECURITY_STATUS;
+            if (data_size == 5 && data[4] == 0x11)
+                put_ec_public_key(response, 65);
+            else if (data_size == 5 && data[4] == 0x14)
+                put_ec_public_key(response, 97);
+            else
+                put_public_key(response);
+            return SW_OK;
+        case 0xDB:  // PUT DATA, possibly chained
+            if (!card.management_verified)
+                return SW_SECURITY_STATUS;
+            if (card.chain_size + data_size > sizeof(card.chain))
+                return SW_WRONG_LENGTH;
+            memcpy(card.chain + card.chain_size, data, data_size);
+            card.chain_size += data_size;
+            if (apdu[0] & 0x10)
+                return SW_OK;
+            card.chain_size = 0;
+            return SW_OK;
+        case 0xFF:  // YubiKey set management key
+            if (!card.management_verified)
+                return SW_SECURITY_STATUS;
+            if (data_size < 3 || data[2] != data_size - 3 ||
+                data[2] > sizeof(card.management_key))
+                return SW_WRONG_LENGTH;
+            card.management_algorithm = data[0];
+            card.management_key_size  = data[2];
+            memcpy(card.management_key, data + 3, data[2]);
+            return SW_OK;
+        default:
+            return SW_INS_UNKNOWN;
+    }
+}
+
+static unsigned int select_apdu(const unsigned char* data, size_t size)
+{
+    static const unsigned char openpgp_aid[] = {0xD2, 0x76, 0x00,
+                                                0x01, 0x24, 0x01};
+    static const unsigned char piv_aid[] = {0xA0, 0x00, 0x00, 0x03, 0x08};
+
+    if (size >= sizeof(openpgp_aid) &&
+        !memcmp(data, openpgp_aid, sizeof(openpgp_aid))) {
+        card.app = APP_OPENPGP;
+        return SW_OK;
+    }
+
+    if (size >= sizeof(piv_aid) && !memcmp(data, piv_aid, sizeof(piv_aid))) {
+        card.app                 = APP_PIV;
+        card.management_verified = 0;
+        return SW_OK;
+    }
+
+    return SW_NOT_FOUND;
+}
+
+static void process_apdu(const unsigned char* apdu,
+                         size_t size,
+                         struct response* response)
+{
+    unsigned int sw;
+    const unsigned char* data = NULL;
+    size_t data_size          = 0;
+
+    response->size = 0;
+
+    if (size < 4) {
+        put_sw(response, SW_WRONG_LENGTH);
+        return;
+    }
+
+    if (size > 5) {
+        data_size = apdu[4];
+        data      = apdu + 5;
+        if (data_size > size - 5) {
+            put_sw(response, SW_WRONG_LENGTH);
+            return;
+        }
+    }
+
+    if (apdu[1] == fail_ins)
+        sw = SW_UNKNOWN;
+    else if (apdu[1] == 0xA4)
+        sw = select_apdu(data, data_size);
+    else if (card.app == APP_OPENPGP)
+        sw = openpgp_apdu(apdu, size, data, data_size, response);
+    else if (card.app == APP_PIV)
+        sw = piv_apdu(apdu, size, data, data_size, response);
+    else
+        sw = SW_CONDITIONS;
+
+    if (sw != SW_OK)
+        response->size = 0;
+    put_sw(response, sw);
+}
+
+static void sleep_ms(unsigned int ms)
+{
+    struct timespec ts = {ms / 1000, (ms % 1000) * 1000000L};
+    nanosleep(&ts, NULL);
+}
+
+static unsigned int apdu_latency(unsigned char ins)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "YUBIMGR_MOCK_LATENCY_%02X", ins);
+    const char* value = getenv(name);
+
+    return value ? (unsigned int)atoi(value) : latency_ms;
+}
+
+// Sends data lines, escaping as required by Assuan
+static void send_data(const unsigned char* data, size_t size)
+{
+    size_t line = 0;
+
+    for (size_t i = 0; i < size; ++i) {
+        if (!line) {
+            fputs("D ", stdout);
+            line = 2;
+        }
+        if (data[i] == '%' || data[i] == '\r' || data[i] == '\n') {
+            printf("%%%02X", data[i]);
+            line += 3;
+        } else {
+            putchar(data[i]);
+            line++;
+        }
+        if (line > 900) {
+            putchar('\n');
+            line = 0;
+        }
+    }
+    if (line)
+        putchar('\n');
+}
+
+static void ok()
+{
+    puts("OK");
+}
+
+static void handle_apdu(const char* args)
+{
+    unsigned char apdu[MAX_OBJECT_SIZE];
+    struct response response;
+    size_t size = 0;
+
+    // Skip options such as --more or --exlen
+    while (*args == '-') {
+        args += strcspn(args, " ");
+        args += strspn(args, " ");
+    }
+
+    for (; args[0] && args[1] && size < sizeof(apdu); args += 2) {
+        unsigned int byte;
+        if (sscanf(args, "%2x", &byte) != 1)
+            break;
+        apdu[size++] = byte;
+    }
+
+    if (size >= 2)
+        sleep_ms(apdu_latency(apdu[1]));
+
+    if (fail_rate > 0 && (double)rand() / RAND_MAX < fail_rate) {
+        printf("ERR %u Card error <SCD>\n", ERR_CARD);
+        return;
+    }
+
+    process_apdu(apdu, size, &response);
+    send_data(response.data, response.size);
+    ok();
+}
+
+// Asks gpg-agent for data, decoded into buffer. Returns the size read, or
+// -1 when the inquiry is canceled.
+static long inquire(const char* keyword, unsigned char* buffer, size_t size)
+{
+    char line[2048];
+    size_t count = 0;
+
+    printf("INQUIRE %s\n", keyword);
+    while (fgets(line, sizeof(line), stdin)) {
+        line[strcspn(line, "\r\n")] = 0;
+        if (!strcmp(line, "END"))
+            return count;
+        if (!strcmp(line, "CAN") || strncmp(line, "D ", 2))
+            break;
+        for (const char* c = line + 2; *c; ++c) {
+            unsigned int byte = (unsigned char)*c;
+            if (*c == '%' && sscanf(c + 1, "%2x", &byte) == 1)
+                c += 2;
+            if (count < size)
+                buffer[count++] = byte;
+        }
+    }
+
+    return -1;
+}
+
+// Imports a key into an OpenPGP slot (keytocard). The key itself is not
+// kept, its hash stands for the fingerprint gpg reads back.
+static void handle_writekey(const char* args)
+{
+    unsigned char keydata[MAX_OBJECT_SIZE];
+    unsigned char pin[128] = {0};
+    unsigned char fpr[20];
+    int key = 0;
+
+    if (!strncmp(args, "--force ", 8))
+        args += 8;
+    if (sscanf(args, "OPENPGP.%d", &key) != 1 || key < 1 || key > 3) {
+        printf("ERR %u Invalid key reference <SCD>\n", ERR_CARD);
+        return;
+    }
+
+    long size = inquire("KEYDATA", keydata, sizeof(keydata));
+    if (size < 0) {
+        printf("ERR %u Canceled <SCD>\n", ERR_CANCELED);
+        return;
+    }
+
+    // gpg-agent answers with the PIN, NUL padded
+    if (!card.pw3.verified) {
+        if (inquire("NEEDPIN |A|Please enter the Admin PIN", pin,
+                    sizeof(pin) - 1) < 0) {
+            printf("ERR %u Canceled <SCD>\n", ERR_CANCELED);
+            return;
+        }
+        if (check_pin(&card.pw3, pin, strlen((char*)pin)) != SW_OK) {
+            printf("ERR %u Bad PIN <SCD>\n", ERR_BAD_PIN);
+            return;
+        }
+    }
+
+    gcry_md_hash_buffer(GCRY_MD_SHA1, fpr, keydata, size);
+    store_object(0xC6 + key, fpr, sizeof(fpr));
+    ok();
+}
+
+// Prints the status lines of attribute name, or all of them for NULL
+static void print_attributes(const char* name)
+{
+    static const char* attributes[][2] = {
+        {"READER", "Mock YubiKey"},
+        {"SERIALNO", NULL},
+        {"APPTYPE", "openpgp"},
+        {"APPVERSION", "304"},
+        {"EXTCAP", "gc=1+ki=1+fc=1+pd=1+mcl3=2048+aac=1+sm=0+si=5+dec=0+bt=1"
+                   "+kdf=1"},
+        {"MANUFACTURER", "6 Yubico"},
+        {"CHV-STATUS", NULL},
+        {"SIG-COUNTER", "0"},
+        {"KEY-ATTR", NULL},
+        {"KEY-FPR", NULL},
+    };
+
+    for (size_t i = 0; i < sizeof(attributes) / sizeof(attributes[0]); ++i) {
+        const char* attribute = attributes[i][0];
+        if (name && strcasecmp(name, attribute))
+            continue;
+        if (!strcmp(attribute, "SERIALNO"))
+            printf("S SERIALNO D2760001240103040006%s0000\n", serial);
+        else if (!strcmp(attribute, "CHV-STATUS"))
+            printf("S CHV-STATUS +1+127+127+127+%d+0+%d\n", card.pw1.retries,
+                   card.pw3.retries);
+        else if (!strcmp(attribute, "KEY-ATTR"))
+            for (int key = 1; key <= 3; ++key)
+                printf("S KEY-ATTR %d 1 rsa2048\n", key);
+        else if (!strcmp(attribute, "KEY-FPR"))
+            for (int key = 1; key <= 3; ++key) {
+                const struct object* fpr = find_object(0xC6 + key);
+                if (!fpr)
+                    continue;
+                printf("S KEY-FPR %d ", key);
+                for (size_t j = 0; j < fpr->size; ++j)
+                    printf("%02X", fpr->value[j]);
+                putchar('\n');
+            }
+        else
+            printf("S %s %s\n", attribute, attributes[i][1]);
+    }
+    ok();
+}
+
+int main(int __attribute__((unused)) argc, char __attribute__((unused)) ** argv)
+{
+    char line[2048];
+    const char* value;
+
+    gcry_check_version(NULL);
+    gcry_control(GCRYCTL_DISABLE_SECMEM, 0);
+    gcry_control(GCRYCTL_INITIALIZATION_FINISHED, 0);
+
+    if ((value = getenv("YUBIMGR_MOCK_LATENCY_MS")))
+        latency_ms = atoi(value);
+    if ((value = getenv("YUBIMGR_MOCK_FAIL_RATE")))
+        fail_rate = atof(value);
+    if ((value = getenv("YUBIMGR_MOCK_FAIL_INS")))
+        fail_ins = strtol(value, NULL, 16);
+    if ((value = getenv("YUBIMGR_MOCK_SERIAL")))
+        snprintf(serial, sizeof(serial), "%.8s", value);
+    if ((value = getenv("YUBIMGR_MOCK_PIV_MANAGEMENT")))
+        default_management_algorithm = strtol(value, NULL, 16);
+    value = getenv("YUBIMGR_MOCK_SEED");
+    srand(value ? (unsigned int)atoi(value) : (unsigned int)getpid());
+
+    reset_openpgp();
+    reset_piv();
+
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    puts("OK Mock scdaemon ready");
+
+    while (fgets(line, sizeof(line), stdin)) {
+        line[strcspn(line, "\r\n")] = 0;
+
+        char* args = line + strcspn(line, " ");
+        if (*args)
+            *args++ = 0;
+
+        if (!strcasecmp(line, "APDU")) {
+            handle_apdu(args);
+        } else if (!strcasecmp(line, "SERIALNO")) {
+            printf("S SERIALNO D2760001240103040006%s0000\n", serial);
+            ok();
+        } else if (!strcasecmp(line, "LEARN")) {
+            print_attributes(NULL);
+        } else if (!strcasecmp(line, "GETATTR")) {
+            print_attributes(args);
+        } else if (!strcasecmp(line, "WRITEKEY")) {
+            handle_writekey(args);
+        } else if (!strcasecmp(line, "GETINFO")) {
+            if (!strcmp(args, "version"))
+                puts("D 2.2.40");
+            else if (!strcmp(args, "socket_name"))
+                puts("D /nonexistent/S.scdaemon");
+            ok();
+        } else if (!strcasecmp(line, "RESET") ||
+                   !strcasecmp(line, "RESTART")) {
+            card.app = APP_NONE;
+            ok();
+        } else if (!strcasecmp(line, "BYE") || !strcasecmp(line, "KILLSCD")) {
+            ok();
+            break;
+        } else {
+            // OPTION, SETATTR and friends are accepted and ignored
+            ok();
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,196 @@
+/*
+Copyright (C) 2016 Aurelien Vallee
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "mock_card.h"
+
+#include <gpgme.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+int mock_card_available()
+{
+    const char* mock = getenv("MOCK_SCDAEMON");
+
+    if (!mock || !*mock) {
+        fprintf(stderr, "MOCK_SCDAEMON is not set.\n");
+        return 1;
+    }
+
+    if (system("gpg-agent --version >/dev/null 2>&1") ||
+        system("gpgconf --version >/dev/null 2>&1")) {
+        fprintf(stderr, "gpg-agent is not available.\n");
+        return 1;
+    }
+
+    return 0;
+}
+
+int mock_gpg_available()
+{
+    if (system("gpg --version >/dev/null 2>&1") ||
+        system("gpg-agent --version >/dev/null 2>&1")) {
+        fprintf(stderr, "gpg is not available.\n");
+        return 1;
+    }
+
+    return 0;
+}
+
+int mock_keyring_create(char* homedir, size_t size)
+{
+    const char* tmprootdir = getenv("TMPDIR");
+    if (!tmprootdir)
+        tmprootdir = "/tmp";
+
+    // Agent sockets paths are limited in length, keep the name short
+    snprintf(homedir, size, "%s/ymc.XXXXXX", tmprootdir);
+    if (!mkdtemp(homedir)) {
+        perror("mkdtemp");
+        return 1;
+    }
+
+    return 0;
+}
+
+int mock_card_create(char* homedir, size_t size)
+{
+    if (mock_keyring_create(homedir, size))
+        return 1;
+
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/gpg-agent.conf", homedir);
+    FILE* file = fopen(path, "w");
+    if (!file) {
+        perror("fopen");
+        return 1;
+    }
+    fprintf(file, "scdaemon-program %s\n", getenv("MOCK_SCDAEMON"));
+    fclose(file);
+
+    return 0;
+}
+
+void mock_card_destroy(const char* homedir)
+{
+    char command[1024];
+
+    snprintf(command, sizeof(command),
+             "gpgconf --homedir \"%s\" --kill all >/dev/null 2>&1; "
+             "rm -rf \"%s\"",
+             homedir, homedir);
+    if (system(command))
+        fprintf(stderr, "Failed to remove \"%s\".\n", homedir);
+}
+
+int mock_key_create(const char* homedir,
+                    const char* uid,
+                    const char* algo,
+                    const char* usage,
+                    const char* passphrase,
+                    char* fpr,
+                    size_t size)
+{
+    char command[1024];
+    char line[256];
+    int found = 0;
+
+    if (size < 41)
+        return 1;
+
+    snprintf(command, sizeof(command),
+             "gpg --homedir \"%s\" --batch --pinentry-mode loopback "
+             "--passphrase \"%s\" --status-fd 1 --quick-gen-key \"%s\" %s %s "
+             "never 2>/dev/null",
+             homedir, passphrase ? passphrase : "", uid, algo, usage);
+    FILE* gpg = popen(command, "r");
+    if (!gpg) {
+        perror("popen");
+        return 1;
+    }
+    while (fgets(line, sizeof(line), gpg))
+        if (!found && sscanf(line, "[GNUPG:] KEY_CREATED P %40s", fpr) == 1)
+            found = 1;
+    if (pclose(gpg) || !found) {
+        fprintf(stderr, "Failed to create key \"%s\".\n", uid);
+        return 1;
+    }
+
+    return 0;
+}
+
+int mock_subkey_add(const char* homedir,
+                    const char* fpr,
+                    const char* algo,
+                    const char* usage,
+                    const char* passphrase)
+{
+    char command[1024];
+
+    snprintf(command, sizeof(command),
+             "gpg --homedir \"%s\" --batch --pinentry-mode loopback "
+             "--passphrase \"%s\" --quick-add-key %s %s %s never "
+             ">/dev/null 2>&1",
+             homedir, passphrase ? passphrase : "", fpr, algo, usage);
+    if (system(command)) {
+        fprintf(stderr, "Failed to add a subkey to %s.\n", fpr);
+        return 1;
+    }
+
+    return 0;
+}
+
+int mock_keyring_available(const char* fpr)
+{
+    gpgme_ctx_t context;
+    gpgme_key_t key = NULL;
+
+    gpgme_check_version(NULL);
+    if (gpgme_new(&context))
+        return 1;
+    gpgme_error_t err = gpgme_get_key(context, fpr, &key, 0);
+    gpgme_key_unref(key);
+    gpgme_release(context);
+
+    if (err)
+        fprintf(stderr, "GPGME does not see the test keyring: %s\n",
+                gpgme_strerror(err));
+
+    return err != 0;
+}
+
+double mock_metric(const char* path, const char* sample)
+{
+    char line[256];
+    double value = -1;
+    size_t size  = strlen(sample);
+
+    FILE* file = fopen(path, "r");
+    if (!file)
+        return -1;
+    while (fgets(line, sizeof(line), file))
+        if (!strncmp(line, sample, size) && line[size] == ' ')
+            value = atof(line + size + 1);
+    fclose(file);
+
+    return value;
+}
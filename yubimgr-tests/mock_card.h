@@ -0,0 +1,70 @@
+/*
+Copyright (C) 2016 Aurelien Vallee
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef YUBIMGR_MOCK_CARD_H
+#define YUBIMGR_MOCK_CARD_H
+
+#include "check.h"
+
+#include <stddef.h>
+
+// Creates a GNUPGHOME whose gpg-agent uses the mock scdaemon found in
+// $MOCK_SCDAEMON, that is a fresh virtual card.
+int mock_card_create(char* homedir, size_t size);
+
+// Stops the agent (and virtual card) and removes the GNUPGHOME.
+void mock_card_destroy(const char* homedir);
+
+// Returns 0 when virtual cards can be used on this host.
+int mock_card_available();
+
+// Returns 0 when gpg can create software keys on this host.
+int mock_gpg_available();
+
+// Creates an empty GNUPGHOME, for software keys only.
+int mock_keyring_create(char* homedir, size_t size);
+
+// Creates a software key (gpg --quick-gen-key uid algo usage) protected by
+// passphrase (none if NULL) in homedir, and writes its fingerprint to fpr.
+int mock_key_create(const char* homedir,
+                    const char* uid,
+                    const char* algo,
+                    const char* usage,
+                    const char* passphrase,
+                    char* fpr,
+                    size_t size);
+
+// Adds a subkey to the key fpr of homedir.
+int mock_subkey_add(const char* homedir,
+                    const char* fpr,
+                    const char* algo,
+                    const char* usage,
+                    const char* passphrase);
+
+// Returns 0 when GPGME sees the key fpr of the current GNUPGHOME, that is
+// when software key tests can run on this host.
+int mock_keyring_available(const char* fpr);
+
+// Value of a sample (name and labels, e.g. "yubimgr_queue_depth") of the
+// metrics file path (see write_metrics()), or -1.
+double mock_metric(const char* path, const char* sample);
+
+#endif  // YUBIMGR_MOCK_CARD_H
@@ -0,0 +1,147 @@
+/*
+Copyright (C) 2016 Aurelien Vallee
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <yubimgr/logging.h>
+
+#include "audit_log.h"
+#include "check.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define USERS 100
+#define RECORDS 3000
+
+// Number of records covered by the index of path (see audit.c), or -1
+static long indexed_records(const char* path)
+{
+    char index_path[256];
+    unsigned char header[16];
+    uint64_t records;
+
+    snprintf(index_path, sizeof(index_path), "%s.idx", path);
+    FILE* file = fopen(index_path, "rb");
+    if (!file)
+        return -1;
+    size_t size = fread(header, 1, sizeof(header), file);
+    fclose(file);
+    if (size != sizeof(header))
+        return -1;
+    memcpy(&records, header + 8, sizeof(records));
+
+    return (long)records;
+}
+
+// Number of records matching query, or -1
+static int count_matches(const char* path, const char* query)
+{
+    char* output = NULL;
+    size_t size  = 0;
+    int lines    = 0;
+
+    FILE* out = open_memstream(&output, &size);
+    int err   = audit_query(path, query, out);
+    fclose(out);
+
+    for (size_t i = 0; i < size; ++i)
+        lines += output[i] == '\n';
+    free(output);
+
+    return err ? -1 : lines;
+}
+
+// Appends count records, cycling over USERS users, numbered from first
+static void append_records(int first, int count)
+{
+    char user[32];
+    char serial[16];
+
+    for (int i = first; i < first + count; ++i) {
+        snprintf(user, sizeof(user), "user%d", i % USERS);
+        snprintf(serial, sizeof(serial), "%08d", i);
+        audit_event(PHASE_RESET, 0, user, NULL, serial);
+    }
+}
+
+static int test_audit(const char* path)
+{
+    CHECK(set_audit_log(path) == 0);
+
+    // Enough records for the query to build the index
+    append_records(0, RECORDS);
+
+    CHECK(count_matches(path, "user=user7") == RECORDS / USERS);
+    CHECK(count_matches(path, "serial=00000042") == 1);
+    CHECK(count_matches(path, "serial=42") == 1);
+    CHECK(count_matches(path, "user=nobody") == 0);
+
+    // Records appended after the index was built are found too
+    audit_subject("User7", "0123456789ABCDEF0123456789ABCDEF01234567", NULL);
+    audit_phase(PHASE_MASTERKEY, 0, 1.5);
+    audit_clear();
+    audit_phase(PHASE_STATUS, 1, 0.1);
+
+    CHECK(count_matches(path, "user=USER7") == RECORDS / USERS + 1);
+    CHECK(count_matches(path,
+                        "fpr=0123456789abcdef0123456789abcdef01234567") == 1);
+
+    CHECK(count_matches(path, "email=user7") == -1);
+    CHECK(count_matches(path, "user") == -1);
+    CHECK(indexed_records(path) == RECORDS);
+
+    // Enough new records for a second merge into the existing index, which
+    // must keep the entries of the first one
+    append_records(RECORDS, RECORDS);
+    CHECK(count_matches(path, "user=user7") == 2 * RECORDS / USERS + 1);
+    CHECK(indexed_records(path) == 2 * RECORDS + 2);
+    CHECK(count_matches(path, "serial=00000042") == 1);
+    CHECK(count_matches(path, "serial=00004242") == 1);
+    CHECK(count_matches(path,
+                        "fpr=0123456789abcdef0123456789abcdef01234567") == 1);
+    CHECK(count_matches(path, "serial=00006000") == 0);
+
+    return 0;
+}
+
+int main(int __attribute__((unused)) argc, char __attribute__((unused)) ** argv)
+{
+    char dir[] = "/tmp/test_audit.XXXXXX";
+    char path[64];
+    char index_path[64];
+
+    set_log_file(stderr);
+
+    if (!mkdtemp(dir))
+        return 1;
+    snprintf(path, sizeof(path), "%s/audit.log", dir);
+    snprintf(index_path, sizeof(index_path), "%s/audit.log.idx", dir);
+
+    int err = test_audit(path);
+
+    unlink(path);
+    unlink(index_path);
+    rmdir(dir);
+
+    return err;
+}
@@ -0,0 +1,171 @@
+/*
+Copyright (C) 2016 Aurelien Vallee
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <yubimgr/yubimgr.h>
+#include <yubimgr/audit.h>
+#include <yubimgr/keygen.h>
+#include <yubimgr/logging.h>
+#include <yubimgr/personalize.h>
+
+#include "check.h"
+#include "mock_card.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static const char* _passphrase = "correct horse battery staple";
+
+// Whether the audit records of path matching query include phase
+static int audited(const char* path, const char* query, const char* phase)
+{
+    char* output = NULL;
+    size_t size  = 0;
+    char needle[64];
+
+    FILE* out = open_memstream(&output, &size);
+    int err   = audit_query(path, query, out);
+    fclose(out);
+
+    snprintf(needle, sizeof(needle), " %s ", phase);
+    int found = !err && output && strstr(output, needle);
+    free(output);
+
+    return found;
+}
+
+// Counts the secret key packets of the backups in dir, and those protected
+// with a S2K. Returns 1 when gpg cannot list them.
+static int backup_packets(const char* dir, int* secret, int* protected)
+{
+    char command[1024];
+    char line[256];
+
+    *secret    = 0;
+    *protected = 0;
+
+    snprintf(command, sizeof(command),
+             "cat \"%s\"/*.asc | gpg --list-packets 2>/dev/null", dir);
+    FILE* gpg = popen(command, "r");
+    if (!gpg) {
+        perror("popen");
+        return 1;
+    }
+    while (fgets(line, sizeof(line), gpg)) {
+        if (!strncmp(line, ":secret ", 8))
+            (*secret)++;
+        else if (strstr(line, " S2K, "))
+            (*protected)++;
+    }
+
+    return pclose(gpg) != 0;
+}
+
+// Host generated subkeys are moved to the card under its admin PIN, and not
+// the masterkey passphrase, before the card is personalized
+static int test_keytocard()
+{
+    struct personalization config = {0};
+    config.new_admin_pin = "87654321";
+    set_personalization(&config);
+
+    char audit_log[512];
+    snprintf(audit_log, sizeof(audit_log), "%s/audit.log", getenv("GNUPGHOME"));
+    CHECK(set_audit_log(audit_log) == 0);
+
+    CHECK(bootstrap("jdoe", "John", "Doe", "jdoe@example.com", _passphrase) ==
+          0);
+
+    // Steps before the card is first opened are recorded against it too
+    CHECK(audited(audit_log, "serial=12345678", "setup"));
+
+    // The host subkeys are backed up under the masterkey passphrase, like
+    // the masterkey itself
+    int secret;
+    int protected;
+    CHECK(backup_packets(getenv("GNUPGHOME"), &secret, &protected) == 0);
+    CHECK(secret == 1 + 3);
+    CHECK(protected == secret);
+
+    return 0;
+}
+
+// keytocard fails with a wrong admin PIN, and so does bootstrap()
+static int test_wrong_admin_pin()
+{
+    struct personalization config = {0};
+    config.admin_pin = "11111111";
+    set_personalization(&config);
+
+    CHECK(bootstrap("jdoe", "John", "Doe", "jdoe@example.com", _passphrase) !=
+          0);
+
+    return 0;
+}
+
+// Each bootstrap() runs from its own process, as GPGME resolves the agent
+// socket of the card stages once per process
+static int run(int (*test)())
+{
+    int status = 1;
+
+    pid_t pid = fork();
+    if (pid == 0)
+        _exit(test());
+
+    if (pid < 0 || waitpid(pid, &status, 0) < 0)
+        status = 1;
+
+    return !WIFEXITED(status) || WEXITSTATUS(status);
+}
+
+int main(int __attribute__((unused)) argc, char __attribute__((unused)) ** argv)
+{
+    char homedir[256];
+    char fpr[41];
+
+    set_log_file(stderr);
+    set_log_level(LOG_LEVEL_DEBUG);
+
+    if (mock_card_available() || mock_gpg_available())
+        return TEST_SKIPPED;
+
+    // The temporary keyrings of bootstrap() use the mock scdaemon of this
+    // one, where masterkeys are backed up
+    if (mock_card_create(homedir, sizeof(homedir)))
+        return 1;
+    setenv("GNUPGHOME", homedir, 1);
+    set_keygen(KEYGEN_HOST, KEYGEN_RSA2048);
+    set_backup_dir(homedir);
+
+    int err = mock_key_create(homedir, "Probe <probe@example.com>", "ed25519",
+                              "sign", NULL, fpr, sizeof(fpr));
+    if (!err)
+        err = mock_keyring_available(fpr)
+                  ? TEST_SKIPPED
+                  : run(test_keytocard) || run(test_wrong_admin_pin);
+
+    mock_card_destroy(homedir);
+
+    return err;
+}
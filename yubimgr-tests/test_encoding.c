@@ -0,0 +1,70 @@
+/*
+Copyright (C) 2016 Aurelien Vallee
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <yubimgr/logging.h>
+
+#include "check.h"
+#include "encoding.h"
+
+#include <gcrypt.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int test_base64()
+{
+    static const char* expected[] = {"",     "Zg==",     "Zm8=",    "Zm9v",
+                                     "Zm9vYg==", "Zm9vYmE=", "Zm9vYmFy"};
+    char out[16];
+
+    for (size_t i = 0; i < sizeof(expected) / sizeof(expected[0]); ++i) {
+        size_t size = base64_encode((const unsigned char*)"foobar", i, out);
+        CHECK(size == strlen(expected[i]));
+        CHECK(!strcmp(out, expected[i]));
+    }
+
+    return 0;
+}
+
+static int test_zbase32()
+{
+    // Web Key Directory example from draft-koch-openpgp-webkey-service
+    unsigned char digest[20];
+    char out[ZBASE32_SIZE(sizeof(digest))];
+
+    gcry_md_hash_buffer(GCRY_MD_SHA1, digest, "joe.doe", 7);
+    CHECK(zbase32_encode(digest, sizeof(digest), out) == 32);
+    CHECK(!strcmp(out, "iy9q119eutrkn8s1mk4r39qejnbu3n5q"));
+
+    CHECK(zbase32_encode((const unsigned char*)"\xf0", 1, out) == 2);
+    CHECK(!strcmp(out, "6y"));
+
+    return 0;
+}
+
+int main(int __attribute__((unused)) argc, char __attribute__((unused)) ** argv)
+{
+    set_log_file(stderr);
+    gcry_check_version(NULL);
+
+    return test_base64() || test_zbase32();
+}
@@ -0,0 +1,115 @@
+/*
+Copyright (C) 2016 Aurelien Vallee
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <yubimgr/yubimgr.h>
+#include <yubimgr/logging.h>
+
+#include "check.h"
+#include "mock_card.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Counts the lines of path starting with prefix
+static size_t count_lines(const char* path, const char* prefix)
+{
+    char line[1024];
+    size_t count = 0;
+
+    FILE* file = fopen(path, "r");
+    if (!file)
+        return 0;
+    while (fgets(line, sizeof(line), file))
+        count += !strncmp(line, prefix, strlen(prefix));
+    fclose(file);
+
+    return count;
+}
+
+static int test_export_csr(const char* homedir, const char* rsa_fpr)
+{
+    char output[512];
+    char manifest[512];
+    char entry[256];
+
+    snprintf(output, sizeof(output), "%s/csr.pem", homedir);
+    snprintf(manifest, sizeof(manifest), "%s/csr.pem.manifest", homedir);
+    snprintf(entry, sizeof(entry), "rsa@example.com\trsa@example.com\t%s\t",
+             rsa_fpr);
+
+    static const char* rsa[] = {"rsa@example.com", NULL};
+    CHECK(export_csr(rsa, output, "O=Corp,C=FR") == 0);
+    CHECK(count_lines(output, "-----BEGIN CERTIFICATE REQUEST-----") == 1);
+    CHECK(count_lines(output, "-----END CERTIFICATE REQUEST-----") == 1);
+    CHECK(count_lines(output, "# rsa@example.com <rsa@example.com> ") == 1);
+    CHECK(count_lines(manifest, "# username\temail\tmasterkey\tsubkey\t") ==
+          1);
+    CHECK(count_lines(manifest, entry) == 1);
+    CHECK(count_lines(manifest, "") == 2);
+
+    // DSA cannot sign a CSR: the export fails, but still covers the other
+    // keys. Keys without authentication subkey are left out.
+    static const char* all[] = {NULL};
+    CHECK(export_csr(all, output, NULL) != 0);
+    CHECK(count_lines(output, "-----BEGIN CERTIFICATE REQUEST-----") == 1);
+    CHECK(count_lines(output, "# dsa@example.com") == 0);
+    CHECK(count_lines(manifest, entry) == 1);
+    CHECK(count_lines(manifest, "") == 2);
+
+    return 0;
+}
+
+int main(int __attribute__((unused)) argc, char __attribute__((unused)) ** argv)
+{
+    char homedir[256];
+    char rsa_fpr[41];
+    char fpr[41];
+
+    set_log_file(stderr);
+    set_log_level(LOG_LEVEL_DEBUG);
+
+    if (mock_gpg_available() ||
+        system("gpgsm --version >/dev/null 2>&1"))
+        return TEST_SKIPPED;
+
+    if (mock_keyring_create(homedir, sizeof(homedir)))
+        return 1;
+    setenv("GNUPGHOME", homedir, 1);
+
+    int err =
+        mock_key_create(homedir, "Rsa User <rsa@example.com>", "ed25519",
+                        "sign", NULL, rsa_fpr, sizeof(rsa_fpr)) ||
+        mock_subkey_add(homedir, rsa_fpr, "rsa2048", "auth", NULL) ||
+        mock_key_create(homedir, "Dsa User <dsa@example.com>", "dsa2048",
+                        "auth", NULL, fpr, sizeof(fpr)) ||
+        mock_key_create(homedir, "Sign User <sign@example.com>", "ed25519",
+                        "sign", NULL, fpr, sizeof(fpr));
+
+    if (!err)
+        err = mock_keyring_available(rsa_fpr)
+                  ? TEST_SKIPPED
+                  : test_export_csr(homedir, rsa_fpr);
+
+    mock_card_destroy(homedir);
+
+    return err;
+}
@@ -0,0 +1,132 @@
+/*
+Copyright (C) 2016 Aurelien Vallee
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <yubimgr/keygen.h>
+#include <yubimgr/logging.h>
+
+#include "check.h"
+#include "hostkey.h"
+
+#include <gcrypt.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static int test_profiles()
+{
+    enum KEYGEN_PROFILE profile;
+
+    for (int i = 0; i < KEYGEN_PROFILE_COUNT; ++i) {
+        CHECK(keygen_parse_profile(keygen_profile_name(i), &profile) == 0);
+        CHECK(profile == (enum KEYGEN_PROFILE)i);
+    }
+    CHECK(keygen_parse_profile("dsa1024", &profile) != 0);
+
+    return 0;
+}
+
+static int test_generate(enum KEYGEN_PROFILE profile, unsigned int nbits)
+{
+    struct hostkey keys[SUBKEY_COUNT];
+
+    CHECK(hostkey_generate(profile, keys, 1) == 0);
+
+    for (int i = 0; i < SUBKEY_COUNT; ++i) {
+        CHECK(keys[i].usage == (enum SUBKEY_USAGE)i);
+        CHECK(strlen(keys[i].keygrip) == 40);
+        CHECK(gcry_pk_get_nbits(keys[i].private_key) == nbits);
+        for (int j = 0; j < i; ++j)
+            CHECK(strcmp(keys[i].keygrip, keys[j].keygrip));
+    }
+
+    hostkey_release(keys);
+
+    return 0;
+}
+
+// Keys are handed over to gpg-agent as KEYGRIP.key canonical S-expressions
+static int test_store(const char* homedir)
+{
+    struct hostkey keys[SUBKEY_COUNT];
+    char path[1024];
+
+    CHECK(hostkey_generate(KEYGEN_ED25519, keys, 0) == 0);
+
+    for (int i = 0; i < SUBKEY_COUNT; ++i) {
+        CHECK(hostkey_store(&keys[i], homedir) == 0);
+
+        snprintf(path, sizeof(path), "%s/private-keys-v1.d/%s.key", homedir,
+                 keys[i].keygrip);
+
+        struct stat st;
+        CHECK(stat(path, &st) == 0);
+        CHECK((st.st_mode & 0777) == 0600);
+
+        char buffer[512];
+        FILE* file  = fopen(path, "r");
+        size_t size = file ? fread(buffer, 1, sizeof(buffer), file) : 0;
+        if (file)
+            fclose(file);
+
+        gcry_sexp_t key;
+        unsigned char grip[20];
+        char keygrip[41];
+        CHECK(size > 0 && gcry_sexp_new(&key, buffer, size, 0) == 0);
+        CHECK(gcry_pk_get_keygrip(key, grip) != NULL);
+        for (size_t j = 0; j < sizeof(grip); ++j)
+            snprintf(keygrip + 2 * j, 3, "%02X", grip[j]);
+        CHECK(!strcmp(keygrip, keys[i].keygrip));
+        gcry_sexp_release(key);
+
+        // Keys are never overwritten
+        CHECK(hostkey_store(&keys[i], homedir) != 0);
+
+        unlink(path);
+    }
+
+    hostkey_release(keys);
+
+    snprintf(path, sizeof(path), "%s/private-keys-v1.d", homedir);
+    rmdir(path);
+
+    return 0;
+}
+
+int main(int __attribute__((unused)) argc, char __attribute__((unused)) ** argv)
+{
+    char homedir[] = "/tmp/test_hostkey.XXXXXX";
+
+    set_log_file(stderr);
+    gcry_check_version(NULL);
+
+    if (!mkdtemp(homedir))
+        return 1;
+
+    int err = test_profiles() || test_generate(KEYGEN_ED25519, 255) ||
+              test_generate(KEYGEN_RSA2048, 2048) || test_store(homedir);
+
+    rmdir(homedir);
+
+    return err;
+}
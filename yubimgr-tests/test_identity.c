@@ -0,0 +1,153 @@
+/*
+Copyright (C) 2016 Aurelien Vallee
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <yubimgr/identity.h>
+#include <yubimgr/logging.h>
+
+#include "check.h"
+#include "identity_index.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define FPR "0123456789ABCDEF0123456789ABCDEF01234567"
+
+static int test_identity(const char* index_path)
+{
+    char fpr[41];
+    char key[64];
+
+    CHECK(identity_key("email", "John.Doe@Example.COM", key, sizeof(key)) ==
+          0);
+    CHECK(!strcmp(key, "email:john.doe@example.com"));
+    CHECK(identity_key("fpr", "0123abcd", key, sizeof(key)) == 0);
+    CHECK(!strcmp(key, "fpr:0123ABCD"));
+    CHECK(identity_key("user", "", key, sizeof(key)) != 0);
+
+    // Nothing is indexed until the first bootstrap
+    set_identity_index(index_path);
+    CHECK(identity_find("jdoe", "john.doe@example.com", fpr, sizeof(fpr)) ==
+          0);
+
+    CHECK(identity_record("jdoe", "John.Doe@example.com", FPR) == 0);
+    CHECK(identity_find("JDoe", NULL, fpr, sizeof(fpr)) == 1);
+    CHECK(!strcmp(fpr, FPR));
+    CHECK(identity_find("someone", "JOHN.DOE@EXAMPLE.COM", fpr,
+                        sizeof(fpr)) == 1);
+    CHECK(identity_find("someone", "someone@example.com", fpr, sizeof(fpr)) ==
+          0);
+
+    // An unreadable index is not mistaken for an empty one
+    char corrupted[80];
+    snprintf(corrupted, sizeof(corrupted), "%s.corrupted", index_path);
+    FILE* file = fopen(corrupted, "w");
+    CHECK(file);
+    fputs("not an index\n", file);
+    fclose(file);
+    set_identity_index(corrupted);
+    CHECK(identity_find("jdoe", NULL, fpr, sizeof(fpr)) < 0);
+    unlink(corrupted);
+    set_identity_index(index_path);
+
+    return 0;
+}
+
+static int test_roster(const char* roster_path, const char* rejected_path)
+{
+    struct roster roster;
+    char line[256];
+
+    FILE* file = fopen(roster_path, "w");
+    CHECK(file);
+    fputs("username,firstname,lastname,email\n"
+          "asmith, Alice, Smith, alice.smith@example.com\r\n"
+          "jdoe,John,Doe,john.doe@example.com\n"
+          "\n"
+          "bmartin,Bob,Martin,bob.martin@example.com\n"
+          "ASmith,Alice,Smith,alice@example.com\n"
+          "bob,Bob,Martin,Bob.Martin@example.com\n"
+          "broken,row\n"
+          "cdupont,Claire,Dupont,claire.dupont@example.com",
+          file);
+    CHECK(fclose(file) == 0);
+
+    FILE* rejected = fopen(rejected_path, "w");
+    CHECK(rejected);
+    CHECK(roster_load(roster_path, rejected, &roster) == 0);
+    CHECK(fclose(rejected) == 0);
+
+    CHECK(roster.count == 3);
+    CHECK(!strcmp(roster.identities[0].username, "asmith"));
+    CHECK(!strcmp(roster.identities[0].firstname, "Alice"));
+    CHECK(!strcmp(roster.identities[0].email, "alice.smith@example.com"));
+    CHECK(!strcmp(roster.identities[1].username, "bmartin"));
+    CHECK(!strcmp(roster.identities[2].username, "cdupont"));
+    CHECK(!strcmp(roster.identities[2].email, "claire.dupont@example.com"));
+    roster_release(&roster);
+
+    // The rejected rows, in order, with their reason
+    static const char* const expected[] = {
+        "jdoe,John,Doe,john.doe@example.com,has masterkey " FPR "\n",
+        "ASmith,Alice,Smith,alice@example.com,duplicate of row 2\n",
+        "bob,Bob,Martin,Bob.Martin@example.com,duplicate of row 5\n",
+        "broken,row,malformed\n",
+    };
+    rejected = fopen(rejected_path, "r");
+    CHECK(rejected);
+    for (size_t i = 0; i < sizeof(expected) / sizeof(expected[0]); ++i)
+        CHECK(fgets(line, sizeof(line), rejected) &&
+              !strcmp(line, expected[i]));
+    CHECK(!fgets(line, sizeof(line), rejected));
+    fclose(rejected);
+
+    return 0;
+}
+
+int main(int __attribute__((unused)) argc, char __attribute__((unused)) ** argv)
+{
+    char dir[] = "/tmp/test_identity.XXXXXX";
+    char index_path[64];
+    char lock_path[64];
+    char roster_path[64];
+    char rejected_path[64];
+
+    set_log_file(stderr);
+
+    if (!mkdtemp(dir))
+        return 1;
+    snprintf(index_path, sizeof(index_path), "%s/identities", dir);
+    snprintf(lock_path, sizeof(lock_path), "%s/identities.lock", dir);
+    snprintf(roster_path, sizeof(roster_path), "%s/roster.csv", dir);
+    snprintf(rejected_path, sizeof(rejected_path), "%s/rejected.csv", dir);
+
+    int err = test_identity(index_path) ||
+              test_roster(roster_path, rejected_path);
+
+    unlink(index_path);
+    unlink(lock_path);
+    unlink(roster_path);
+    unlink(rejected_path);
+    rmdir(dir);
+
+    return err;
+}
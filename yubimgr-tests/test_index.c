@@ -0,0 +1,115 @@
+/*
+Copyright (C) 2016 Aurelien Vallee
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <yubimgr/logging.h>
+
+#include "check.h"
+#include "index.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define ENTRIES 1000
+
+static int test_index(const char* path)
+{
+    struct index* index;
+    char key[32];
+    char value[INDEX_VALUE_SIZE];
+
+    // A table that was never written to is empty
+    CHECK(index_open(&index, path, 0) == 0);
+    CHECK(index_count(index) == 0);
+    CHECK(index_get(index, "email:user0@example.com") == NULL);
+    index_close(index);
+
+    // Enough entries to grow the table several times
+    CHECK(index_open(&index, path, 1) == 0);
+    for (int i = 0; i < ENTRIES; ++i) {
+        snprintf(key, sizeof(key), "email:user%d@example.com", i);
+        snprintf(value, sizeof(value), "%040d", i);
+        CHECK(index_put(index, key, value) == 0);
+    }
+
+    // Updates do not add entries, and leave the previous value intact for
+    // the readers still holding it
+    const char* previous = index_get(index, "email:user1@example.com");
+    snprintf(value, sizeof(value), "%040d", 1);
+    CHECK(index_put(index, "email:user1@example.com", "updated") == 0);
+    CHECK(!strcmp(previous, value));
+    CHECK(!strcmp(index_get(index, "email:user1@example.com"), "updated"));
+    CHECK(index_put(index, "email:user0@example.com", "updated") == 0);
+    CHECK(index_count(index) == ENTRIES);
+
+    // Tombstones are dropped when the table grows
+    for (int i = 0; i < ENTRIES; ++i)
+        CHECK(index_put(index, "email:user2@example.com",
+                        i % 2 ? "odd" : "even") == 0);
+    CHECK(index_count(index) == ENTRIES);
+    CHECK(!strcmp(index_get(index, "email:user2@example.com"), "odd"));
+
+    char long_key[INDEX_KEY_SIZE + 1];
+    memset(long_key, 'k', INDEX_KEY_SIZE);
+    long_key[INDEX_KEY_SIZE] = 0;
+    CHECK(index_put(index, long_key, "value") != 0);
+    index_close(index);
+
+    // Entries survive a reopen, read only
+    CHECK(index_open(&index, path, 0) == 0);
+    CHECK(index_count(index) == ENTRIES);
+    CHECK(!strcmp(index_get(index, "email:user0@example.com"), "updated"));
+    CHECK(!strcmp(index_get(index, "email:user1@example.com"), "updated"));
+    for (int i = 3; i < ENTRIES; ++i) {
+        snprintf(key, sizeof(key), "email:user%d@example.com", i);
+        snprintf(value, sizeof(value), "%040d", i);
+        const char* found = index_get(index, key);
+        CHECK(found && !strcmp(found, value));
+    }
+    CHECK(index_get(index, "email:nobody@example.com") == NULL);
+    CHECK(index_put(index, "fpr:0", "read only") != 0);
+    index_close(index);
+
+    return 0;
+}
+
+int main(int __attribute__((unused)) argc, char __attribute__((unused)) ** argv)
+{
+    char dir[] = "/tmp/test_index.XXXXXX";
+    char path[64];
+    char lock_path[64];
+
+    set_log_file(stderr);
+
+    if (!mkdtemp(dir))
+        return 1;
+    snprintf(path, sizeof(path), "%s/index", dir);
+    snprintf(lock_path, sizeof(lock_path), "%s/index.lock", dir);
+
+    int err = test_index(path);
+
+    unlink(path);
+    unlink(lock_path);
+    rmdir(dir);
+
+    return err;
+}
@@ -0,0 +1,171 @@
+/*
+Copyright (C) 2016 Aurelien Vallee
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <yubimgr/yubimgr.h>
+#include <yubimgr/logging.h>
+#include <yubimgr/metrics.h>
+
+#include "check.h"
+#include "mock_card.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MAX_FAMILIES 32
+
+// A metrics file, as read back by a textfile collector
+struct textfile {
+    char families[MAX_FAMILIES][64];
+    size_t family_count;
+    size_t sample_count;
+};
+
+static int has_family(const struct textfile* textfile, const char* name)
+{
+    for (size_t i = 0; i < textfile->family_count; ++i) {
+        size_t size = strlen(textfile->families[i]);
+        // Histograms samples are suffixed with _bucket, _sum and _count
+        if (!strncmp(name, textfile->families[i], size) &&
+            (!name[size] || !strcmp(name + size, "_bucket") ||
+             !strcmp(name + size, "_sum") || !strcmp(name + size, "_count")))
+            return 1;
+    }
+
+    return 0;
+}
+
+// Checks every line is a TYPE declaration or a sample of a declared family
+static int parse_textfile(const char* path, struct textfile* textfile)
+{
+    char line[256];
+    char name[128];
+    char type[32];
+    double value;
+
+    memset(textfile, 0, sizeof(*textfile));
+
+    FILE* file = fopen(path, "r");
+    CHECK(file);
+    while (fgets(line, sizeof(line), file)) {
+        CHECK(line[strlen(line) - 1] == '\n');
+        if (sscanf(line, "# TYPE %127s %31s", name, type) == 2) {
+            CHECK(!strcmp(type, "counter") || !strcmp(type, "gauge") ||
+                  !strcmp(type, "histogram"));
+            CHECK(!has_family(textfile, name));
+            CHECK(textfile->family_count < MAX_FAMILIES);
+            strcpy(textfile->families[textfile->family_count++], name);
+            continue;
+        }
+        char* labels = strchr(line, '{');
+        char* end    = strrchr(line, ' ');
+        CHECK(end && sscanf(end, " %lf", &value) == 1 && value >= 0);
+        size_t size = labels ? (size_t)(labels - line) : (size_t)(end - line);
+        CHECK(size < sizeof(name));
+        memcpy(name, line, size);
+        name[size] = 0;
+        CHECK(!labels || end[-1] == '}');
+        CHECK(has_family(textfile, name));
+        textfile->sample_count++;
+    }
+    fclose(file);
+
+    return 0;
+}
+
+static int test_metrics(const char* path)
+{
+    struct textfile textfile;
+    char tmp_path[320];
+
+    CHECK(reset() == 0);
+    CHECK(reset() == 0);
+    set_queue_depth(3);
+    CHECK(write_metrics(path) == 0);
+
+    // Nothing is left aside
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    CHECK(access(tmp_path, F_OK) != 0);
+
+    CHECK(parse_textfile(path, &textfile) == 0);
+    CHECK(textfile.sample_count > 0);
+
+    CHECK(mock_metric(path,
+                      "yubimgr_cards_processed_total{action=\"reset\"}") == 2);
+    CHECK(mock_metric(path, "yubimgr_resets_total{outcome=\"success\"}") == 2);
+    CHECK(mock_metric(path, "yubimgr_resets_total{outcome=\"failure\"}") == 0);
+    CHECK(mock_metric(path,
+                      "yubimgr_phase_failures_total{phase=\"reset\"}") == 0);
+    CHECK(mock_metric(path, "yubimgr_queue_depth") == 3);
+
+    // Buckets are cumulative, up to the total count
+    static const double buckets[] = {0.1, 0.25, 0.5, 1,  2.5, 5,
+                                     10,  30,   60,  120, 300};
+    double previous = 0;
+    for (size_t i = 0; i < sizeof(buckets) / sizeof(buckets[0]); ++i) {
+        char name[128];
+        snprintf(name, sizeof(name),
+                 "yubimgr_phase_duration_seconds_bucket"
+                 "{phase=\"reset\",le=\"%g\"}",
+                 buckets[i]);
+        double value = mock_metric(path, name);
+        CHECK(value >= previous);
+        previous = value;
+    }
+    double count = mock_metric(
+        path, "yubimgr_phase_duration_seconds_count{phase=\"reset\"}");
+    CHECK(count == 2);
+    CHECK(previous <= count);
+    CHECK(mock_metric(path, "yubimgr_phase_duration_seconds_bucket"
+                            "{phase=\"reset\",le=\"+Inf\"}") == count);
+    CHECK(mock_metric(
+              path, "yubimgr_phase_duration_seconds_sum{phase=\"reset\"}") > 0);
+
+    // Written again, the file is replaced
+    set_queue_depth(0);
+    CHECK(write_metrics(path) == 0);
+    CHECK(mock_metric(path, "yubimgr_queue_depth") == 0);
+
+    return 0;
+}
+
+int main(int __attribute__((unused)) argc, char __attribute__((unused)) ** argv)
+{
+    char homedir[256];
+    char path[300];
+
+    set_log_file(stderr);
+
+    if (mock_card_available())
+        return TEST_SKIPPED;
+    if (mock_card_create(homedir, sizeof(homedir)))
+        return 1;
+    setenv("GNUPGHOME", homedir, 1);
+    snprintf(path, sizeof(path), "%s/yubimgr.prom", homedir);
+
+    int err = test_metrics(path);
+
+    unlink(path);
+    mock_card_destroy(homedir);
+
+    return err;
+}
@@ -0,0 +1,286 @@
+/*
+Copyright (C) 2016 Aurelien Vallee
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <yubimgr/yubimgr.h>
+#include <yubimgr/logging.h>
+#include <yubimgr/metrics.h>
+#include <yubimgr/personalize.h>
+#include <yubimgr/piv.h>
+#include <yubimgr/timeout.h>
+
+#include "check.h"
+#include "mock_card.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+static int test_card()
+{
+    static const unsigned char management_key[24] = {
+        0xA1, 0xA2, 0xA3, 0xA4, 0xA5, 0xA6, 0xA7, 0xA8,
+        0xA1, 0xA2, 0xA3, 0xA4, 0xA5, 0xA6, 0xA7, 0xA8,
+        0xA1, 0xA2, 0xA3, 0xA4, 0xA5, 0xA6, 0xA7, 0xA8};
+
+    CHECK(reset() == 0);
+    // A reset card can be reset again
+    CHECK(reset() == 0);
+
+    char public_key[256];
+    snprintf(public_key, sizeof(public_key), "%s/9c.pem", getenv("GNUPGHOME"));
+
+    struct piv_config piv = {0};
+    piv.reset                   = 1;
+    piv.pin                     = "654321";
+    piv.puk                     = "87654321";
+    piv.new_management_key      = management_key;
+    piv.new_management_key_size = sizeof(management_key);
+    piv.slots[PIV_SLOT_AUTHENTICATION].algorithm = PIV_ALGO_RSA2048;
+    piv.slots[PIV_SLOT_SIGNATURE].algorithm      = PIV_ALGO_ECCP256;
+    piv.slots[PIV_SLOT_SIGNATURE].public_key     = public_key;
+    CHECK(piv_provision(&piv) == 0);
+
+    // The generated P-256 key is written as a SubjectPublicKeyInfo
+    char line[128];
+    FILE* file = fopen(public_key, "r");
+    CHECK(file);
+    CHECK(fgets(line, sizeof(line), file) &&
+          !strcmp(line, "-----BEGIN PUBLIC KEY-----\n"));
+    CHECK(fgets(line, sizeof(line), file) &&
+          !strncmp(line, "MFkwEwYHKoZIzj0CAQYIKoZIzj0DAQcDQgAE", 36) &&
+          strlen(line) == 65);
+    CHECK(fgets(line, sizeof(line), file) && strlen(line) == 61);
+    CHECK(fgets(line, sizeof(line), file) &&
+          !strcmp(line, "-----END PUBLIC KEY-----\n"));
+    fclose(file);
+
+    // The management key changed, the factory one is refused now
+    piv.reset = 0;
+    piv.pin   = NULL;
+    piv.puk   = NULL;
+    CHECK(piv_provision(&piv) != 0);
+    piv.management_key      = management_key;
+    piv.management_key_size = sizeof(management_key);
+    CHECK(piv_provision(&piv) == 0);
+
+    // Without a reset, the PIN only changes given the current one
+    piv.pin = "111111";
+    CHECK(piv_provision(&piv) != 0);
+    piv.current_pin = "654321";
+    CHECK(piv_provision(&piv) == 0);
+    piv.current_pin = "111111";
+    piv.pin         = "222222";
+    CHECK(piv_provision(&piv) == 0);
+
+    return 0;
+}
+
+static int test_aes_card()
+{
+    static const unsigned char management_key[32] = {
+        0xB1, 0xB2, 0xB3, 0xB4, 0xB5, 0xB6, 0xB7, 0xB8,
+        0xB1, 0xB2, 0xB3, 0xB4, 0xB5, 0xB6, 0xB7, 0xB8,
+        0xB1, 0xB2, 0xB3, 0xB4, 0xB5, 0xB6, 0xB7, 0xB8,
+        0xB1, 0xB2, 0xB3, 0xB4, 0xB5, 0xB6, 0xB7, 0xB8};
+
+    // The factory key is AES-192 on this card, as asked to GET METADATA
+    struct piv_config piv = {0};
+    piv.new_management_algorithm = PIV_ALGO_AES256;
+    piv.new_management_key       = management_key;
+    piv.new_management_key_size  = sizeof(management_key);
+    CHECK(piv_provision(&piv) == 0);
+
+    // A key of the wrong algorithm is refused
+    piv.new_management_key   = NULL;
+    piv.management_algorithm = PIV_ALGO_AES192;
+    piv.management_key       = management_key;
+    piv.management_key_size  = sizeof(management_key);
+    CHECK(piv_provision(&piv) != 0);
+    piv.management_algorithm = PIV_ALGO_AES256;
+    CHECK(piv_provision(&piv) == 0);
+    piv.management_algorithm = PIV_ALGO_NONE;
+    CHECK(piv_provision(&piv) == 0);
+
+    return 0;
+}
+
+static int test_personalize()
+{
+    struct personalization config = {0};
+    config.new_admin_pin = "87654321";
+    config.new_user_pin  = "654321";
+    config.reset_code    = "11223344";
+    config.firstname     = "John Paul";
+    config.lastname      = "Doe";
+    config.login         = "jdoe";
+    config.language      = "en";
+    config.url           = "https://keys.example.org/jdoe.asc";
+    config.touch[CARD_KEY_SIGNATURE] = TOUCH_FIXED;
+    config.touch[CARD_KEY_AUTHENTICATION] = TOUCH_ON;
+    CHECK(personalize(&config) == 0);
+
+    // The admin PIN changed, the factory one is refused now
+    config.new_admin_pin = NULL;
+    config.new_user_pin  = NULL;
+    CHECK(personalize(&config) != 0);
+
+    // A fixed touch policy cannot be changed: the batch fails and the PINs
+    // are left untouched
+    config.admin_pin                 = "87654321";
+    config.user_pin                  = "654321";
+    config.new_user_pin              = "111111";
+    config.touch[CARD_KEY_SIGNATURE] = TOUCH_OFF;
+    CHECK(personalize(&config) != 0);
+
+    config.new_user_pin              = NULL;
+    config.touch[CARD_KEY_SIGNATURE] = TOUCH_UNSET;
+    CHECK(personalize(&config) == 0);
+
+    // Still the user PIN set by the first run
+    config.new_user_pin = "222222";
+    CHECK(personalize(&config) == 0);
+
+    // The admin PIN is changed first, and kept when the user PIN change
+    // fails
+    config.new_admin_pin = "12121212";
+    config.user_pin      = "000000";
+    config.new_user_pin  = "333333";
+    CHECK(personalize(&config) != 0);
+    config.admin_pin     = "12121212";
+    config.user_pin      = "222222";
+    config.new_admin_pin = NULL;
+    CHECK(personalize(&config) == 0);
+
+    return 0;
+}
+
+static int test_failing_card()
+{
+    // TERMINATE DF is refused by this card
+    CHECK(reset() != 0);
+
+    return 0;
+}
+
+static int test_unblockable_card()
+{
+    struct timespec start, end;
+
+    // VERIFY always fails with 6F00: blocking the PINs must give up at once
+    // instead of sending it 256 times
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    CHECK(reset() != 0);
+    struct piv_config piv = {0};
+    piv.reset             = 1;
+    CHECK(piv_provision(&piv) != 0);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    CHECK(end.tv_sec - start.tv_sec < 5);
+
+    return 0;
+}
+
+static int test_stuck_card()
+{
+    struct timespec start, end;
+
+    // TERMINATE DF never answers in time, the reset must be cancelled
+    set_phase_timeout(PHASE_RESET, 2);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    CHECK(reset() != 0);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    CHECK(end.tv_sec - start.tv_sec < 8);
+
+    return 0;
+}
+
+static int test_flaky_card()
+{
+    char path[300];
+
+    // Transport errors are retried from a fresh session
+    CHECK(reset() == 0);
+    CHECK(reset() == 0);
+
+    // This seed injects failures, which were retried rather than lucky
+    snprintf(path, sizeof(path), "%s/yubimgr.prom", getenv("GNUPGHOME"));
+    CHECK(write_metrics(path) == 0);
+    CHECK(mock_metric(path, "yubimgr_card_retries_total") > 0);
+    CHECK(mock_metric(path, "yubimgr_resets_total{outcome=\"success\"}") ==
+          2);
+
+    return 0;
+}
+
+// Each virtual card is used from its own process, as GPGME resolves the
+// agent socket once per process. env holds NAME, VALUE pairs passed to the
+// mock scdaemon.
+static int run(int (*test)(), const char* const env[])
+{
+    char homedir[256];
+    int status = 1;
+
+    if (mock_card_create(homedir, sizeof(homedir)))
+        return 1;
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        // The agent is spawned with this environment, and passes it on to
+        // the mock scdaemon
+        setenv("GNUPGHOME", homedir, 1);
+        for (size_t i = 0; env && env[i]; i += 2)
+            setenv(env[i], env[i + 1], 1);
+        _exit(test());
+    }
+
+    if (pid < 0 || waitpid(pid, &status, 0) < 0)
+        status = 1;
+
+    mock_card_destroy(homedir);
+
+    return !WIFEXITED(status) || WEXITSTATUS(status);
+}
+
+int main(int __attribute__((unused)) argc, char __attribute__((unused)) ** argv)
+{
+    set_log_file(stderr);
+    set_log_level(LOG_LEVEL_DEBUG);
+
+    if (mock_card_available())
+        return TEST_SKIPPED;
+
+    static const char* const failing[] = {"YUBIMGR_MOCK_FAIL_INS", "E6", NULL};
+    static const char* const stuck[]   = {"YUBIMGR_MOCK_LATENCY_E6", "10000",
+                                        NULL};
+    static const char* const aes[] = {"YUBIMGR_MOCK_PIV_MANAGEMENT", "0A",
+                                      NULL};
+    static const char* const unblockable[] = {
+        "YUBIMGR_MOCK_FAIL_INS", "20", "YUBIMGR_MOCK_LATENCY_20", "50", NULL};
+    static const char* const flaky[]   = {"YUBIMGR_MOCK_FAIL_RATE", "0.05",
+                                        "YUBIMGR_MOCK_SEED", "4", NULL};
+
+    return run(test_card, NULL) || run(test_aes_card, aes) ||
+           run(test_personalize, NULL) || run(test_failing_card, failing) ||
+           run(test_unblockable_card, unblockable) ||
+           run(test_stuck_card, stuck) || run(test_flaky_card, flaky);
+}
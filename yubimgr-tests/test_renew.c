@@ -0,0 +1,250 @@
+/*
+Copyright (C) 2016 Aurelien Vallee
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <yubimgr/logging.h>
+#include <yubimgr/renew.h>
+
+#include "check.h"
+#include "mock_card.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define ALICE 0
+#define BOB 1
+#define CAROL 2
+
+// Named as an export, but not a key
+#define CORRUPTED "FFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFF"
+
+static const char* _passphrase = "renew passphrase";
+
+// Exports the secret key fpr of homedir to the vault file name
+static int export_secret(const char* homedir, const char* fpr, const char* name)
+{
+    char command[1024];
+
+    snprintf(command, sizeof(command),
+             "gpg --homedir \"%s\" --batch --pinentry-mode loopback "
+             "--passphrase \"%s\" --armor --export-secret-keys %s "
+             ">\"%s/vault/%s\" 2>/dev/null",
+             homedir, _passphrase, fpr, homedir, name);
+
+    return system(command) != 0;
+}
+
+static int write_file(const char* homedir, const char* name, const char* data)
+{
+    char path[512];
+
+    snprintf(path, sizeof(path), "%s/vault/%s", homedir, name);
+    FILE* file = fopen(path, "w");
+    if (!file)
+        return 1;
+    fputs(data, file);
+
+    return fclose(file) != 0;
+}
+
+// Field n (from 1) of a gpg colon record, line is modified
+static const char* field(char* line, int n)
+{
+    char* start = line;
+
+    for (int i = 1; i < n && start; ++i)
+        if ((start = strchr(start, ':')))
+            ++start;
+    if (!start)
+        return "";
+    start[strcspn(start, ":\n")] = 0;
+
+    return start;
+}
+
+// Lists the keys of a keyring file in order, and counts the subkeys having
+// an expiration date
+static size_t bundle_keys(const char* homedir,
+                          const char* path,
+                          char fprs[][41],
+                          size_t max,
+                          size_t* expiring)
+{
+    char command[1024];
+    char line[1024];
+    size_t count = 0;
+    int primary  = 0;
+
+    snprintf(command, sizeof(command),
+             "gpg --homedir \"%s\" --with-colons --show-keys \"%s\" "
+             "2>/dev/null",
+             homedir, path);
+    FILE* gpg = popen(command, "r");
+    if (!gpg)
+        return 0;
+
+    *expiring = 0;
+    while (fgets(line, sizeof(line), gpg)) {
+        if (!strncmp(line, "pub:", 4)) {
+            primary = 1;
+        } else if (!strncmp(line, "sub:", 4)) {
+            primary = 0;
+            *expiring += *field(line, 7) != 0;
+        } else if (!strncmp(line, "fpr:", 4) && primary && count < max) {
+            snprintf(fprs[count++], 41, "%s", field(line, 10));
+            primary = 0;
+        }
+    }
+    pclose(gpg);
+
+    return count;
+}
+
+static int test_renew(const char* homedir, char fprs[][41])
+{
+    char bundle[512];
+    char unmatched[512];
+    char alice_id[19] = "0x";
+    char keys[4][41];
+    size_t expiring;
+    int err;
+
+    snprintf(bundle, sizeof(bundle), "%s/renewed.gpg", homedir);
+    snprintf(unmatched, sizeof(unmatched), "%s/unmatched.gpg", homedir);
+
+    // Key IDs are fingerprint suffixes, matched whatever their case
+    for (size_t i = 0; i < 16; ++i)
+        alice_id[2 + i] = (char)tolower((unsigned char)fprs[ALICE][24 + i]);
+    alice_id[18] = 0;
+
+    struct renewal config = {0};
+    char vault[512];
+    char metrics[512];
+    snprintf(vault, sizeof(vault), "%s/vault", homedir);
+    snprintf(metrics, sizeof(metrics), "%s/renew.prom", homedir);
+    config.vault      = vault;
+    config.expire     = "2y";
+    config.passphrase = _passphrase;
+    config.workers    = 2;
+    config.metrics    = metrics;
+
+    // The corrupted export fails, the others are still renewed and bundled
+    // in fingerprint order. Carol is not asked for.
+    const char* patterns[] = {alice_id, fprs[BOB], CORRUPTED + 24, NULL};
+    CHECK(renew(&config, patterns, bundle) != 0);
+
+    size_t count = bundle_keys(homedir, bundle, keys, 4, &expiring);
+    CHECK(count == 2);
+    int alice_first = strcasecmp(fprs[ALICE], fprs[BOB]) < 0;
+    CHECK(!strcasecmp(keys[0], fprs[alice_first ? ALICE : BOB]));
+    CHECK(!strcasecmp(keys[1], fprs[alice_first ? BOB : ALICE]));
+    // Alice's two subkeys were expired at once, as was Bob's single one
+    CHECK(expiring == 3);
+    // Workers flushed the metrics as they went, the queue is drained
+    CHECK(mock_metric(metrics, "yubimgr_queue_depth") == 0);
+
+    // Patterns shorter than a key ID match nothing, no bundle is written
+    const char* short_id[] = {fprs[CAROL] + 34, NULL};
+    CHECK(renew(&config, short_id, unmatched) != 0);
+    CHECK(access(unmatched, F_OK) != 0);
+
+    // Every export of the vault, other files are left out. The failure is
+    // accounted for.
+    char log[512];
+    char line[256];
+    int accounted = 0;
+    snprintf(log, sizeof(log), "%s/renew.log", homedir);
+    FILE* file = fopen(log, "w+");
+    CHECK(file);
+    set_log_file(file);
+    err = renew(&config, NULL, bundle);
+    set_log_file(stderr);
+    rewind(file);
+    while (fgets(line, sizeof(line), file))
+        accounted |=
+            !strcmp(line, "Renewed 3 masterkeys out of 4 (1 failed).\n");
+    fclose(file);
+    CHECK(err != 0);
+    CHECK(accounted);
+    CHECK(bundle_keys(homedir, bundle, keys, 4, &expiring) == 3);
+    CHECK(expiring == 4);
+
+    return 0;
+}
+
+int main(int __attribute__((unused)) argc, char __attribute__((unused)) ** argv)
+{
+    char homedir[256];
+    char vault[512];
+    char fprs[3][41];
+    char name[64];
+
+    set_log_file(stderr);
+    set_log_level(LOG_LEVEL_DEBUG);
+
+    if (mock_gpg_available())
+        return TEST_SKIPPED;
+
+    if (mock_keyring_create(homedir, sizeof(homedir)))
+        return 1;
+    setenv("GNUPGHOME", homedir, 1);
+    snprintf(vault, sizeof(vault), "%s/vault", homedir);
+
+    int err =
+        mkdir(vault, 0700) ||
+        mock_key_create(homedir, "alice <alice@example.com>", "rsa2048",
+                        "sign", _passphrase, fprs[ALICE], 41) ||
+        mock_subkey_add(homedir, fprs[ALICE], "rsa2048", "encr",
+                        _passphrase) ||
+        mock_subkey_add(homedir, fprs[ALICE], "rsa2048", "auth",
+                        _passphrase) ||
+        mock_key_create(homedir, "bob <bob@example.com>", "ed25519", "sign",
+                        _passphrase, fprs[BOB], 41) ||
+        mock_subkey_add(homedir, fprs[BOB], "cv25519", "encr", _passphrase) ||
+        mock_key_create(homedir, "carol <carol@example.com>", "ed25519",
+                        "sign", _passphrase, fprs[CAROL], 41) ||
+        mock_subkey_add(homedir, fprs[CAROL], "cv25519", "encr",
+                        _passphrase);
+
+    // FINGERPRINT.asc files only, whatever the case of the name
+    for (int i = 0; i < 3 && !err; ++i) {
+        snprintf(name, sizeof(name), "%.40s.asc", fprs[i]);
+        for (char* c = name; i == BOB && *c; ++c)
+            *c = (char)tolower((unsigned char)*c);
+        err = export_secret(homedir, fprs[i], name);
+    }
+    if (!err)
+        err = write_file(homedir, CORRUPTED ".asc", "not a key\n") ||
+              write_file(homedir, "notes.txt", "not a key\n") ||
+              write_file(homedir, "FFFFFFFF.asc", "not a key\n");
+
+    if (!err)
+        err = mock_keyring_available(fprs[ALICE]) ? TEST_SKIPPED
+                                                  : test_renew(homedir, fprs);
+
+    mock_card_destroy(homedir);
+
+    return err;
+}
@@ -0,0 +1,197 @@
+/*
+Copyright (C) 2016 Aurelien Vallee
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <yubimgr/yubimgr.h>
+#include <yubimgr/audit.h>
+#include <yubimgr/logging.h>
+#include <yubimgr/metrics.h>
+#include <yubimgr/simulate.h>
+#include <yubimgr/timeout.h>
+
+#include "check.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define CARDS 10
+#define READERS 2
+
+// Every recorded reset took between 5 and 10 seconds
+static int write_model(const char* path, int failures)
+{
+    FILE* file = fopen(path, "w");
+    if (!file)
+        return 1;
+
+    fprintf(file,
+            "# TYPE yubimgr_phase_failures_total counter\n"
+            "yubimgr_phase_failures_total{phase=\"reset\"} %d\n"
+            "# TYPE yubimgr_phase_duration_seconds histogram\n"
+            "yubimgr_phase_duration_seconds_bucket"
+            "{phase=\"reset\",le=\"5\"} 0\n"
+            "yubimgr_phase_duration_seconds_bucket"
+            "{phase=\"reset\",le=\"10\"} 100\n"
+            "yubimgr_phase_duration_seconds_bucket"
+            "{phase=\"reset\",le=\"+Inf\"} 100\n"
+            "yubimgr_phase_duration_seconds_sum{phase=\"reset\"} 750\n"
+            "yubimgr_phase_duration_seconds_count{phase=\"reset\"} 100\n",
+            failures);
+
+    return fclose(file) != 0;
+}
+
+static int reset_card(void __attribute__((unused)) * opaque)
+{
+    return reset();
+}
+
+static int test_capacity(const char* model)
+{
+    struct simulation config = {CARDS, READERS, model, 42};
+    struct simulation_report report;
+
+    CHECK(write_model(model, 0) == 0);
+    CHECK(simulate(&config, reset_card, NULL, &report) == 0);
+
+    CHECK(report.failures == 0);
+    CHECK(report.makespan >= 5.0 * CARDS / READERS);
+    CHECK(report.makespan <= 10.0 * CARDS / READERS);
+    CHECK(report.utilization > 0.5 && report.utilization <= 1.0);
+    CHECK(report.throughput > 0);
+    CHECK(report.max_wait >= report.p95_wait);
+    CHECK(report.p95_wait >= report.mean_wait);
+
+    // The same seed replays the same run
+    struct simulation_report replay;
+    CHECK(simulate(&config, reset_card, NULL, &replay) == 0);
+    CHECK(replay.makespan == report.makespan);
+
+    // One more reader cannot make the intake slower
+    config.readers = READERS + 1;
+    CHECK(simulate(&config, reset_card, NULL, &replay) == 0);
+    CHECK(replay.makespan < report.makespan);
+
+    return 0;
+}
+
+static int test_timeout(const char* model)
+{
+    struct simulation config = {CARDS, READERS, model, 42};
+    struct simulation_report report;
+
+    // Resets are cut at the phase deadline, and do not count as transient
+    CHECK(write_model(model, 0) == 0);
+    set_phase_timeout(PHASE_RESET, 2.0);
+    CHECK(simulate(&config, reset_card, NULL, &report) == 0);
+    set_phase_timeout(PHASE_RESET, DEFAULT_PHASE_TIMEOUT);
+
+    CHECK(report.failures == CARDS);
+    CHECK(report.makespan == 2.0 * CARDS / READERS);
+
+    return 0;
+}
+
+static int test_failures(const char* model)
+{
+    struct simulation config = {CARDS, READERS, model, 42};
+    struct simulation_report report;
+
+    // Failed attempts are retried, and still occupy the reader
+    CHECK(write_model(model, 100) == 0);
+    CHECK(simulate(&config, reset_card, NULL, &report) == 0);
+
+    CHECK(report.failures == CARDS);
+    CHECK(report.makespan >= 5.0 * 4 * CARDS / READERS);
+
+    return 0;
+}
+
+// Returns 1 if path holds line
+static int has_line(const char* path, const char* expected)
+{
+    char line[256];
+    int found = 0;
+
+    FILE* file = fopen(path, "r");
+    if (!file)
+        return 0;
+    while (!found && fgets(line, sizeof(line), file))
+        found = !strcmp(line, expected);
+    fclose(file);
+
+    return found;
+}
+
+static int test_isolation(const char* model)
+{
+    struct simulation config = {CARDS, READERS, model, 42};
+    struct simulation_report report;
+    char audit_log[64];
+    char metrics[64];
+    struct stat st;
+
+    snprintf(audit_log, sizeof(audit_log), "%s.audit", model);
+    snprintf(metrics, sizeof(metrics), "%s.prom", model);
+
+    // Simulated cards leave no audit record nor metric behind
+    CHECK(write_model(model, 100) == 0);
+    CHECK(set_audit_log(audit_log) == 0);
+    CHECK(simulate(&config, reset_card, NULL, &report) == 0);
+    CHECK(report.failures == CARDS);
+    CHECK(write_metrics(metrics) == 0);
+
+    CHECK(stat(audit_log, &st) != 0 || st.st_size == 0);
+    CHECK(has_line(metrics,
+                   "yubimgr_cards_processed_total{action=\"reset\"} 0\n"));
+    CHECK(has_line(metrics,
+                   "yubimgr_phase_failures_total{phase=\"reset\"} 0\n"));
+    CHECK(has_line(metrics, "yubimgr_phase_duration_seconds_count"
+                            "{phase=\"reset\"} 0\n"));
+    CHECK(has_line(metrics, "yubimgr_card_retries_total 0\n"));
+
+    unlink(audit_log);
+    unlink(metrics);
+
+    return 0;
+}
+
+int main(int __attribute__((unused)) argc, char __attribute__((unused)) ** argv)
+{
+    char model[] = "/tmp/test_simulate.XXXXXX";
+
+    set_log_file(stderr);
+    set_log_level(LOG_LEVEL_WARNING);
+
+    int fd = mkstemp(model);
+    if (fd < 0)
+        return 1;
+    close(fd);
+
+    int err = test_capacity(model) || test_timeout(model) ||
+              test_failures(model) || test_isolation(model);
+
+    unlink(model);
+
+    return err;
+}
@@ -0,0 +1,95 @@
+/*
+Copyright (C) 2016 Aurelien Vallee
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <yubimgr/logging.h>
+
+#include "check.h"
+#include "openpgp.h"
+#include "ssh.h"
+
+#include <gcrypt.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int test_rsa_subkey()
+{
+    // Public subkey packet, RSA with a 128 bits modulus and e=65537
+    static const unsigned char stream[] = {
+        0xce, 0x1d, 0x04, 0x5a, 0x00, 0x00, 0x00, 0x01, 0x00, 0x80, 0xc3,
+        0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b,
+        0x0c, 0x0d, 0x0e, 0x0f, 0x00, 0x11, 0x01, 0x00, 0x01};
+
+    struct openpgp_packet packet;
+    size_t offset = 0;
+    CHECK(openpgp_next_packet(stream, sizeof(stream), &offset, &packet) == 0);
+    CHECK(packet.tag == OPENPGP_TAG_PUBLIC_SUBKEY);
+    CHECK(packet.size == 29);
+    CHECK(offset == sizeof(stream));
+    CHECK(openpgp_next_packet(stream, sizeof(stream), &offset, &packet) == -1);
+
+    char fpr[41];
+    CHECK(openpgp_fingerprint(&packet, fpr) == 0);
+    CHECK(!strcmp(fpr, "BBDFF5C3C3622BCEFB5950AA71F976B3CC929621"));
+
+    char* line = ssh_format_key(&packet, "user@example.com");
+    CHECK(line);
+    CHECK(!strcmp(line,
+                  "ssh-rsa AAAAB3NzaC1yc2EAAAADAQABAAAAEQDDAQIDBAUGBwgJCgsMDQ4P"
+                  " user@example.com\n"));
+    free(line);
+
+    // Truncated packets are rejected
+    offset = 0;
+    CHECK(openpgp_next_packet(stream, sizeof(stream) - 1, &offset, &packet) ==
+          1);
+
+    return 0;
+}
+
+static int test_ed25519_subkey()
+{
+    unsigned char body[51] = {0x04, 0x5a, 0x00, 0x00, 0x00, 0x16, 0x09,
+                              0x2b, 0x06, 0x01, 0x04, 0x01, 0xda, 0x47,
+                              0x0f, 0x01, 0x01, 0x07, 0x40};
+    for (int i = 0; i < 32; ++i)
+        body[19 + i] = i;
+
+    struct openpgp_packet packet = {OPENPGP_TAG_PUBLIC_SUBKEY, body,
+                                    sizeof(body)};
+    char* line = ssh_format_key(&packet, "openpgp:0x12345678");
+    CHECK(line);
+    CHECK(!strcmp(line,
+                  "ssh-ed25519 AAAAC3NzaC1lZDI1NTE5AAAAIAABAgMEBQYHCAkKCwwNDg8Q"
+                  "ERITFBUWFxgZGhscHR4f openpgp:0x12345678\n"));
+    free(line);
+
+    return 0;
+}
+
+int main(int __attribute__((unused)) argc, char __attribute__((unused)) ** argv)
+{
+    set_log_file(stderr);
+    gcry_check_version(NULL);
+
+    return test_rsa_subkey() || test_ed25519_subkey();
+}
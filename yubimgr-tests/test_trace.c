@@ -0,0 +1,222 @@
+/*
+Copyright (C) 2016 Aurelien Vallee
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <yubimgr/logging.h>
+
+#include "check.h"
+#include "trace_events.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static void skip_space(const char** s)
+{
+    while (**s == ' ' || **s == '\n' || **s == '\r' || **s == '\t')
+        ++*s;
+}
+
+static int skip_string(const char** s)
+{
+    if (**s != '"')
+        return 1;
+
+    for (++*s; **s != '"'; ++*s) {
+        // Control characters, the terminator included, must be escaped
+        if ((unsigned char)**s < 0x20)
+            return 1;
+        if (**s != '\\')
+            continue;
+        ++*s;
+        if (**s == 'u') {
+            for (int i = 0; i < 4; ++i)
+                if (!isxdigit((unsigned char)*++*s))
+                    return 1;
+        } else if (!**s || !strchr("\"\\/bfnrt", **s)) {
+            return 1;
+        }
+    }
+    ++*s;
+
+    return 0;
+}
+
+// Skips a JSON value, returns 0 when it is well formed
+static int skip_value(const char** s)
+{
+    skip_space(s);
+
+    if (**s == '{' || **s == '[') {
+        int object = **s == '{';
+        char close = object ? '}' : ']';
+        ++*s;
+        skip_space(s);
+        if (**s == close) {
+            ++*s;
+            return 0;
+        }
+        for (;;) {
+            if (object) {
+                if (skip_string(s))
+                    return 1;
+                skip_space(s);
+                if (**s != ':')
+                    return 1;
+                ++*s;
+            }
+            if (skip_value(s))
+                return 1;
+            skip_space(s);
+            if (**s == close) {
+                ++*s;
+                return 0;
+            }
+            if (**s != ',')
+                return 1;
+            ++*s;
+            skip_space(s);
+        }
+    }
+
+    if (**s == '"')
+        return skip_string(s);
+
+    static const char* const literals[] = {"true", "false", "null"};
+    for (size_t i = 0; i < 3; ++i) {
+        if (!strncmp(*s, literals[i], strlen(literals[i]))) {
+            *s += strlen(literals[i]);
+            return 0;
+        }
+    }
+
+    char* end;
+    strtod(*s, &end);
+    if (end == *s)
+        return 1;
+    *s = end;
+
+    return 0;
+}
+
+static char* read_trace(const char* path)
+{
+    static char buffer[65536];
+
+    FILE* file = fopen(path, "r");
+    if (!file)
+        return NULL;
+    size_t size  = fread(buffer, 1, sizeof(buffer) - 1, file);
+    buffer[size] = 0;
+    fclose(file);
+
+    return buffer;
+}
+
+static int test_trace(const char* path)
+{
+    char expected[256];
+    char tmp_path[300];
+
+    start_trace();
+
+    // Outside of any card
+    trace_span(PHASE_SETUP, 9.0, 1.0, 0);
+
+    // Special characters are escaped, the serial is appended once
+    trace_reader(1);
+    trace_card("jdoe \"q\"\\\nx");
+    trace_card_serial("12345678");
+    trace_card_serial("12345678");
+    trace_span(PHASE_RESET, 10.0, 0.5, 0);
+
+    // Cards of the first reader, then without a known serial
+    trace_reader(0);
+    trace_card("status");
+    trace_card_serial("");
+    trace_span(PHASE_STATUS, 10.25, 0.25, 1);
+
+    CHECK(write_trace(path) == 0);
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    CHECK(access(tmp_path, F_OK) != 0);
+
+    const char* json = read_trace(path);
+    CHECK(json);
+    const char* end = json;
+    CHECK(skip_value(&end) == 0);
+    skip_space(&end);
+    CHECK(!*end);
+
+    // Readers are processes, cards their threads
+    CHECK(strstr(json, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,"
+                       "\"args\":{\"name\":\"reader 1\"}}"));
+    CHECK(strstr(json, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":2,"
+                       "\"args\":{\"name\":\"reader 2\"}}"));
+    CHECK(strstr(json, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+                       "\"tid\":0,\"args\":{\"name\":\"host\"}}"));
+    CHECK(strstr(json, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":2,"
+                       "\"tid\":1,\"args\":{\"name\":"
+                       "\"jdoe \\\"q\\\"\\\\\\u000ax 12345678\"}}"));
+    CHECK(strstr(json, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+                       "\"tid\":2,\"args\":{\"name\":\"status\"}}"));
+
+    // Spans go to the lane of their card, from the earliest one
+    snprintf(expected, sizeof(expected),
+             "{\"name\":\"%s\",\"cat\":\"phase\",\"ph\":\"X\",\"ts\":0,"
+             "\"dur\":1000000,\"pid\":1,\"tid\":0,\"args\":{\"err\":0}}",
+             phase_name(PHASE_SETUP));
+    CHECK(strstr(json, expected));
+    snprintf(expected, sizeof(expected),
+             "{\"name\":\"%s\",\"cat\":\"phase\",\"ph\":\"X\","
+             "\"ts\":1000000,\"dur\":500000,\"pid\":2,\"tid\":1,"
+             "\"args\":{\"err\":0}}",
+             phase_name(PHASE_RESET));
+    CHECK(strstr(json, expected));
+    snprintf(expected, sizeof(expected),
+             "{\"name\":\"%s\",\"cat\":\"phase\",\"ph\":\"X\","
+             "\"ts\":1250000,\"dur\":250000,\"pid\":1,\"tid\":2,"
+             "\"args\":{\"err\":1}}",
+             phase_name(PHASE_STATUS));
+    CHECK(strstr(json, expected));
+
+    return 0;
+}
+
+int main(int __attribute__((unused)) argc, char __attribute__((unused)) ** argv)
+{
+    char dir[] = "/tmp/test_trace.XXXXXX";
+    char path[64];
+
+    set_log_file(stderr);
+    set_log_level(LOG_LEVEL_DEBUG);
+
+    if (!mkdtemp(dir))
+        return 1;
+    snprintf(path, sizeof(path), "%s/trace.json", dir);
+
+    int err = test_trace(path);
+
+    unlink(path);
+    rmdir(dir);
+
+    return err;
+}
@@ -0,0 +1,223 @@
+/*
+Copyright (C) 2016 Aurelien Vallee
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <yubimgr/logging.h>
+
+#include "check.h"
+#include "openpgp.h"
+#include "string_table.h"
+#include "wkd.h"
+
+#include <gcrypt.h>
+
+#include <locale.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define KEY_SIZE 31
+#define USER_ID_SIZE 9
+
+// Appends an old format public key (or subkey) packet, RSA with a 128 bits
+// modulus, of which id is the first byte
+static size_t put_key(unsigned char* out, int tag, unsigned char id)
+{
+    static const unsigned char body[] = {
+        0x04, 0x5a, 0x00, 0x00, 0x00, 0x01, 0x00, 0x80, 0xc3, 0x01,
+        0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b,
+        0x0c, 0x0d, 0x0e, 0x0f, 0x00, 0x11, 0x01, 0x00, 0x01};
+
+    out[0] = 0x80 | (tag << 2);
+    out[1] = sizeof(body);
+    memcpy(out + 2, body, sizeof(body));
+    out[10] = id;
+
+    return KEY_SIZE;
+}
+
+static size_t put_user_id(unsigned char* out, const char* name)
+{
+    out[0] = 0x80 | (OPENPGP_TAG_USER_ID << 2);
+    out[1] = 7;
+    memcpy(out + 2, name, 7);
+
+    return USER_ID_SIZE;
+}
+
+static int fingerprint(const unsigned char* key, char* fpr)
+{
+    struct openpgp_packet packet;
+    size_t offset = 0;
+
+    return openpgp_next_packet(key, KEY_SIZE, &offset, &packet) ||
+           openpgp_fingerprint(&packet, fpr);
+}
+
+static int test_entry()
+{
+    struct wkd_entry entry;
+    struct wkd_entry folded;
+
+    // Web Key Directory example from draft-koch-openpgp-webkey-service
+    CHECK(wkd_entry_init(&entry, "Joe.Doe@Example.ORG") == 0);
+    CHECK(!strcmp(entry.domain, "example.org"));
+    CHECK(!strcmp(entry.hash, "iy9q119eutrkn8s1mk4r39qejnbu3n5q"));
+
+    // Folding is plain ASCII whatever the locale (tolower('I') is not 'i'
+    // in Turkish)
+    setlocale(LC_CTYPE, "tr_TR.ISO-8859-9");
+    CHECK(wkd_entry_init(&folded, "JOE.DOE@EXAMPLE.ORG") == 0);
+    setlocale(LC_CTYPE, "C");
+    CHECK(!strcmp(folded.domain, entry.domain));
+    CHECK(!strcmp(folded.hash, entry.hash));
+
+    // Only ASCII is folded
+    CHECK(wkd_entry_init(&folded, "J\xc3\x96" "E.doe@example.org") == 0);
+    CHECK(strcmp(folded.hash, entry.hash));
+
+    // Domains must be a single path component
+    CHECK(wkd_entry_init(&entry, NULL) != 0);
+    CHECK(wkd_entry_init(&entry, "joe.doe") != 0);
+    CHECK(wkd_entry_init(&entry, "@example.org") != 0);
+    CHECK(wkd_entry_init(&entry, "joe.doe@") != 0);
+    CHECK(wkd_entry_init(&entry, "joe.doe@.example.org") != 0);
+    CHECK(wkd_entry_init(&entry, "joe.doe@example.org/hu") != 0);
+
+    return 0;
+}
+
+// Reads path into out, returns its size or -1
+static long read_file(const char* path, unsigned char* out, size_t size)
+{
+    FILE* file = fopen(path, "rb");
+    if (!file)
+        return -1;
+    size_t read = fread(out, 1, size, file);
+    fclose(file);
+
+    return (long)read;
+}
+
+static int test_publish(const char* dir)
+{
+    unsigned char stream[8 * KEY_SIZE];
+    unsigned char file[sizeof(stream)];
+    char fprs[3][41];
+    char path[1024];
+    size_t size = 0;
+
+    // Key 0 has a subkey, key 2 is not listed, key 1 is missing
+    size_t starts[3];
+    starts[0] = size;
+    size += put_key(stream + size, OPENPGP_TAG_PUBLIC_KEY, 0xc0);
+    size += put_user_id(stream + size, "joe.doe");
+    size += put_key(stream + size, OPENPGP_TAG_PUBLIC_SUBKEY, 0xc1);
+    starts[2] = size;
+    size += put_key(stream + size, OPENPGP_TAG_PUBLIC_KEY, 0xc2);
+    size += put_user_id(stream + size, "unknown");
+    starts[1] = size;
+    size += put_key(stream + size, OPENPGP_TAG_PUBLIC_KEY, 0xc3);
+    size += put_user_id(stream + size, "someone");
+    size_t end = size;
+
+    for (int i = 0; i < 3; ++i)
+        CHECK(fingerprint(stream + starts[i], fprs[i]) == 0);
+
+    struct string_table table;
+    struct key_block blocks[3] = {{0, 0}, {0, 0}, {0, 0}};
+    CHECK(string_table_init(&table, 3) == 0);
+    string_table_insert(&table, fprs[0], 0);
+    string_table_insert(&table, fprs[1], 1);
+    CHECK(split_keys(stream, size, &table, blocks, 2) == 0);
+
+    // Blocks span a key up to the next one, subkeys included
+    CHECK(blocks[0].start == starts[0] && blocks[0].end == starts[2]);
+    CHECK(blocks[1].start == starts[1] && blocks[1].end == end);
+
+    // Truncated streams are rejected
+    CHECK(split_keys(stream, size - 1, &table, blocks, 2) != 0);
+    string_table_release(&table);
+
+    // Two keys share an address, one is alone under another domain
+    struct wkd_entry entries[3];
+    CHECK(wkd_entry_init(&entries[0], "bob@other.test") == 0);
+    CHECK(wkd_entry_init(&entries[1], "joe.doe@example.org") == 0);
+    CHECK(wkd_entry_init(&entries[2], "Joe.Doe@Example.org") == 0);
+    entries[0].key = 0;
+    entries[1].key = 1;
+    entries[2].key = 0;
+    char bob[sizeof(entries[0].hash)];
+    strcpy(bob, entries[0].hash);
+
+    size_t updated   = 0;
+    size_t unchanged = 0;
+    CHECK(wkd_publish(dir, (const char*)stream, blocks, entries, 3, &updated,
+                      &unchanged) == 0);
+    CHECK(updated == 2 && unchanged == 0);
+
+    snprintf(path, sizeof(path), "%s/example.org/policy", dir);
+    CHECK(read_file(path, file, sizeof(file)) == 0);
+    snprintf(path, sizeof(path), "%s/other.test/policy", dir);
+    CHECK(read_file(path, file, sizeof(file)) == 0);
+
+    // Keys of the same address are concatenated in key order
+    size_t first  = blocks[0].end - blocks[0].start;
+    size_t second = blocks[1].end - blocks[1].start;
+    snprintf(path, sizeof(path),
+             "%s/example.org/hu/iy9q119eutrkn8s1mk4r39qejnbu3n5q", dir);
+    CHECK(read_file(path, file, sizeof(file)) == (long)(first + second));
+    CHECK(!memcmp(file, stream + blocks[0].start, first));
+    CHECK(!memcmp(file + first, stream + blocks[1].start, second));
+
+    snprintf(path, sizeof(path), "%s/other.test/hu/%s", dir, bob);
+    CHECK(read_file(path, file, sizeof(file)) == (long)first);
+    CHECK(!memcmp(file, stream + blocks[0].start, first));
+
+    // Publishing the same keys again leaves every file untouched
+    updated = 0;
+    CHECK(wkd_publish(dir, (const char*)stream, blocks, entries, 3, &updated,
+                      &unchanged) == 0);
+    CHECK(updated == 0 && unchanged == 2);
+
+    return 0;
+}
+
+int main(int __attribute__((unused)) argc, char __attribute__((unused)) ** argv)
+{
+    char dir[] = "/tmp/test_wkd.XXXXXX";
+    char command[64];
+
+    set_log_file(stderr);
+    gcry_check_version(NULL);
+
+    if (!mkdtemp(dir))
+        return 1;
+
+    int err = test_entry() || test_publish(dir);
+
+    snprintf(command, sizeof(command), "rm -rf %s", dir);
+    if (system(command))
+        err = 1;
+
+    return err;
+}